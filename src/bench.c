@@ -0,0 +1,305 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lisp.h"
+#include "reader.h"
+
+/*
+ * Benchmark harness. Every result is printed as a single line of
+ * key=value pairs, for example
+ *
+ *   benchmark=fib kind=lisp iterations=5 wall_ms=... allocations=... gcs=5 gc_ms=...
+ *
+ * so that runs from different commits can be compared with a script.
+ * Lisp benchmarks are run the way the REPL runs a form: eval() followed by
+ * a collection. Naming benchmarks on the command line runs only those.
+ */
+
+typedef struct {
+  char *name;
+  char *file;                   /* loaded once, before timing */
+  char *form;                   /* evaluated once per iteration */
+  int iterations;
+} lisp_benchmark_t;
+
+static lisp_benchmark_t lisp_benchmarks[] = {
+  {"fib", "bench/fib.lisp", "(fib 18)", 5},
+  {"tak", "bench/tak.lisp", "(tak 18 12 6)", 5},
+  {"nqueens", "bench/nqueens.lisp", "(nqueens 7)", 5},
+  {"sort", "bench/sort.lisp", "(merge-sort sort-input)", 20},
+  {"deep-recursion", "bench/recursion.lisp", "(deep-recursion 5000)", 20},
+  {"macros", "bench/macros.lisp", "(classify-all 20)", 5},
+  {NULL, NULL, NULL, 0}
+};
+
+/* a snapshot of the counters a benchmark is measured against */
+typedef struct {
+  double wall_ms;
+  size_t allocations;
+  size_t gcs;
+  double gc_ms;
+} measurement_t;
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static measurement_t measure() {
+  const memory_stats_t *stats = memory_stats();
+  measurement_t m = {now_ms(), allocation_count(), stats->gc_count, stats->total_pause_ms};
+
+  return m;
+}
+
+static void report(const char *name, const char *kind, long iterations, measurement_t start) {
+  measurement_t end = measure();
+
+  printf("benchmark=%s kind=%s iterations=%ld wall_ms=%.3f allocations=%zu gcs=%zu gc_ms=%.3f\n",
+         name, kind, iterations, end.wall_ms - start.wall_ms,
+         end.allocations - start.allocations, end.gcs - start.gcs, end.gc_ms - start.gc_ms);
+  fflush(stdout);
+}
+
+static int selected(const char *name, int argc, char **argv) {
+  if (argc < 2)
+    return 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], name))
+      return 1;
+  }
+
+  return 0;
+}
+
+static lisp_object_t* parse(const char *text) {
+  lisp_reader_t *reader = make_memory_reader(text, strlen(text));
+  lisp_object_t *form = read_form(reader);
+  free_reader(reader);
+
+  return form;
+}
+
+static lisp_object_t* load_file(const char *path, lisp_object_t *env) {
+  lisp_object_t *path_o = make_string(strdup(path));
+
+  return eval(make_cons(intern("load", 4), make_cons(path_o, NIL)), env);
+}
+
+static int run_lisp_benchmark(lisp_benchmark_t *benchmark, lisp_object_t *env) {
+  if (!load_file(benchmark->file, env)) {
+    fprintf(stderr, "Error: unable to load %s.\n", benchmark->file);
+    return 1;
+  }
+
+  lisp_object_t *form = parse(benchmark->form);
+
+  /* keeps the form alive across the collections below */
+  nice_set("*benchmark-form*", form, env);
+  do_gc(env);
+
+  measurement_t start = measure();
+
+  for (int i = 0; i < benchmark->iterations; i++) {
+    if (!eval(form, env)) {
+      fprintf(stderr, "Error: benchmark %s failed.\n", benchmark->name);
+      return 1;
+    }
+
+    do_gc(env);
+  }
+
+  report(benchmark->name, "lisp", benchmark->iterations, start);
+
+  return 0;
+}
+
+/* Writes count data forms to a temporary file for the load benchmark */
+static char* write_data_file(int count) {
+  char *path = strdup("/tmp/maxlisp-bench-XXXXXX");
+  int fd = mkstemp(path);
+  FILE *file = fd < 0 ? NULL : fdopen(fd, "w");
+
+  if (!file) {
+    fprintf(stderr, "Error: unable to create a data file.\n");
+    exit(1);
+  }
+
+  for (int i = 0; i < count; i++)
+    fprintf(file, "(quote (record %d \"name %d\" (%d.5 %d) (nested (list of symbols))))\n",
+            i, i, i, i);
+
+  fclose(file);
+
+  return path;
+}
+
+static void bench_load(lisp_object_t *env) {
+  char *path = write_data_file(20000);
+  measurement_t start = measure();
+
+  if (!load_file(path, env))
+    fprintf(stderr, "Error: unable to load %s.\n", path);
+
+  do_gc(env);
+  report("load", "lisp", 1, start);
+
+  remove(path);
+  free(path);
+}
+
+static void bench_make_cons(lisp_object_t *env) {
+  long count = 1000000;
+  measurement_t start = measure();
+
+  lisp_object_t *list = NIL;
+  for (long i = 0; i < count; i++)
+    list = make_cons(NIL, list);
+
+  report("make_cons", "c", count, start);
+  do_gc(env);
+}
+
+/* what a data cons costs, counting its object and reference, and how much
+   of that is the cache only call sites and lambda forms use */
+static void bench_cons_memory(lisp_object_t *env) {
+  long count = 1000000;
+  const memory_stats_t *stats = memory_stats();
+  size_t bytes = stats->bytes[ALLOC_CONS];
+
+  lisp_object_t *list = NIL;
+  for (long i = 0; i < count; i++)
+    list = make_cons(NIL, list);
+
+  bytes = stats->bytes[ALLOC_CONS] - bytes;
+  printf("benchmark=cons_memory kind=c conses=%ld bytes_per_cons=%.1f cache_bytes_per_cons=%zu\n",
+         count, (double) bytes / count, sizeof(((cons*) NULL)->cache));
+  fflush(stdout);
+  do_gc(env);
+}
+
+static void bench_get(lisp_object_t *env) {
+  long count = 100000;
+
+  /* new globals go last, so every lookup walks the whole environment */
+  lisp_object_t *symbol = intern("*benchmark-get*", 15);
+  nice_set("*benchmark-get*", T, env);
+
+  measurement_t start = measure();
+
+  for (long i = 0; i < count; i++) {
+    if (!get(symbol, env)) {
+      fprintf(stderr, "Error: get found no binding.\n");
+      return;
+    }
+  }
+
+  report("get", "c", count, start);
+}
+
+static void bench_do_gc(lisp_object_t *env) {
+  long count = 20;
+
+  lisp_object_t *list = NIL;
+  for (long i = 0; i < 100000; i++)
+    list = make_cons(make_number(i), list);
+
+  nice_set("*benchmark-live*", list, env);
+  do_gc(env);
+
+  measurement_t start = measure();
+
+  for (long i = 0; i < count; i++)
+    do_gc(env);
+
+  report("do_gc", "c", count, start);
+
+  nice_set("*benchmark-live*", NIL, env);
+  do_gc(env);
+}
+
+static void bench_reader(lisp_object_t *env) {
+  lisp_writer_t writer;
+  init_string_writer(&writer);
+
+  for (int i = 0; i < 20000; i++) {
+    char line[128];
+    int length = snprintf(line, sizeof(line),
+                          "(define-record %d \"string %d\" (%d.25 -%d) symbol-%d)\n",
+                          i, i, i, i, i % 100);
+    writer_write(&writer, line, length);
+  }
+
+  char *text = writer_finish(&writer);
+  long forms = 0;
+  measurement_t start = measure();
+
+  lisp_reader_t *reader = make_memory_reader(text, strlen(text));
+  while (read_form(reader))
+    forms++;
+  free_reader(reader);
+
+  report("reader", "c", forms, start);
+
+  free(text);
+  do_gc(env);
+}
+
+/* building strings through the printer, the runtime's only string builder */
+static void bench_print(lisp_object_t *env) {
+  long count = 20;
+
+  lisp_object_t *list = NIL;
+  for (long i = 0; i < 10000; i++)
+    list = make_cons(make_cons(make_number(i), make_cons(intern("item", 4), NIL)), list);
+
+  measurement_t start = measure();
+
+  for (long i = 0; i < count; i++)
+    print_object(list);
+
+  report("print", "c", count, start);
+  do_gc(env);
+}
+
+int main(int argc, char **argv) {
+  lisp_object_t *env = init_lisp_module();
+
+  if (!env)
+    return 1;
+
+  for (lisp_benchmark_t *benchmark = lisp_benchmarks; benchmark->name; benchmark++) {
+    if (selected(benchmark->name, argc, argv) && run_lisp_benchmark(benchmark, env) != 0)
+      return 1;
+  }
+
+  if (selected("load", argc, argv))
+    bench_load(env);
+
+  if (selected("make_cons", argc, argv))
+    bench_make_cons(env);
+
+  if (selected("cons_memory", argc, argv))
+    bench_cons_memory(env);
+
+  if (selected("get", argc, argv))
+    bench_get(env);
+
+  if (selected("do_gc", argc, argv))
+    bench_do_gc(env);
+
+  if (selected("reader", argc, argv))
+    bench_reader(env);
+
+  if (selected("print", argc, argv))
+    bench_print(env);
+
+  return 0;
+}
@@ -0,0 +1,5 @@
+;;; Doubly recursive fibonacci: calls and arithmetic
+(defun fib (n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
@@ -0,0 +1,14 @@
+;;; Macro-heavy code: let* and cond are expanded on every call
+(defun classify (n)
+  (let* ((half (/ n 2))
+         (double (* n 2))
+         (sum (+ half double)))
+    (cond ((< sum 10) 'small)
+          ((< sum 100) 'medium)
+          ((< sum 1000) 'large)
+          (t 'huge))))
+
+(defun classify-all (n)
+  (if (eq n 0)
+      nil
+      (cons (classify n) (classify-all (- n 1)))))
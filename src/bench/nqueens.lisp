@@ -0,0 +1,25 @@
+;;; Counts the solutions to the n queens problem. Written with plain if so
+;;; that it measures the search rather than macro expansion.
+(defun queen-safe? (column placed distance)
+  (if (nil? placed)
+      t
+      (if (eq (car placed) column)
+          nil
+          (if (eq (car placed) (+ column distance))
+              nil
+              (if (eq (car placed) (- column distance))
+                  nil
+                  (queen-safe? column (cdr placed) (+ distance 1)))))))
+
+(defun queens-from (n row column placed)
+  (if (eq row n)
+      1
+      (if (eq column n)
+          0
+          (+ (if (queen-safe? column placed 1)
+                 (queens-from n (+ row 1) 0 (cons column placed))
+                 0)
+             (queens-from n row (+ column 1) placed)))))
+
+(defun nqueens (n)
+  (queens-from n 0 0 nil))
@@ -0,0 +1,13 @@
+;;; Deep recursion: builds and measures a long list without tail calls
+(defun count-up (n)
+  (if (eq n 0)
+      nil
+      (cons n (count-up (- n 1)))))
+
+(defun sum-list (seq)
+  (if (nil? seq)
+      0
+      (+ (car seq) (sum-list (cdr seq)))))
+
+(defun deep-recursion (n)
+  (sum-list (count-up n)))
@@ -0,0 +1,31 @@
+;;; Merge sort of a list interleaving ascending and descending runs
+(defun zigzag (low high)
+  (if (< high low)
+      nil
+      (cons low (cons high (zigzag (+ low 1) (- high 1))))))
+
+(defun merge-lists (a b)
+  (if (nil? a)
+      b
+      (if (nil? b)
+          a
+          (if (< (car b) (car a))
+              (cons (car b) (merge-lists a (cdr b)))
+              (cons (car a) (merge-lists (cdr a) b))))))
+
+(defun split-evens (seq)
+  (if (nil? seq)
+      nil
+      (if (nil? (cdr seq))
+          seq
+          (cons (car seq) (split-evens (cdr (cdr seq)))))))
+
+(defun merge-sort (seq)
+  (if (nil? seq)
+      seq
+      (if (nil? (cdr seq))
+          seq
+          (merge-lists (merge-sort (split-evens seq))
+                       (merge-sort (split-evens (cdr seq)))))))
+
+(setq sort-input (zigzag 1 200))
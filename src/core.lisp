@@ -195,3 +195,22 @@
   (lambda (n . rest)
     (apply f  (append initial-args
                       (cons n rest)))))
+
+;;; NON-LOCAL EXITS
+
+(defmacro catch (--catch-tag . body)
+  `(primitive-catch ,--catch-tag (lambda () ,@body)))
+
+(defmacro unwind-protect (--protected-form . cleanup-forms)
+  `(primitive-unwind-protect (lambda () ,--protected-form)
+                             (lambda () ,@cleanup-forms)))
+
+;;; OUTPUT
+
+(defmacro with-output-to-string (--output-form . body)
+  `(primitive-with-output-to-string (lambda () ,--output-form ,@body)))
+
+;;; GREEN THREADS
+
+(defmacro future (--future-form)
+  `(primitive-future (lambda () ,--future-form)))
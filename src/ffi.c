@@ -0,0 +1,209 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dlfcn.h>
+
+#include "lisp.h"
+#include "ffi.h"
+
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(_WIN32)
+#define FFI_SUPPORTED 1
+#endif
+
+/* what the calling conventions pass in registers */
+#define MAX_INTEGER_ARGS 6
+#define MAX_DOUBLE_ARGS 8
+
+typedef enum {
+  FFI_VOID,
+  FFI_INT,
+  FFI_LONG,
+  FFI_DOUBLE,
+  FFI_POINTER,
+  FFI_STRING
+} ffi_type;
+
+typedef struct {
+  void *library;
+  void (*function)(void);
+  char *name;
+  ffi_type result;
+  size_t argc;
+  ffi_type args[MAX_INTEGER_ARGS + MAX_DOUBLE_ARGS];
+} ffi_binding_t;
+
+/*
+ * Integers and pointers go in one set of registers and doubles in
+ * another, each in order of appearance, whichever way they interleave.
+ * So any function we support can be called as one taking every integer
+ * register and then every double one; the callee just ignores the rest.
+ * Only the result's register depends on the declared type.
+ */
+typedef long (*integer_call)(long, long, long, long, long, long,
+                             double, double, double, double, double, double, double, double);
+typedef double (*double_call)(long, long, long, long, long, long,
+                              double, double, double, double, double, double, double, double);
+
+static const char *type_names[] = {"void", "int", "long", "double", "pointer", "string"};
+
+static int parse_type(lisp_object_t *symbol, ffi_type *type) {
+  if (symbol->type != SYMBOL)
+    return 0;
+
+  for (size_t i = 0; i < sizeof(type_names) / sizeof(type_names[0]); i++) {
+    if (!strcmp(symbol->datum.symbol, type_names[i])) {
+      *type = (ffi_type) i;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void free_binding(void *data) {
+  ffi_binding_t *binding = data;
+
+  dlclose(binding->library);
+  free(binding->name);
+  free(binding);
+}
+
+static long integer_arg(ffi_binding_t *binding, ffi_type type, lisp_object_t *arg, size_t i) {
+  switch (type) {
+  case FFI_INT:
+  case FFI_LONG:
+    if (arg->type != NUMBER)
+      break;
+
+    return (long) arg->datum.number;
+
+  case FFI_POINTER:
+    if (arg == NIL)
+      return 0;
+    else if (arg->type == BYTES)
+      return (long) (intptr_t) arg->datum.bytes->data;
+    else if (arg->type == STRING)
+      return (long) (intptr_t) arg->datum.string;
+
+    break;
+
+  case FFI_STRING:
+    if (arg->type != STRING)
+      break;
+
+    return (long) (intptr_t) arg->datum.string;
+
+  default:
+    break;
+  }
+
+  lisp_error("%s expects argument %lu to be of type %s.", binding->name,
+             (unsigned long) i + 1, type_names[type]);
+}
+
+static lisp_object_t* call_foreign(lisp_object_t **args, size_t argc, void *data) {
+  ffi_binding_t *binding = data;
+  long integers[MAX_INTEGER_ARGS] = {0};
+  double doubles[MAX_DOUBLE_ARGS] = {0};
+  size_t integer_count = 0;
+  size_t double_count = 0;
+
+  for (size_t i = 0; i < argc; i++) {
+    if (binding->args[i] != FFI_DOUBLE) {
+      integers[integer_count++] = integer_arg(binding, binding->args[i], args[i], i);
+    } else if (args[i]->type == NUMBER) {
+      doubles[double_count++] = args[i]->datum.number;
+    } else {
+      return lisp_error("%s expects argument %lu to be of type double.", binding->name,
+                        (unsigned long) i + 1);
+    }
+  }
+
+  if (binding->result == FFI_DOUBLE) {
+    double_call function = (double_call) binding->function;
+
+    return make_number(function(integers[0], integers[1], integers[2], integers[3],
+                                integers[4], integers[5], doubles[0], doubles[1], doubles[2],
+                                doubles[3], doubles[4], doubles[5], doubles[6], doubles[7]));
+  }
+
+  integer_call function = (integer_call) binding->function;
+  long result = function(integers[0], integers[1], integers[2], integers[3], integers[4],
+                         integers[5], doubles[0], doubles[1], doubles[2], doubles[3],
+                         doubles[4], doubles[5], doubles[6], doubles[7]);
+
+  switch (binding->result) {
+  case FFI_INT:
+    return make_number((int) result);
+
+  case FFI_LONG:
+    return make_number(result);
+
+  case FFI_STRING:
+    return result ? make_string(strdup((char*) (intptr_t) result)) : NIL;
+
+  default:
+    return NIL;
+  }
+}
+
+lisp_object_t* ffi_bind(const char *path, const char *symbol, lisp_object_t *result_type,
+                        lisp_object_t *arg_types) {
+#ifndef FFI_SUPPORTED
+  (void) path;
+  (void) symbol;
+  (void) result_type;
+  (void) arg_types;
+
+  return lisp_error("foreign-function isn't supported on this platform.");
+#else
+  ffi_binding_t binding;
+  size_t integer_count = 0;
+  size_t double_count = 0;
+
+  memset(&binding, 0, sizeof(binding));
+
+  if (!parse_type(result_type, &binding.result) || binding.result == FFI_POINTER)
+    return lisp_error("foreign-function given an unknown result type.");
+
+  for (; arg_types != NIL && arg_types->type == CONS; arg_types = CONS_VALUE(arg_types)->cdr) {
+    ffi_type type;
+
+    if (!parse_type(CONS_VALUE(arg_types)->car, &type) || type == FFI_VOID)
+      return lisp_error("foreign-function given an unknown argument type.");
+
+    if (type == FFI_DOUBLE)
+      double_count++;
+    else
+      integer_count++;
+
+    if (integer_count > MAX_INTEGER_ARGS || double_count > MAX_DOUBLE_ARGS)
+      return lisp_error("foreign-function given too many arguments to pass in registers.");
+
+    binding.args[binding.argc++] = type;
+  }
+
+  binding.library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+  if (!binding.library)
+    return lisp_error("foreign-function unable to load library: %s", dlerror());
+
+  void *address = dlsym(binding.library, symbol);
+
+  if (!address) {
+    dlclose(binding.library);
+    return lisp_error("foreign-function unable to find \"%s\".", symbol);
+  }
+
+  /* ISO C has no cast from an object pointer to a function pointer */
+  memcpy(&binding.function, &address, sizeof(address));
+  binding.name = strdup(symbol);
+
+  ffi_binding_t *copy = xmalloc(sizeof(ffi_binding_t));
+  *copy = binding;
+
+  return make_host_function(symbol, (int) binding.argc, call_foreign, copy, free_binding);
+#endif
+}
@@ -0,0 +1,31 @@
+#ifndef FFI_H
+#define FFI_H
+
+#include "lisp.h"
+
+/*
+ * Calling C functions in shared libraries. A binding is a HOST_FUNCTION
+ * that converts its arguments by the types it was declared with:
+ *
+ *   int, long   a NUMBER, truncated
+ *   double      a NUMBER
+ *   pointer     BYTES, passed as a pointer to their data without copying,
+ *               a STRING, or nil for NULL
+ *   string      a STRING
+ *
+ * and its result the same way, where void returns nil and a NULL string
+ * returns nil. Strings are copied on the way back.
+ *
+ * Arguments are passed in registers without a libffi, so this works on
+ * x86-64 and AArch64 Unix only, for functions of at most 6 integer and
+ * pointer arguments and 8 double ones. Variadic functions aren't
+ * supported.
+ */
+
+/* Returns a function calling symbol in the shared library at path, or in
+   the program itself and the libraries it's linked with when path is
+   NULL. result_type is a SYMBOL and arg_types a list of them. */
+lisp_object_t* ffi_bind(const char *path, const char *symbol, lisp_object_t *result_type,
+                        lisp_object_t *arg_types);
+
+#endif
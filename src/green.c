@@ -0,0 +1,531 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "lisp.h"
+#include "green.h"
+
+/*
+ * Every green thread gets a C stack of its own, so eval() and the natives
+ * can be suspended anywhere they wait, and switching threads is a
+ * swapcontext() plus swapping the VM's evaluator stacks (see lisp_exec_t).
+ * The VM's own thread of evaluation, the one that spawned the rest, takes
+ * part as the scheduler's main thread.
+ */
+
+/* reserved per thread; only the pages a thread touches are ever used */
+#define GREEN_STACK_SIZE (1024 * 1024)
+
+typedef enum {
+  GREEN_RUNNABLE,
+  GREEN_RUNNING,
+  GREEN_BLOCKED,
+  GREEN_FINISHED
+} green_state;
+
+typedef struct green_thread {
+  ucontext_t context;
+  char *stack;                  /* NULL for main and once finished */
+  lisp_exec_t *exec;            /* its evaluator stacks while switched out */
+  green_state state;
+
+  lisp_object_t *thunk;
+  lisp_object_t *result;        /* or the value thrown */
+  lisp_object_t *tag;           /* what it threw to, if failed */
+  int failed;
+  int keep_errors;
+
+  struct green_thread *waiters; /* threads touching this one */
+  struct green_thread *next;    /* in the run queue or a wait list */
+  struct green_thread *live_next;
+
+  lisp_object_t *object;        /* its THREAD, NULL for main */
+  void *stack_low;              /* how far down its C stack is used, while switched out */
+} green_thread_t;
+
+struct green_channel {
+  lisp_object_t *head;          /* the values queued, oldest first */
+  lisp_object_t *tail;
+  size_t length;
+  size_t capacity;
+  green_thread_t *receivers;    /* waiting for a value */
+  green_thread_t *senders;      /* waiting for room */
+};
+
+typedef struct green_scheduler {
+  green_thread_t main;
+  green_thread_t *current;
+  green_thread_t *run_head;
+  green_thread_t *run_tail;
+  green_thread_t *live;         /* the spawned threads that haven't finished */
+  size_t alive;
+  green_thread_t *finished;     /* its stack is freed once we're off it */
+  int deadlocked;               /* main was woken because nothing could run */
+
+  /* events being waited for, and those signalled from other OS threads
+     that haven't woken their waiters yet, under lock */
+  size_t awaited;
+  pthread_mutex_t lock;
+  pthread_cond_t signalled_cond;
+  green_event_t *signalled;
+} green_scheduler_t;
+
+static green_scheduler_t* scheduler() {
+  green_scheduler_t **slot = lisp_vm_scheduler();
+
+  if (!*slot) {
+    green_scheduler_t *s = xmalloc(sizeof(green_scheduler_t));
+
+    memset(s, 0, sizeof(green_scheduler_t));
+    s->main.state = GREEN_RUNNING;
+    s->main.exec = lisp_exec_create();
+    s->current = &s->main;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->signalled_cond, NULL);
+    *slot = s;
+  }
+
+  return *slot;
+}
+
+static void append_thread(green_thread_t **list, green_thread_t *thread) {
+  thread->next = NULL;
+
+  while (*list)
+    list = &(*list)->next;
+
+  *list = thread;
+}
+
+static green_thread_t* pop_thread(green_thread_t **list) {
+  green_thread_t *thread = *list;
+
+  if (thread)
+    *list = thread->next;
+
+  return thread;
+}
+
+static void remove_thread(green_thread_t **list, green_thread_t *thread) {
+  while (*list && *list != thread)
+    list = &(*list)->next;
+
+  if (*list)
+    *list = thread->next;
+}
+
+static void make_runnable(green_scheduler_t *s, green_thread_t *thread) {
+  thread->state = GREEN_RUNNABLE;
+  thread->next = NULL;
+
+  if (s->run_tail)
+    s->run_tail->next = thread;
+  else
+    s->run_head = thread;
+
+  s->run_tail = thread;
+}
+
+static void free_stack(green_thread_t *thread) {
+  if (thread->stack) {
+    munmap(thread->stack, GREEN_STACK_SIZE);
+    thread->stack = NULL;
+  }
+}
+
+/* frees what the last thread to finish ran on, now that we're off it */
+static void reap(green_scheduler_t *s) {
+  green_thread_t *thread = s->finished;
+
+  if (!thread)
+    return;
+
+  s->finished = NULL;
+  free_stack(thread);
+  lisp_exec_destroy(thread->exec);
+  thread->exec = NULL;
+}
+
+/* Its frame lies below its caller's */
+static __attribute__((noinline)) void* stack_pointer() {
+  return __builtin_frame_address(0);
+}
+
+static void switch_to(green_scheduler_t *s, green_thread_t *next) {
+  green_thread_t *current = s->current;
+
+  next->state = GREEN_RUNNING;
+
+  if (next == current)
+    return;
+
+  lisp_exec_save(current->exec);
+  lisp_exec_load(next->exec);
+  s->current = next;
+  current->stack_low = stack_pointer();
+
+  swapcontext(&current->context, &next->context);
+  reap(s);
+}
+
+/* Wakes the waiters of signalled events. With wait, sleeps until there's
+   at least one. */
+static void take_signalled(green_scheduler_t *s, int wait) {
+  pthread_mutex_lock(&s->lock);
+
+  while (wait && !s->signalled)
+    pthread_cond_wait(&s->signalled_cond, &s->lock);
+
+  green_event_t *event = s->signalled;
+  s->signalled = NULL;
+  pthread_mutex_unlock(&s->lock);
+
+  for (; event; event = event->next) {
+    s->awaited--;
+    make_runnable(s, event->waiter);
+  }
+}
+
+/* Passes the VM to the next runnable thread. With none, the current
+   thread must be waiting, and so must main: main is woken to report it. */
+static void run_next(green_scheduler_t *s) {
+  if (s->awaited)
+    take_signalled(s, !s->run_head);
+
+  green_thread_t *next = s->run_head;
+
+  if (next) {
+    s->run_head = next->next;
+
+    if (!s->run_head)
+      s->run_tail = NULL;
+  } else {
+    s->deadlocked = 1;
+    next = &s->main;
+  }
+
+  switch_to(s, next);
+}
+
+/* Suspends the current thread on wait_list until something wakes it */
+static void block(green_scheduler_t *s, green_thread_t **wait_list) {
+  green_thread_t *current = s->current;
+
+  current->state = GREEN_BLOCKED;
+  append_thread(wait_list, current);
+  run_next(s);
+
+  if (s->deadlocked && current == &s->main) {
+    s->deadlocked = 0;
+    remove_thread(wait_list, current);
+    lisp_error("every green thread is waiting on another.");
+  }
+}
+
+static void finish(green_scheduler_t *s, green_thread_t *thread) {
+  green_thread_t **live = &s->live;
+
+  while (*live != thread)
+    live = &(*live)->live_next;
+
+  *live = thread->live_next;
+  s->alive--;
+
+  thread->state = GREEN_FINISHED;
+
+  while (thread->waiters)
+    make_runnable(s, pop_thread(&thread->waiters));
+
+  s->finished = thread;
+  run_next(s);
+}
+
+static void thread_main() {
+  green_scheduler_t *s = *lisp_vm_scheduler();
+  green_thread_t *thread = s->current;
+  escape_point_t point;
+
+  reap(s);
+  push_escape(&point, ESCAPE_CATCH_ALL, NULL);
+
+  if (setjmp(point.jump) == 0) {
+    thread->result = funcall(thread->thunk, NIL);
+  } else {
+    thread->failed = 1;
+    thread->tag = point.tag;
+    thread->result = point.value;
+
+    if (!thread->keep_errors)
+      report_uncaught(point.tag, point.value);
+  }
+
+  pop_escape(&point);
+  finish(s, thread);
+}
+
+lisp_object_t* green_spawn(lisp_object_t *thunk, int keep_errors) {
+  green_scheduler_t *s = scheduler();
+  green_thread_t *thread = xmalloc(sizeof(green_thread_t));
+  long page = sysconf(_SC_PAGESIZE);
+
+  memset(thread, 0, sizeof(green_thread_t));
+  thread->thunk = thunk;
+  thread->keep_errors = keep_errors;
+  thread->exec = lisp_exec_create();
+
+  /* the lowest page is left unmapped to catch overflows */
+  thread->stack = mmap(NULL, GREEN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (thread->stack == MAP_FAILED || mprotect(thread->stack, page, PROT_NONE) != 0
+      || getcontext(&thread->context) != 0) {
+    fprintf(stderr, "Error: unable to make a green thread.\n");
+    exit(1);
+  }
+
+  thread->context.uc_stack.ss_sp = thread->stack;
+  thread->context.uc_stack.ss_size = GREEN_STACK_SIZE;
+  thread->context.uc_link = NULL;
+  makecontext(&thread->context, thread_main, 0);
+
+  thread->live_next = s->live;
+  s->live = thread;
+  s->alive++;
+  make_runnable(s, thread);
+
+  lisp_object_t *object = make_lisp_object();
+  object->type = THREAD;
+  object->datum.thread = thread;
+  thread->object = object;
+
+  return object;
+}
+
+void green_event_init(green_event_t *event) {
+  green_scheduler_t *s = scheduler();
+
+  memset(event, 0, sizeof(green_event_t));
+  event->scheduler = s;
+  event->waiter = s->current;
+  s->awaited++;
+}
+
+void green_wait_event(green_event_t *event) {
+  green_scheduler_t *s = event->scheduler;
+
+  pthread_mutex_lock(&s->lock);
+
+  /* if it's been signalled already, there's nobody to wake */
+  if (event->done) {
+    green_event_t **link = &s->signalled;
+
+    while (*link != event)
+      link = &(*link)->next;
+
+    *link = event->next;
+    s->awaited--;
+    pthread_mutex_unlock(&s->lock);
+    return;
+  }
+
+  pthread_mutex_unlock(&s->lock);
+
+  event->waiter->state = GREEN_BLOCKED;
+  run_next(s);
+}
+
+void green_signal_event(green_event_t *event) {
+  pthread_mutex_lock(&event->scheduler->lock);
+  event->done = 1;
+  event->next = event->scheduler->signalled;
+  event->scheduler->signalled = event;
+  pthread_cond_signal(&event->scheduler->signalled_cond);
+  pthread_mutex_unlock(&event->scheduler->lock);
+}
+
+int green_can_overlap() {
+  green_scheduler_t *s = *lisp_vm_scheduler();
+
+  return s && (s->run_head || s->awaited);
+}
+
+void green_yield() {
+  green_scheduler_t *s = *lisp_vm_scheduler();
+
+  if (!s || !s->run_head)
+    return;
+
+  make_runnable(s, s->current);
+  run_next(s);
+}
+
+lisp_object_t* green_touch(lisp_object_t *object) {
+  green_thread_t *thread = object->datum.thread;
+
+  if (thread->state != GREEN_FINISHED) {
+    green_scheduler_t *s = scheduler();
+
+    if (thread == s->current)
+      return lisp_error("a green thread can't wait for itself.");
+
+    block(s, &thread->waiters);
+  }
+
+  if (thread->failed)
+    throw_to(thread->tag, thread->result);
+
+  return thread->result;
+}
+
+lisp_object_t* green_make_channel(size_t capacity) {
+  struct green_channel *channel = xmalloc(sizeof(struct green_channel));
+
+  memset(channel, 0, sizeof(struct green_channel));
+  channel->head = NIL;
+  channel->tail = NIL;
+  channel->capacity = capacity;
+
+  lisp_object_t *object = make_lisp_object();
+  object->type = CHANNEL;
+  object->datum.channel = channel;
+
+  return object;
+}
+
+void green_send(lisp_object_t *object, lisp_object_t *value) {
+  struct green_channel *channel = object->datum.channel;
+
+  while (channel->capacity && channel->length >= channel->capacity)
+    block(scheduler(), &channel->senders);
+
+  lisp_object_t *cell = make_cons(value, NIL);
+
+  if (channel->tail == NIL)
+    channel->head = cell;
+  else
+    CONS_VALUE(channel->tail)->cdr = cell;
+
+  channel->tail = cell;
+  channel->length++;
+
+  if (channel->receivers)
+    make_runnable(scheduler(), pop_thread(&channel->receivers));
+}
+
+lisp_object_t* green_recv(lisp_object_t *object) {
+  struct green_channel *channel = object->datum.channel;
+
+  while (channel->length == 0)
+    block(scheduler(), &channel->receivers);
+
+  lisp_object_t *cell = channel->head;
+
+  channel->head = CONS_VALUE(cell)->cdr;
+  channel->length--;
+
+  if (channel->head == NIL)
+    channel->tail = NIL;
+
+  if (channel->senders)
+    make_runnable(scheduler(), pop_thread(&channel->senders));
+
+  return CONS_VALUE(cell)->car;
+}
+
+void green_run_pending() {
+  green_scheduler_t *s = *lisp_vm_scheduler();
+
+  if (!s || s->current != &s->main)
+    return;
+
+  while (s->run_head) {
+    make_runnable(s, &s->main);
+    run_next(s);
+  }
+}
+
+int green_threads_alive() {
+  green_scheduler_t *s = *lisp_vm_scheduler();
+
+  return s && s->alive;
+}
+
+void green_mark_threads(void (*mark)(lisp_object_t*), green_stack_marker mark_stack,
+                        void *data) {
+  green_scheduler_t *s = *lisp_vm_scheduler();
+
+  if (!s)
+    return;
+
+  if (s->current != &s->main)
+    mark_stack(s->main.exec, s->main.stack_low, NULL, &s->main.context,
+               sizeof(ucontext_t), data);
+
+  /* a thread that hasn't started yet only has its thunk */
+  for (green_thread_t *thread = s->live; thread; thread = thread->live_next) {
+    mark(thread->object);
+
+    if (thread != s->current && thread->stack_low)
+      mark_stack(thread->exec, thread->stack_low, thread->stack + GREEN_STACK_SIZE,
+                 &thread->context, sizeof(ucontext_t), data);
+  }
+}
+
+char* green_stack_top() {
+  green_scheduler_t *s = *lisp_vm_scheduler();
+
+  if (!s || s->current == &s->main)
+    return NULL;
+
+  return s->current->stack + GREEN_STACK_SIZE;
+}
+
+void green_mark_object(lisp_object_t *object, void (*mark)(lisp_object_t*)) {
+  if (object->type == THREAD) {
+    mark(object->datum.thread->thunk);
+    mark(object->datum.thread->result);
+    mark(object->datum.thread->tag);
+  } else {
+    mark(object->datum.channel->head);
+  }
+}
+
+void green_delete_object(lisp_object_t *object) {
+  if (object->type == THREAD) {
+    free_stack(object->datum.thread);
+    free(object->datum.thread);
+  } else {
+    free(object->datum.channel);
+  }
+}
+
+void green_destroy_scheduler() {
+  green_scheduler_t **slot = lisp_vm_scheduler();
+  green_scheduler_t *s = *slot;
+
+  if (!s)
+    return;
+
+  reap(s);
+
+  /* threads still waiting are dropped where they stand */
+  for (green_thread_t *thread = s->live; thread; thread = thread->live_next) {
+    free_stack(thread);
+    lisp_exec_destroy(thread->exec);
+    thread->exec = NULL;
+    thread->state = GREEN_FINISHED;
+  }
+
+  /* main's stacks are the VM's own */
+  free(s->main.exec);
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->signalled_cond);
+  free(s);
+  *slot = NULL;
+}
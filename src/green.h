@@ -0,0 +1,94 @@
+#ifndef GREEN_H
+#define GREEN_H
+
+#include "lisp.h"
+
+/*
+ * Green threads: many threads of evaluation inside one VM, each with its
+ * own C stack and evaluator stacks, taking turns on the VM's OS thread.
+ * Scheduling is cooperative. A thread runs until it yields, blocks on a
+ * channel or another thread, or finishes, and the runnable ones take
+ * turns in the order they became runnable.
+ */
+
+/* Returns a THREAD that will call thunk with no arguments. Unless
+   keep_errors, whatever the thunk throws is reported like an uncaught
+   error at top level. */
+lisp_object_t* green_spawn(lisp_object_t *thunk, int keep_errors);
+
+/* Lets the other runnable threads run first */
+void green_yield();
+
+/* Waits for thread to finish, returning its result or throwing again
+   what it threw */
+lisp_object_t* green_touch(lisp_object_t *thread);
+
+/* Returns a CHANNEL holding up to capacity values, where 0 means there's
+   no limit */
+lisp_object_t* green_make_channel(size_t capacity);
+
+/* Queues value on channel, waiting while it's full */
+void green_send(lisp_object_t *channel, lisp_object_t *value);
+
+/* Takes the oldest value from channel, waiting while it's empty */
+lisp_object_t* green_recv(lisp_object_t *channel);
+
+/* Something the current thread can wait for while another OS thread does
+ * the work, e.g. a read on the I/O pool:
+ *
+ *   green_event_t event;
+ *   green_event_init(&event);
+ *   ...hand the work and &event over; when done it calls
+ *   green_signal_event(&event)...
+ *   green_wait_event(&event);
+ *
+ * Other green threads run meanwhile. The event must be waited for, even
+ * when it may already be done.
+ */
+typedef struct green_event {
+  int done;
+  struct green_thread *waiter;
+  struct green_scheduler *scheduler;
+  struct green_event *next;
+} green_event_t;
+
+void green_event_init(green_event_t *event);
+
+void green_wait_event(green_event_t *event);
+
+/* Can be called from any OS thread */
+void green_signal_event(green_event_t *event);
+
+/* Would waiting for an event let something else run in the meantime? */
+int green_can_overlap();
+
+/* Runs green threads until none are runnable. eval() calls this after
+   each top-level form. */
+void green_run_pending();
+
+/* Are there green threads that haven't finished? */
+int green_threads_alive();
+
+/* Called by green_mark_threads() for a suspended thread: its evaluator
+   stacks, the part of its C stack in use, [low, high), where high is NULL
+   on the VM's own OS thread stack, and the registers it saved */
+typedef void (*green_stack_marker)(lisp_exec_t *exec, void *low, void *high, void *context,
+                                   size_t context_size, void *data);
+
+/* Marks what the threads that haven't finished are keeping alive, for a
+   collection run by the current thread */
+void green_mark_threads(void (*mark)(lisp_object_t*), green_stack_marker mark_stack,
+                        void *data);
+
+/* Where the current green thread's C stack starts, or NULL on main */
+char* green_stack_top();
+
+/* Marks what a THREAD or CHANNEL refers to */
+void green_mark_object(lisp_object_t *object, void (*mark)(lisp_object_t*));
+
+void green_delete_object(lisp_object_t *object);
+
+/* Frees the current VM's green threads, finished or not */
+void green_destroy_scheduler();
+
+#endif
@@ -0,0 +1,434 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lisp.h"
+#include "image.h"
+
+#define IMAGE_MAGIC "MAXLIMG"
+#define IMAGE_VERSION 2
+#define NO_INDEX UINT32_MAX
+
+/* record types besides the lisp_type values */
+enum {
+  IMAGE_NIL = 100,
+  IMAGE_EOF,
+  IMAGE_LEXICAL_SYMBOL          /* a symbol with SYMBOL_LEXICAL set */
+};
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;         /* guards against a foreign ABI */
+  uint64_t object_count;
+  uint64_t string_bytes;
+  uint64_t root;
+} image_header_t;
+
+/* One per object. Pairs keep their car and cdr as indices into the
+ * record array, names and strings are offsets into the string pool.
+ */
+typedef struct {
+  uint32_t type;
+  uint32_t a;
+  union {
+    uint64_t b;
+    double number;
+  } u;
+} image_record_t;
+
+/* maps objects to their record index while saving */
+typedef struct {
+  lisp_object_t **keys;
+  uint32_t *values;
+  size_t capacity;
+} object_index_t;
+
+static size_t hash_pointer(lisp_object_t *object, size_t capacity) {
+  return (((uintptr_t) object >> 4) * 11400714819323198485ull) & (capacity - 1);
+}
+
+static uint32_t* index_slot(object_index_t *index, lisp_object_t *object) {
+  size_t slot = hash_pointer(object, index->capacity);
+
+  while (index->keys[slot] && index->keys[slot] != object)
+    slot = (slot + 1) & (index->capacity - 1);
+
+  if (!index->keys[slot]) {
+    index->keys[slot] = object;
+    index->values[slot] = NO_INDEX;
+  }
+
+  return &index->values[slot];
+}
+
+static void grow_index(object_index_t *index) {
+  lisp_object_t **old_keys = index->keys;
+  uint32_t *old_values = index->values;
+  size_t old_capacity = index->capacity;
+
+  index->capacity = old_capacity ? old_capacity * 2 : 1024;
+  index->keys = calloc(index->capacity, sizeof(lisp_object_t*));
+  index->values = xmalloc(index->capacity * sizeof(uint32_t));
+
+  if (!index->keys) {
+    fprintf(stderr, "Error: out of memory.\n");
+    exit(1);
+  }
+
+  for (size_t i = 0; i < old_capacity; i++) {
+    if (old_keys[i])
+      *index_slot(index, old_keys[i]) = old_values[i];
+  }
+
+  free(old_keys);
+  free(old_values);
+}
+
+/* growable scratch space for records and the string pool */
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+} image_buffer_t;
+
+static void* buffer_append(image_buffer_t *buffer, const void *data, size_t length) {
+  if (buffer->length + length > buffer->capacity) {
+    while (buffer->length + length > buffer->capacity)
+      buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+
+    buffer->data = realloc(buffer->data, buffer->capacity);
+
+    if (!buffer->data) {
+      fprintf(stderr, "Error: out of memory.\n");
+      exit(1);
+    }
+  }
+
+  void *target = buffer->data + buffer->length;
+
+  if (data)
+    memcpy(target, data, length);
+
+  buffer->length += length;
+
+  return target;
+}
+
+static uint32_t append_name(image_buffer_t *pool, const char *name, uint64_t *length) {
+  size_t offset = pool->length;
+
+  *length = strlen(name);
+  buffer_append(pool, name, *length + 1);
+
+  return (uint32_t) offset;
+}
+
+int write_image(const char *path, lisp_object_t *root) {
+  object_index_t index = {NULL, NULL, 0};
+  lisp_object_t **objects = NULL;
+  size_t object_count = 0;
+  size_t objects_capacity = 0;
+  image_buffer_t records = {NULL, 0, 0};
+  image_buffer_t pool = {NULL, 0, 0};
+  int status = -1;
+
+  /* first we number everything reachable, breadth first */
+  grow_index(&index);
+  objects_capacity = 1024;
+  objects = xmalloc(objects_capacity * sizeof(lisp_object_t*));
+  objects[object_count] = root;
+  *index_slot(&index, root) = object_count++;
+
+  for (size_t i = 0; i < object_count; i++) {
+    lisp_object_t *object = objects[i];
+
+    if (object == NIL ||
+        (object->type != CONS && object->type != LAMBDA && object->type != MACRO))
+      continue;
+
+    lisp_object_t *children[2] = {CONS_VALUE(object)->car, CONS_VALUE(object)->cdr};
+
+    for (int c = 0; c < 2; c++) {
+      if (!children[c])
+        continue;
+
+      if ((object_count + 1) * 2 >= index.capacity)
+        grow_index(&index);
+
+      uint32_t *slot = index_slot(&index, children[c]);
+
+      if (*slot != NO_INDEX)
+        continue;
+
+      if (object_count == NO_INDEX) {
+        fprintf(stderr, "Error: save-image given too many objects.\n");
+        goto cleanup;
+      }
+
+      if (object_count == objects_capacity) {
+        objects_capacity *= 2;
+        objects = realloc(objects, objects_capacity * sizeof(lisp_object_t*));
+
+        if (!objects) {
+          fprintf(stderr, "Error: out of memory.\n");
+          exit(1);
+        }
+      }
+
+      objects[object_count] = children[c];
+      *slot = object_count++;
+    }
+  }
+
+  /* then we write a record per object in that order */
+  for (size_t i = 0; i < object_count; i++) {
+    lisp_object_t *object = objects[i];
+    image_record_t record;
+    const char *native_name = NULL;
+
+    memset(&record, 0, sizeof(record));
+    record.type = object->type;
+
+    if (object == NIL) {
+      record.type = IMAGE_NIL;
+    } else if (object == EOF_OBJECT) {
+      record.type = IMAGE_EOF;
+    } else {
+      switch (object->type) {
+
+      case NUMBER:
+        record.u.number = object->datum.number;
+        break;
+
+      case STRING:
+        record.a = append_name(&pool, object->datum.string, &record.u.b);
+        break;
+
+      case SYMBOL:
+        /* the evaluator relies on the flag to tell which symbols a frame
+           might bind, and the process loading the image may never have
+           bound them itself */
+        if (object->flags & SYMBOL_LEXICAL)
+          record.type = IMAGE_LEXICAL_SYMBOL;
+
+        record.a = append_name(&pool, object->datum.symbol, &record.u.b);
+        break;
+
+      case CONS:
+      case LAMBDA:
+      case MACRO:
+        record.a = CONS_VALUE(object)->car ?
+          *index_slot(&index, CONS_VALUE(object)->car) : NO_INDEX;
+        record.u.b = CONS_VALUE(object)->cdr ?
+          *index_slot(&index, CONS_VALUE(object)->cdr) : NO_INDEX;
+        break;
+
+      case NATIVE_FUNCTION:
+        native_name = native_function_name(object->datum.native_func);
+
+        if (!native_name) {
+          fprintf(stderr, "Error: save-image found an unregistered native function.\n");
+          goto cleanup;
+        }
+
+        record.a = append_name(&pool, native_name, &record.u.b);
+        break;
+
+      default:
+        /* ports and the like don't survive a restart */
+        record.type = IMAGE_NIL;
+        break;
+      }
+    }
+
+    buffer_append(&records, &record, sizeof(record));
+  }
+
+  FILE *file = fopen(path, "wb");
+
+  if (!file) {
+    fprintf(stderr, "Error: save-image unable to open file: \"%s\"\n", path);
+    goto cleanup;
+  }
+
+  image_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  header.version = IMAGE_VERSION;
+  header.record_size = sizeof(image_record_t);
+  header.object_count = object_count;
+  header.string_bytes = pool.length;
+  header.root = 0;
+
+  if (fwrite(&header, sizeof(header), 1, file) != 1
+      || fwrite(records.data, 1, records.length, file) != records.length
+      || fwrite(pool.data, 1, pool.length, file) != pool.length) {
+    fprintf(stderr, "Error: save-image unable to write file: \"%s\"\n", path);
+    fclose(file);
+    goto cleanup;
+  }
+
+  if (fclose(file) == 0)
+    status = 0;
+
+ cleanup:
+  free(objects);
+  free(index.keys);
+  free(index.values);
+  free(records.data);
+  free(pool.data);
+
+  return status;
+}
+
+static lisp_object_t* decode_record(image_record_t *record, const char *pool,
+                                    uint64_t string_bytes) {
+  lisp_object_t *object = NULL;
+  char *string = NULL;
+  char *name = NULL;
+
+  if (record->type == STRING || record->type == SYMBOL || record->type == IMAGE_LEXICAL_SYMBOL
+      || record->type == NATIVE_FUNCTION) {
+    if ((uint64_t) record->a + record->u.b >= string_bytes)
+      return NULL;
+
+    name = (char*) pool + record->a;
+  }
+
+  switch (record->type) {
+
+  case IMAGE_NIL:
+    return NIL;
+
+  case IMAGE_EOF:
+    return EOF_OBJECT;
+
+  case SYMBOL:
+    return intern(name, record->u.b);
+
+  case IMAGE_LEXICAL_SYMBOL:
+    object = intern(name, record->u.b);
+    __atomic_fetch_or(&object->flags, SYMBOL_LEXICAL, __ATOMIC_RELAXED);
+    return object;
+
+  case NUMBER:
+    return make_number(record->u.number);
+
+  case STRING:
+    string = xmalloc(record->u.b + 1);
+    memcpy(string, name, record->u.b + 1);
+    return make_string(string);
+
+  case CONS:
+  case LAMBDA:
+  case MACRO:
+    /* the car and cdr are patched in once every object exists */
+    object = make_cons(NULL, NULL);
+    object->type = record->type;
+    return object;
+
+  case NATIVE_FUNCTION:
+    object = make_lisp_object();
+    object->type = NATIVE_FUNCTION;
+    object->datum.native_func = find_native_function(name);
+
+    if (!object->datum.native_func) {
+      fprintf(stderr, "Error: image refers to unknown native function \"%s\".\n", name);
+      return NULL;
+    }
+    return object;
+
+  default:
+    return NULL;
+  }
+}
+
+lisp_object_t* read_image(const char *path) {
+  int fd = open(path, O_RDONLY);
+  struct stat file_stat;
+  lisp_object_t *root = NULL;
+
+  if (fd < 0 || fstat(fd, &file_stat) != 0) {
+    fprintf(stderr, "Error: unable to open image: \"%s\"\n", path);
+
+    if (fd >= 0)
+      close(fd);
+
+    return NULL;
+  }
+
+  size_t size = file_stat.st_size;
+  char *mapping = MAP_FAILED;
+
+  if (size >= sizeof(image_header_t))
+    mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "Error: \"%s\" is not an image.\n", path);
+    return NULL;
+  }
+
+  image_header_t *header = (image_header_t*) mapping;
+  image_record_t *records = (image_record_t*) (mapping + sizeof(image_header_t));
+  const char *pool = (const char*) (records + header->object_count);
+
+  if (memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0
+      || header->version != IMAGE_VERSION
+      || header->record_size != sizeof(image_record_t)
+      || header->object_count == 0
+      || header->root >= header->object_count
+      || header->object_count > (size - sizeof(image_header_t)) / sizeof(image_record_t)
+      || size - sizeof(image_header_t) - header->object_count * sizeof(image_record_t)
+         != header->string_bytes) {
+    fprintf(stderr, "Error: \"%s\" is not a valid image.\n", path);
+    munmap(mapping, size);
+    return NULL;
+  }
+
+  lisp_object_t **objects = xmalloc(header->object_count * sizeof(lisp_object_t*));
+
+  /* two linear passes: create every object, then patch the pairs */
+  for (uint64_t i = 0; i < header->object_count; i++) {
+    objects[i] = decode_record(&records[i], pool, header->string_bytes);
+
+    if (!objects[i]) {
+      fprintf(stderr, "Error: \"%s\" has a corrupt record.\n", path);
+      goto cleanup;
+    }
+  }
+
+  for (uint64_t i = 0; i < header->object_count; i++) {
+    image_record_t *record = &records[i];
+
+    if (objects[i] == NIL
+        || (record->type != CONS && record->type != LAMBDA && record->type != MACRO))
+      continue;
+
+    if ((record->a != NO_INDEX && record->a >= header->object_count)
+        || (record->u.b != NO_INDEX && record->u.b >= header->object_count)) {
+      fprintf(stderr, "Error: \"%s\" has a corrupt record.\n", path);
+      goto cleanup;
+    }
+
+    CONS_VALUE(objects[i])->car = (record->a == NO_INDEX) ? NULL : objects[record->a];
+    CONS_VALUE(objects[i])->cdr = (record->u.b == NO_INDEX) ? NULL : objects[record->u.b];
+  }
+
+  root = objects[header->root];
+
+ cleanup:
+  free(objects);
+  munmap(mapping, size);
+
+  return root;
+}
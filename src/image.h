@@ -0,0 +1,23 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "lisp.h"
+
+/* Images hold either a whole global environment (save-image) or the
+ * compiled forms of a single file (compile-file).
+ */
+
+/* Writes every object reachable from root to path in a compact binary
+ * form. Objects refer to each other by index rather than by address, so
+ * the image can be loaded anywhere. Returns 0 on success.
+ */
+int write_image(const char *path, lisp_object_t *root);
+
+/* Maps an image written by write_image() and rebuilds its objects on the
+ * heap, returning the root or NULL on failure. Symbols are re-interned,
+ * keeping SYMBOL_LEXICAL, and native functions are looked up by their
+ * registered names.
+ */
+lisp_object_t* read_image(const char *path);
+
+#endif
@@ -0,0 +1,311 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "lisp.h"
+#include "green.h"
+#include "io.h"
+
+/* I/O threads, unless MAXLISP_IO_THREADS says otherwise */
+#define IO_THREADS 4
+
+#define LINE_BUFFER_SIZE 4096
+
+struct lisp_stream {
+  int fd;                       /* -1 once closed */
+  int busy;                     /* a green thread is waiting on it */
+
+  /* what read-line has read ahead */
+  char *buffer;
+  size_t start;
+  size_t end;
+  size_t capacity;
+};
+
+typedef enum {
+  IO_READ,
+  IO_WRITE
+} io_operation;
+
+/* lives on the stack of the thread waiting for it */
+typedef struct io_request {
+  io_operation operation;
+  int fd;
+  void *data;
+  size_t length;
+  ssize_t result;
+  int error;
+  green_event_t event;
+  struct io_request *next;
+} io_request_t;
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static io_request_t *queue_head;
+static io_request_t *queue_tail;
+
+static void perform(io_request_t *request) {
+  do {
+    if (request->operation == IO_READ)
+      request->result = read(request->fd, request->data, request->length);
+    else
+      request->result = write(request->fd, request->data, request->length);
+  } while (request->result < 0 && errno == EINTR);
+
+  request->error = request->result < 0 ? errno : 0;
+}
+
+static void* io_thread_main(void *unused) {
+  (void) unused;
+
+  for (;;) {
+    pthread_mutex_lock(&pool_lock);
+
+    while (!queue_head)
+      pthread_cond_wait(&work_ready, &pool_lock);
+
+    io_request_t *request = queue_head;
+    queue_head = request->next;
+
+    if (!queue_head)
+      queue_tail = NULL;
+
+    pthread_mutex_unlock(&pool_lock);
+
+    perform(request);
+    green_signal_event(&request->event);
+  }
+
+  return NULL;
+}
+
+static void start_pool() {
+  const char *setting = getenv("MAXLISP_IO_THREADS");
+  long threads = setting ? atol(setting) : IO_THREADS;
+
+  for (long i = 0; i < threads; i++) {
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, io_thread_main, NULL) != 0) {
+      fprintf(stderr, "Error: unable to start an I/O thread.\n");
+      exit(1);
+    }
+
+    pthread_detach(thread);
+  }
+}
+
+/* Reads or writes once, like read() and write() */
+static ssize_t transfer(io_operation operation, int fd, void *data, size_t length) {
+  io_request_t request;
+
+  memset(&request, 0, sizeof(request));
+  request.operation = operation;
+  request.fd = fd;
+  request.data = data;
+  request.length = length;
+
+  if (!green_can_overlap()) {
+    perform(&request);
+  } else {
+    pthread_once(&pool_once, start_pool);
+    green_event_init(&request.event);
+
+    pthread_mutex_lock(&pool_lock);
+
+    if (queue_tail)
+      queue_tail->next = &request;
+    else
+      queue_head = &request;
+
+    queue_tail = &request;
+    pthread_cond_signal(&work_ready);
+    pthread_mutex_unlock(&pool_lock);
+
+    green_wait_event(&request.event);
+  }
+
+  errno = request.error;
+
+  return request.result;
+}
+
+static struct lisp_stream* open_stream(lisp_object_t *object, const char *function_name) {
+  struct lisp_stream *stream = object->datum.stream;
+
+  if (stream->fd < 0)
+    lisp_error("%s given a closed stream.", function_name);
+
+  if (stream->busy)
+    lisp_error("%s given a stream another green thread is waiting on.", function_name);
+
+  return stream;
+}
+
+lisp_object_t* io_open(const char *path, const char *mode) {
+  int flags;
+
+  if (!strcmp(mode, "r"))
+    flags = O_RDONLY;
+  else if (!strcmp(mode, "w"))
+    flags = O_WRONLY | O_CREAT | O_TRUNC;
+  else if (!strcmp(mode, "a"))
+    flags = O_WRONLY | O_CREAT | O_APPEND;
+  else if (!strcmp(mode, "r+"))
+    flags = O_RDWR;
+  else
+    return lisp_error("open given an unknown mode: \"%s\"", mode);
+
+  int fd = open(path, flags | O_CLOEXEC, 0666);
+
+  if (fd < 0)
+    return lisp_error("open unable to open file: \"%s\" (%s)", path, strerror(errno));
+
+  struct lisp_stream *stream = xmalloc(sizeof(struct lisp_stream));
+  memset(stream, 0, sizeof(struct lisp_stream));
+  stream->fd = fd;
+
+  lisp_object_t *object = make_lisp_object();
+  object->type = STREAM;
+  object->datum.stream = stream;
+
+  return object;
+}
+
+lisp_object_t* io_read_bytes(lisp_object_t *object, size_t count) {
+  struct lisp_stream *stream = open_stream(object, "read-bytes");
+  unsigned char *data = xmalloc(count ? count : 1);
+  ssize_t length = 0;
+
+  /* what read-line read ahead comes first */
+  if (stream->start < stream->end) {
+    length = stream->end - stream->start;
+
+    if ((size_t) length > count)
+      length = count;
+
+    memcpy(data, stream->buffer + stream->start, length);
+    stream->start += length;
+  } else if (count > 0) {
+    stream->busy = 1;
+    length = transfer(IO_READ, stream->fd, data, count);
+    stream->busy = 0;
+
+    if (length < 0) {
+      free(data);
+      return lisp_error("read-bytes failed: %s", strerror(errno));
+    }
+
+    if (length == 0) {
+      free(data);
+      return EOF_OBJECT;
+    }
+  }
+
+  return make_bytes(data, length);
+}
+
+void io_write_bytes(lisp_object_t *object, const unsigned char *data, size_t length) {
+  struct lisp_stream *stream = open_stream(object, "write-bytes");
+  size_t written = 0;
+
+  stream->busy = 1;
+
+  while (written < length) {
+    ssize_t result = transfer(IO_WRITE, stream->fd, (void*) (data + written), length - written);
+
+    if (result < 0) {
+      stream->busy = 0;
+      lisp_error("write-bytes failed: %s", strerror(errno));
+    }
+
+    written += result;
+  }
+
+  stream->busy = 0;
+}
+
+static lisp_object_t* take_line(struct lisp_stream *stream, size_t length, size_t skip) {
+  char *line = xmalloc(length + 1);
+
+  memcpy(line, stream->buffer + stream->start, length);
+  line[length] = '\0';
+  stream->start += length + skip;
+
+  return make_string(line);
+}
+
+lisp_object_t* io_read_line(lisp_object_t *object) {
+  struct lisp_stream *stream = open_stream(object, "read-line");
+  size_t scanned = 0;
+
+  for (;;) {
+    char *newline = NULL;
+
+    if (stream->start + scanned < stream->end)
+      newline = memchr(stream->buffer + stream->start + scanned, '\n',
+                       stream->end - stream->start - scanned);
+
+    if (newline)
+      return take_line(stream, newline - (stream->buffer + stream->start), 1);
+
+    scanned = stream->end - stream->start;
+
+    /* makes room at the end of the buffer for another read */
+    if (stream->start > 0) {
+      memmove(stream->buffer, stream->buffer + stream->start, scanned);
+      stream->start = 0;
+      stream->end = scanned;
+    }
+
+    if (stream->end == stream->capacity) {
+      stream->capacity = stream->capacity ? stream->capacity * 2 : LINE_BUFFER_SIZE;
+      stream->buffer = realloc(stream->buffer, stream->capacity);
+
+      if (!stream->buffer) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+      }
+    }
+
+    stream->busy = 1;
+    ssize_t length = transfer(IO_READ, stream->fd, stream->buffer + stream->end,
+                              stream->capacity - stream->end);
+    stream->busy = 0;
+
+    if (length < 0)
+      return lisp_error("read-line failed: %s", strerror(errno));
+
+    if (length == 0)
+      return scanned ? take_line(stream, scanned, 0) : EOF_OBJECT;
+
+    stream->end += length;
+  }
+}
+
+void io_close(lisp_object_t *object) {
+  struct lisp_stream *stream = open_stream(object, "close-port");
+
+  close(stream->fd);
+  stream->fd = -1;
+  free(stream->buffer);
+  stream->buffer = NULL;
+  stream->start = stream->end = stream->capacity = 0;
+}
+
+void io_delete_stream(lisp_object_t *object) {
+  struct lisp_stream *stream = object->datum.stream;
+
+  if (stream->fd >= 0)
+    close(stream->fd);
+
+  free(stream->buffer);
+  free(stream);
+}
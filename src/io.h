@@ -0,0 +1,30 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stddef.h>
+#include "lisp.h"
+
+/*
+ * File and pipe I/O on STREAMs. Reads and writes are done on a pool of
+ * I/O threads whenever another green thread could run in the meantime,
+ * so the waiting thread is suspended instead of the whole VM. Otherwise
+ * they're plain blocking calls. Errors are thrown.
+ */
+
+/* Opens path with an fopen style mode: "r", "w", "a" or "r+" */
+lisp_object_t* io_open(const char *path, const char *mode);
+
+/* Returns BYTES holding up to count bytes, or the end of file object */
+lisp_object_t* io_read_bytes(lisp_object_t *stream, size_t count);
+
+/* Writes all of data */
+void io_write_bytes(lisp_object_t *stream, const unsigned char *data, size_t length);
+
+/* Returns the next line without its newline, or the end of file object */
+lisp_object_t* io_read_line(lisp_object_t *stream);
+
+void io_close(lisp_object_t *stream);
+
+void io_delete_stream(lisp_object_t *stream);
+
+#endif
@@ -1,21 +1,174 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <pthread.h>
 
 #include "lisp.h"
+#include "reader.h"
+#include "image.h"
+#include "profile.h"
+#include "green.h"
+#include "io.h"
 #include "runtime_functions.h"
 
-static reference_list_t *references = NULL;
-
-lisp_object_t* NIL                = NULL;
-lisp_object_t* T                  = NULL;
+struct continuation {
+  escape_point_t *point;
+  unsigned long id;             /* point is only ours while its id matches */
+};
+
+/* pins are kept in a list per VM, see pin_object() */
+struct lisp_pin {
+  lisp_object_t *object;
+  struct lisp_pin *next;
+  struct lisp_pin **link;       /* whatever points at this pin */
+};
+
+static const char *allocation_kind_names[ALLOCATION_KINDS] = {
+  "cons", "number", "string", "symbol", "closure", "other"
+};
+
+/* every native function by the name it was registered under */
+typedef struct {
+  char *name;
+  lisp_function function;
+} native_entry_t;
+
+/* what lisp_exec_save() and lisp_exec_load() move in and out of a VM */
+struct lisp_exec {
+  lisp_object_t **arg_stack;
+  size_t arg_stack_top;
+  size_t arg_stack_capacity;
+  lisp_object_t **frame_stack;
+  size_t frame_stack_top;
+  size_t frame_stack_capacity;
+  escape_point_t *escape_points;
+  escape_point_t *toplevel_point;
+  lisp_object_t *current_form;
+  lisp_object_t *output_port;
+};
+
+struct lisp_vm {
+  /* Set in a VM made by lisp_vm_fork(), which shares everything but its
+     allocations and stacks with its parent. The symbol table and the
+     native registry are the root's. */
+  lisp_vm_t *parent;
+  lisp_vm_t *root;
+  size_t forks;                 /* forked VMs that haven't been merged */
+
+  reference_list_t *references;
+  size_t objects_allocated;
+  size_t allocated_at_gc;       /* objects_allocated at the last collection */
+  lisp_pin_t *pins;
+  memory_stats_t stats;
+  FILE *stats_log;
+  int stats_log_owned;          /* opened by open_memory_stats_log() */
+  size_t stats_log_interval;
+
+  /* evaluated arguments of the calls in progress, see push_arg() */
+  lisp_object_t **arg_stack;
+  size_t arg_stack_top;
+  size_t arg_stack_capacity;
+
+  /* frame cells that aren't in use */
+  lisp_object_t *free_cells;
+
+  lisp_object_t **frame_stack;
+  size_t frame_stack_top;
+  size_t frame_stack_capacity;
+
+  /* frame cells mark() has reached, which the collection leaves unmarked
+     again since they aren't in references */
+  lisp_object_t **marked_cells;
+  size_t marked_cells_count;
+  size_t marked_cells_capacity;
+
+  /* innermost first, see push_escape() */
+  escape_point_t *escape_points;
+  unsigned long escape_point_count;
+
+  /* the outermost ESCAPE_CATCH_ALL point, which catches whatever the
+     evaluation under it doesn't, see eval_toplevel() */
+  escape_point_t *toplevel_point;
+
+  /* the form errors are reported against */
+  lisp_object_t *current_form;
+
+  /* see current_output_port() */
+  lisp_object_t *output_port;
+  lisp_object_t *stdout_port;
+
+  lisp_object_t *global_environment;
+
+  /* green threads, see green.c; NULL until the first is spawned */
+  struct green_scheduler *scheduler;
+
+  native_entry_t *native_registry;
+  size_t native_registry_count;
+  size_t native_registry_capacity;
+
+  /* interned symbols, open addressed by name */
+  lisp_object_t **symbol_table;
+  size_t symbol_table_capacity;
+  size_t symbol_table_count;
+
+  lisp_object_t *nil;
+  lisp_object_t *t;
+  lisp_object_t *eof_object;
+
+  /* symbols eval() compares against on every call */
+  lisp_object_t *lambda_symbol;
+  lisp_object_t *meta_lambda_symbol;
+  lisp_object_t *quote_symbol;
+  lisp_object_t *set_symbol;
+  lisp_object_t *if_symbol;
+  lisp_object_t *eval_symbol;
+  lisp_object_t *load_symbol;
+  lisp_object_t *apply_symbol;
+  lisp_object_t *while_symbol;
+  lisp_object_t *dotimes_symbol;
+  lisp_object_t *dolist_symbol;
+  lisp_object_t *super_env_symbol;
+  lisp_object_t *error_symbol;
+};
+
+/* the VM this thread is running, see lisp_vm_enter() */
+static LISP_THREAD_LOCAL lisp_vm_t *vm = NULL;
+
+/* the fewest allocations maybe_gc() lets go by between collections */
+#define GC_MIN_ALLOCATIONS 100000
+
+/* Taken while the heap is shared with forked VMs, see heap_shared() */
+static pthread_mutex_t symbol_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t analysis_lock = PTHREAD_MUTEX_INITIALIZER;
+
+LISP_THREAD_LOCAL lisp_object_t* NIL        = NULL;
+LISP_THREAD_LOCAL lisp_object_t* T          = NULL;
+LISP_THREAD_LOCAL lisp_object_t* EOF_OBJECT = NULL;
 
 static void unmark_all_references();
 static void mark(lisp_object_t *object);
+static void mark_stacks();
+static char* os_stack_top();
+static void close_memory_stats_log(lisp_vm_t *target);
+static int is_frame(lisp_object_t *environment);
+static lisp_object_t* lookup_lexical(lisp_object_t *symbol, lisp_object_t *environment);
 
 static lisp_object_t* eval_arg_list(lisp_object_t *arg_list, lisp_object_t *env);
 
-static lisp_object_t* apply_lambda(lisp_object_t *lambda_expr, lisp_object_t *xargs);
+static lisp_object_t* apply_lambda(lisp_object_t *lambda_expr, size_t base);
+
+static lisp_object_t* while_loop(lisp_object_t *loop, lisp_object_t *environment);
+
+static lisp_object_t* dotimes_loop(lisp_object_t *loop, lisp_object_t *environment);
+
+static lisp_object_t* dolist_loop(lisp_object_t *loop, lisp_object_t *environment);
+
+static lisp_object_t* invoke(lisp_object_t *f, size_t base);
 
 void* xmalloc(size_t bytes) {
   char *object = malloc(bytes);
@@ -28,41 +181,375 @@ void* xmalloc(size_t bytes) {
   return object;
 }
 
-lisp_object_t* init_lisp_module() {
-  NIL = make_cons(NULL, NULL);
+static lisp_object_t* special_form(const char *name) {
+  lisp_object_t *symbol = intern(name, strlen(name));
+  symbol->flags |= SYMBOL_SPECIAL_FORM;
 
-  lisp_object_t *global_environment = NIL;
-  lisp_object_t *core_path = make_lisp_object();
-  core_path->type = STRING;
-  core_path->datum.string = strdup("core.lisp");
+  return symbol;
+}
 
-  T = make_lisp_object();
-  T->type = SYMBOL;
-  T->datum.symbol = strdup("t");
+/* Builds an environment holding only the native functions */
+static lisp_object_t* make_base_environment() {
+  NIL = vm->nil = make_cons(NULL, NULL);
+
+  lisp_object_t *environment = NIL;
+
+  T = vm->t = intern("t", 1);
+
+  vm->lambda_symbol = special_form("lambda");
+  vm->meta_lambda_symbol = special_form("meta-lambda");
+  vm->quote_symbol = special_form("quote");
+  vm->set_symbol = special_form("set");
+  vm->if_symbol = special_form("if");
+  vm->eval_symbol = special_form("eval");
+  vm->load_symbol = special_form("load");
+  vm->apply_symbol = special_form("apply");
+  vm->while_symbol = special_form("while");
+  vm->dotimes_symbol = special_form("dotimes");
+  vm->dolist_symbol = special_form("dolist");
+  vm->super_env_symbol = intern("*lisp-super-env*", 16);
+  vm->error_symbol = intern("error", 5);
+  /* its bindings live in frames, so call sites mustn't cache them */
+  vm->super_env_symbol->flags |= SYMBOL_LEXICAL;
+
+  vm->stdout_port = vm->output_port = make_output_port(stdout, 0);
+
+  /* a symbol that isn't interned, so read can't return it by accident */
+  EOF_OBJECT = vm->eof_object = make_lisp_object();
+  EOF_OBJECT->type = SYMBOL;
+  EOF_OBJECT->datum.symbol = strdup("#<eof>");
   
-  global_environment = nice_set("nil", NIL, global_environment);
-  nice_set("t", T, global_environment);
+  environment = nice_set("nil", NIL, environment);
+  nice_set("t", T, environment);
+  nice_set("*eof*", EOF_OBJECT, environment);
 
   /* these functions are defined in runtime_functions.h */
-  register_function("cons", cons_func, global_environment);
-  register_function("car",  car_func,  global_environment);
-  register_function("cdr",  cdr_func,  global_environment);
-  register_function("list", list, global_environment);
-  register_function("length", length, global_environment);
-  register_function("eq", eq, global_environment);
-  register_function("atom?", atomp, global_environment);
-  register_function("primitive-print", primitive_print, global_environment);
-  register_function("+", add, global_environment);
-  register_function("-", subtract, global_environment);
-  register_function("*", multiply, global_environment);
-  register_function("/", divide, global_environment);
-  register_function("<", less_than, global_environment);
-  register_function(">", greater_than, global_environment);
+  register_function("cons", cons_func, environment);
+  register_function("car",  car_func,  environment);
+  register_function("cdr",  cdr_func,  environment);
+  register_function("list", list, environment);
+  register_function("length", length, environment);
+  register_function("eq", eq, environment);
+  register_function("atom?", atomp, environment);
+  register_function("primitive-print", primitive_print, environment);
+  register_function("write", primitive_write, environment);
+  register_function("display", display, environment);
+  register_function("newline", newline, environment);
+  register_function("flush-output", flush_output, environment);
+  register_function("current-output-port", primitive_current_output_port, environment);
+  register_function("open-output-file", open_output_file, environment);
+  register_function("set-port-buffering", set_port_buffering, environment);
+  register_function("primitive-with-output-to-string", primitive_with_output_to_string,
+                    environment);
+  register_function("+", add, environment);
+  register_function("-", subtract, environment);
+  register_function("*", multiply, environment);
+  register_function("/", divide, environment);
+  register_function("<", less_than, environment);
+  register_function(">", greater_than, environment);
+  register_function("open-input-file", open_input_file, environment);
+  register_function("read", read_port, environment);
+  register_function("close-port", close_port, environment);
+  register_function("eof-object?", eof_objectp, environment);
+  register_function("exit", primitive_exit, environment);
+  register_function("open", primitive_open, environment);
+  register_function("read-bytes", read_bytes, environment);
+  register_function("write-bytes", write_bytes, environment);
+  register_function("read-line", read_line, environment);
+  register_function("bytes-length", bytes_length, environment);
+  register_function("bytes->string", bytes_to_string, environment);
+  register_function("string->bytes", string_to_bytes, environment);
+  register_function("make-bytes", primitive_make_bytes, environment);
+  register_function("foreign-function", foreign_function, environment);
+  register_function("f64vector", f64vector, environment);
+  register_function("i64vector", i64vector, environment);
+  register_function("make-f64vector", make_f64vector, environment);
+  register_function("make-i64vector", make_i64vector, environment);
+  register_function("vec-length", vec_length, environment);
+  register_function("vec-ref", vec_ref, environment);
+  register_function("vec->list", vec_to_list, environment);
+  register_function("vec+", vec_add, environment);
+  register_function("vec*", vec_multiply, environment);
+  register_function("dot", dot, environment);
+  register_function("sum", sum, environment);
+  register_function("scale", scale, environment);
+  register_function("vec-map", vec_map, environment);
+  register_function("sort", primitive_sort, environment);
+  register_function("binary-search", binary_search, environment);
+  register_function("for-each-form", for_each_form, environment);
+  register_function("save-image", save_image, environment);
+  register_function("compile-file", compile_file, environment);
+  register_function("profile-start", primitive_profile_start, environment);
+  register_function("profile-stop", primitive_profile_stop, environment);
+  register_function("memory-stats", primitive_memory_stats, environment);
+  register_function("memory-stats-log", memory_stats_log, environment);
+  register_function("call/cc", call_cc, environment);
+  register_function("call-with-current-continuation", call_cc, environment);
+  register_function("error", primitive_error, environment);
+  register_function("error?", errorp, environment);
+  register_function("error-message", error_message, environment);
+  register_function("error-form", error_form, environment);
+  register_function("throw", primitive_throw, environment);
+  register_function("primitive-catch", primitive_catch, environment);
+  register_function("primitive-unwind-protect", primitive_unwind_protect, environment);
+  register_function("pmap", pmap, environment);
+  register_function("pfor-each", pfor_each, environment);
+  register_function("preduce", preduce, environment);
+  register_function("spawn", spawn, environment);
+  register_function("primitive-future", primitive_future, environment);
+  register_function("touch", touch, environment);
+  register_function("yield", yield, environment);
+  register_function("make-channel", make_channel, environment);
+  register_function("send", channel_send, environment);
+  register_function("recv", channel_recv, environment);
+
+  return environment;
+}
+
+lisp_vm_t* lisp_vm_create() {
+  lisp_vm_t *new_vm = xmalloc(sizeof(lisp_vm_t));
+
+  memset(new_vm, 0, sizeof(lisp_vm_t));
+  new_vm->stats_log_interval = 1;
+
+  return new_vm;
+}
+
+void lisp_vm_enter(lisp_vm_t *next) {
+  vm = next;
+
+  NIL = next ? next->nil : NULL;
+  T = next ? next->t : NULL;
+  EOF_OBJECT = next ? next->eof_object : NULL;
+}
+
+lisp_vm_t* lisp_vm_current() {
+  return vm;
+}
+
+struct green_scheduler** lisp_vm_scheduler() {
+  return &vm->scheduler;
+}
+
+void lisp_vm_destroy(lisp_vm_t *target) {
+  lisp_vm_t *previous = vm;
+
+  /* green threads give their frame cells back to target */
+  lisp_vm_enter(target);
+  green_destroy_scheduler();
+  lisp_vm_enter(previous);
+
+  while (target->references) {
+    reference_list_t *next = target->references->next;
+
+    delete_object(target->references->node);
+    free(target->references);
+    target->references = next;
+  }
+
+  while (target->free_cells) {
+    lisp_object_t *next = CONS_VALUE(target->free_cells)->cdr;
+
+    free(target->free_cells->datum.cons);
+    free(target->free_cells);
+    target->free_cells = next;
+  }
+
+  while (target->pins)
+    unpin_object(target->pins);
+
+  close_memory_stats_log(target);
+
+  for (size_t i = 0; i < target->native_registry_count; i++)
+    free(target->native_registry[i].name);
+
+  free(target->native_registry);
+  free(target->symbol_table);
+  free(target->arg_stack);
+  free(target->frame_stack);
+  free(target->marked_cells);
+
+  if (vm == target)
+    lisp_vm_enter(NULL);
+
+  free(target);
+}
+
+lisp_exec_t* lisp_exec_create() {
+  lisp_exec_t *exec = xmalloc(sizeof(lisp_exec_t));
+
+  memset(exec, 0, sizeof(lisp_exec_t));
+  exec->output_port = vm->output_port;
+
+  return exec;
+}
+
+void lisp_exec_save(lisp_exec_t *exec) {
+  exec->arg_stack = vm->arg_stack;
+  exec->arg_stack_top = vm->arg_stack_top;
+  exec->arg_stack_capacity = vm->arg_stack_capacity;
+  exec->frame_stack = vm->frame_stack;
+  exec->frame_stack_top = vm->frame_stack_top;
+  exec->frame_stack_capacity = vm->frame_stack_capacity;
+  exec->escape_points = vm->escape_points;
+  exec->toplevel_point = vm->toplevel_point;
+  exec->current_form = vm->current_form;
+  exec->output_port = vm->output_port;
+}
+
+void lisp_exec_load(lisp_exec_t *exec) {
+  vm->arg_stack = exec->arg_stack;
+  vm->arg_stack_top = exec->arg_stack_top;
+  vm->arg_stack_capacity = exec->arg_stack_capacity;
+  vm->frame_stack = exec->frame_stack;
+  vm->frame_stack_top = exec->frame_stack_top;
+  vm->frame_stack_capacity = exec->frame_stack_capacity;
+  vm->escape_points = exec->escape_points;
+  vm->toplevel_point = exec->toplevel_point;
+  vm->current_form = exec->current_form;
+  vm->output_port = exec->output_port;
+}
+
+static void release_frame(lisp_object_t *frame);
+
+void lisp_exec_destroy(lisp_exec_t *exec) {
+  while (exec->frame_stack_top > 0)
+    release_frame(exec->frame_stack[--exec->frame_stack_top]);
+
+  free(exec->arg_stack);
+  free(exec->frame_stack);
+  free(exec);
+}
+
+lisp_vm_t* lisp_vm_fork() {
+  lisp_vm_t *child = lisp_vm_create();
+  lisp_vm_t *root = vm->root ? vm->root : vm;
+
+  child->parent = vm;
+  child->root = root;
+  child->global_environment = vm->global_environment;
+  child->native_registry = root->native_registry;
+  child->native_registry_count = root->native_registry_count;
+
+  /* a string port isn't safe to share between threads */
+  child->stdout_port = child->output_port = root->stdout_port;
+
+  child->nil = vm->nil;
+  child->t = vm->t;
+  child->eof_object = vm->eof_object;
+  child->lambda_symbol = vm->lambda_symbol;
+  child->meta_lambda_symbol = vm->meta_lambda_symbol;
+  child->quote_symbol = vm->quote_symbol;
+  child->set_symbol = vm->set_symbol;
+  child->if_symbol = vm->if_symbol;
+  child->eval_symbol = vm->eval_symbol;
+  child->load_symbol = vm->load_symbol;
+  child->apply_symbol = vm->apply_symbol;
+  child->while_symbol = vm->while_symbol;
+  child->dotimes_symbol = vm->dotimes_symbol;
+  child->dolist_symbol = vm->dolist_symbol;
+  child->super_env_symbol = vm->super_env_symbol;
+  child->error_symbol = vm->error_symbol;
+
+  vm->forks++;
+
+  return child;
+}
+
+void lisp_vm_merge(lisp_vm_t *child) {
+  reference_list_t *last = child->references;
+
+  if (last) {
+    while (last->next)
+      last = last->next;
+
+    last->next = vm->references;
+    vm->references = child->references;
+    child->references = NULL;
+  }
+
+  lisp_pin_t *last_pin = child->pins;
+
+  if (last_pin) {
+    while (last_pin->next)
+      last_pin = last_pin->next;
+
+    last_pin->next = vm->pins;
+
+    if (vm->pins)
+      vm->pins->link = &last_pin->next;
+
+    vm->pins = child->pins;
+    vm->pins->link = &vm->pins;
+    child->pins = NULL;
+  }
+
+  for (int kind = 0; kind < ALLOCATION_KINDS; kind++) {
+    vm->stats.objects[kind] += child->stats.objects[kind];
+    vm->stats.bytes[kind] += child->stats.bytes[kind];
+  }
+
+  vm->stats.live_objects += child->stats.live_objects;
+  vm->objects_allocated += child->objects_allocated;
+  vm->forks--;
+
+  /* the registry and symbol table aren't the child's to free */
+  child->native_registry = NULL;
+  child->native_registry_count = 0;
+  lisp_vm_destroy(child);
+}
+
+/* Is the heap being used by forked VMs in other threads? Then closure
+   analysis and the symbol table are shared and need locking. */
+static int heap_shared() {
+  return vm->parent || vm->forks;
+}
+
+/* Symbols are shared with forked VMs, so their flags are updated
+   atomically. The bits besides SYMBOL_SEEN are only ever set. */
+static int has_flag(lisp_object_t *object, unsigned char flag) {
+  return __atomic_load_n(&object->flags, __ATOMIC_RELAXED) & flag;
+}
+
+static void set_flag(lisp_object_t *object, unsigned char flag) {
+  __atomic_fetch_or(&object->flags, flag, __ATOMIC_RELAXED);
+}
+
+static void clear_flag(lisp_object_t *object, unsigned char flag) {
+  __atomic_fetch_and(&object->flags, (unsigned char) ~flag, __ATOMIC_RELAXED);
+}
+
+lisp_object_t* init_lisp_module() {
+  lisp_object_t *core_path = NULL;
+
+  lisp_vm_enter(lisp_vm_create());
+  vm->global_environment = make_base_environment();
+
+  core_path = make_string(strdup("core.lisp"));
 
   /* we need to load "core.lisp" as part of the bootstrap process */
-  load(make_cons(core_path, NIL), global_environment);
+  eval(make_cons(vm->load_symbol, make_cons(core_path, NIL)), vm->global_environment);
+
+  return vm->global_environment;
+}
+
+lisp_object_t* init_lisp_image(const char *path) {
+  lisp_vm_enter(lisp_vm_create());
+
+  /* the natives have to be registered before the image can name them */
+  make_base_environment();
 
-  return global_environment;
+  vm->global_environment = read_image(path);
+
+  return vm->global_environment;
+}
+
+lisp_object_t* get_global_environment() {
+  return vm->global_environment;
+}
+
+lisp_object_t* get_super_env_symbol() {
+  return vm->super_env_symbol;
 }
 
 static reference_list_t* make_reference_list(lisp_object_t *object) {
@@ -74,44 +561,261 @@ static reference_list_t* make_reference_list(lisp_object_t *object) {
 
 static void create_reference(lisp_object_t *object) {
   reference_list_t *new_reference = make_reference_list(object);
-  new_reference->next = references;
+  new_reference->next = vm->references;
 
-  references = new_reference;
+  vm->references = new_reference;
 }
 
-lisp_object_t* make_lisp_object() {
+/* payload is whatever the object owns besides its header, for the stats */
+static void count_allocation(allocation_kind kind, size_t payload) {
+  vm->objects_allocated++;
+
+  vm->stats.objects[kind]++;
+  vm->stats.bytes[kind] += sizeof(lisp_object_t) + sizeof(reference_list_t) + payload;
+  vm->stats.live_objects++;
+}
+
+static lisp_object_t* allocate_object(allocation_kind kind, size_t payload) {
   lisp_object_t *object = xmalloc(sizeof(lisp_object_t));
   create_reference(object);
+  count_allocation(kind, payload);
 
   object->marked = 0;
+  object->flags = 0;
 
   return object;
 }
 
-size_t allocated_objects() {
-  size_t num = 0;
+lisp_object_t* make_lisp_object() {
+  return allocate_object(ALLOC_OTHER, 0);
+}
 
-  reference_list_t *current_reference = references;
-  while (current_reference) {
-    num++;
-    current_reference = current_reference->next;
+lisp_object_t* make_number(double value) {
+  lisp_object_t *object = allocate_object(ALLOC_NUMBER, 0);
+  object->type = NUMBER;
+  object->datum.number = value;
+
+  return object;
+}
+
+lisp_object_t* make_string(char *string) {
+  lisp_object_t *object = allocate_object(ALLOC_STRING, strlen(string) + 1);
+  object->type = STRING;
+  object->datum.string = string;
+
+  return object;
+}
+
+lisp_object_t* make_bytes(unsigned char *data, size_t length) {
+  lisp_object_t *object = allocate_object(ALLOC_OTHER, sizeof(lisp_bytes_t) + length);
+  object->type = BYTES;
+  object->datum.bytes = xmalloc(sizeof(lisp_bytes_t));
+  memset(object->datum.bytes, 0, sizeof(lisp_bytes_t));
+  object->datum.bytes->length = length;
+  object->datum.bytes->data = data;
+
+  return object;
+}
+
+lisp_object_t* make_borrowed_bytes(unsigned char *data, size_t length,
+                                   void (*release)(void *context), void *context) {
+  lisp_object_t *object = allocate_object(ALLOC_OTHER, sizeof(lisp_bytes_t));
+  object->type = BYTES;
+  object->datum.bytes = xmalloc(sizeof(lisp_bytes_t));
+  object->datum.bytes->length = length;
+  object->datum.bytes->data = data;
+  object->datum.bytes->borrowed = 1;
+  object->datum.bytes->release = release;
+  object->datum.bytes->context = context;
+
+  return object;
+}
+
+lisp_object_t* make_numeric_vector(lisp_type type, size_t length) {
+  /* both kinds of element are 8 bytes */
+  lisp_object_t *object = allocate_object(ALLOC_OTHER, sizeof(lisp_vector_t) + length * 8);
+  object->type = type;
+  object->datum.vector = xmalloc(sizeof(lisp_vector_t));
+  object->datum.vector->length = length;
+
+  if (type == F64VECTOR)
+    object->datum.vector->data.f64 = calloc(length ? length : 1, sizeof(double));
+  else
+    object->datum.vector->data.i64 = calloc(length ? length : 1, sizeof(int64_t));
+
+  if (!object->datum.vector->data.f64) {
+    fprintf(stderr, "Error: out of memory.\n");
+    exit(1);
   }
 
-  return num;
+  return object;
 }
 
-lisp_object_t* make_cons(lisp_object_t *car, lisp_object_t *cdr) {
-  lisp_object_t *object = make_lisp_object();
+lisp_object_t* make_host_function(const char *name, int arity, lisp_host_function function,
+                                  void *data, void (*free_data)(void *data)) {
+  lisp_object_t *object = allocate_object(ALLOC_OTHER, sizeof(lisp_host_t) + strlen(name) + 1);
+  object->type = HOST_FUNCTION;
+  object->datum.host = xmalloc(sizeof(lisp_host_t));
+  object->datum.host->function = function;
+  object->datum.host->data = data;
+  object->datum.host->free_data = free_data;
+  object->datum.host->name = strdup(name);
+  object->datum.host->arity = arity;
+
+  return object;
+}
+
+static lisp_object_t* make_pair(lisp_type type, allocation_kind kind,
+                                lisp_object_t *car, lisp_object_t *cdr) {
+  lisp_object_t *object = allocate_object(kind, sizeof(cons));
   object->datum.cons = xmalloc(sizeof(cons));
-  object->type = CONS;
+  object->type = type;
 
   cons *object_cons = (cons*) object->datum.cons;
   object_cons->car = car;
   object_cons->cdr = cdr;
+  object_cons->cache = NULL;
 
   return object;
 }
 
+const memory_stats_t* memory_stats() {
+  return &vm->stats;
+}
+
+const char* allocation_kind_name(allocation_kind kind) {
+  return allocation_kind_names[kind];
+}
+
+static void close_memory_stats_log(lisp_vm_t *target) {
+  if (target->stats_log_owned)
+    fclose(target->stats_log);
+
+  target->stats_log = NULL;
+  target->stats_log_owned = 0;
+}
+
+void set_memory_stats_log(FILE *file, size_t interval) {
+  close_memory_stats_log(vm);
+  vm->stats_log = file;
+  vm->stats_log_interval = interval ? interval : 1;
+}
+
+int open_memory_stats_log(const char *path, size_t interval) {
+  FILE *file = fopen(path, "a");
+
+  if (!file)
+    return -1;
+
+  set_memory_stats_log(file, interval);
+  vm->stats_log_owned = 1;
+
+  return 0;
+}
+
+static void log_memory_stats() {
+  fprintf(vm->stats_log, "gc=%zu pause_ms=%.3f survivors=%zu freed=%zu live=%zu",
+          vm->stats.gc_count, vm->stats.last_pause_ms, vm->stats.last_survivors,
+          vm->stats.last_freed, vm->stats.live_objects);
+
+  for (int kind = 0; kind < ALLOCATION_KINDS; kind++)
+    fprintf(vm->stats_log, " %s=%zu", allocation_kind_names[kind], vm->stats.objects[kind]);
+
+  fputc('\n', vm->stats_log);
+  fflush(vm->stats_log);
+}
+
+static size_t hash_symbol_name(const char *name, size_t length) {
+  size_t hash = 2166136261u;
+
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (unsigned char) name[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+static void grow_symbol_table(lisp_vm_t *table) {
+  size_t old_capacity = table->symbol_table_capacity;
+  lisp_object_t **old_table = table->symbol_table;
+
+  table->symbol_table_capacity = old_capacity ? old_capacity * 2 : 256;
+  table->symbol_table = xmalloc(table->symbol_table_capacity * sizeof(lisp_object_t*));
+  memset(table->symbol_table, 0, table->symbol_table_capacity * sizeof(lisp_object_t*));
+
+  for (size_t i = 0; i < old_capacity; i++) {
+    lisp_object_t *symbol = old_table[i];
+
+    if (!symbol)
+      continue;
+
+    size_t index = hash_symbol_name(symbol->datum.symbol, strlen(symbol->datum.symbol))
+      & (table->symbol_table_capacity - 1);
+
+    while (table->symbol_table[index])
+      index = (index + 1) & (table->symbol_table_capacity - 1);
+
+    table->symbol_table[index] = symbol;
+  }
+
+  free(old_table);
+}
+
+/* looks name up in table's symbol table, allocating any new symbol in
+   the current VM */
+static lisp_object_t* intern_in(lisp_vm_t *table, const char *name, size_t length) {
+  if (table->symbol_table_count * 2 >= table->symbol_table_capacity)
+    grow_symbol_table(table);
+
+  size_t mask = table->symbol_table_capacity - 1;
+  size_t index = hash_symbol_name(name, length) & mask;
+
+  while (table->symbol_table[index]) {
+    lisp_object_t *symbol = table->symbol_table[index];
+
+    if (strncmp(symbol->datum.symbol, name, length) == 0
+        && symbol->datum.symbol[length] == 0)
+      return symbol;
+
+    index = (index + 1) & mask;
+  }
+
+  lisp_object_t *symbol = allocate_object(ALLOC_SYMBOL, length + 1);
+  symbol->type = SYMBOL;
+  symbol->datum.symbol = xmalloc(length + 1);
+  memcpy(symbol->datum.symbol, name, length);
+  symbol->datum.symbol[length] = 0;
+
+  table->symbol_table[index] = symbol;
+  table->symbol_table_count++;
+
+  return symbol;
+}
+
+lisp_object_t* intern(const char *name, size_t length) {
+  if (!heap_shared())
+    return intern_in(vm, name, length);
+
+  pthread_mutex_lock(&symbol_lock);
+  lisp_object_t *symbol = intern_in(vm->root ? vm->root : vm, name, length);
+  pthread_mutex_unlock(&symbol_lock);
+
+  return symbol;
+}
+
+size_t allocation_count() {
+  return vm->objects_allocated;
+}
+
+size_t allocated_objects() {
+  return vm->stats.live_objects;
+}
+
+lisp_object_t* make_cons(lisp_object_t *car, lisp_object_t *cdr) {
+  return make_pair(CONS, ALLOC_CONS, car, cdr);
+}
+
 lisp_object_t* deep_copy(lisp_object_t *src) {
   if (src == NULL)
     return NULL;
@@ -160,182 +864,398 @@ lisp_object_t* deep_copy(lisp_object_t *src) {
   return dest;
 }
 
-lisp_object_t* print_object(lisp_object_t *object) {
-  size_t string_size = 256;
-  char *dest = xmalloc(string_size);
-  lisp_object_t *lisp_string = make_lisp_object();
-  lisp_object_t *cdr;
+void init_string_writer(lisp_writer_t *writer) {
+  memset(writer, 0, sizeof(lisp_writer_t));
+  writer->capacity = 256;
+  writer->buffer = xmalloc(writer->capacity);
+  writer->buffer[0] = 0;
+}
+
+void init_file_writer(lisp_writer_t *writer, FILE *file) {
+  memset(writer, 0, sizeof(lisp_writer_t));
+  writer->file = file;
+}
 
-  int strlen = 0;
-  size_t temp = 0;
-  memset(dest, 0, string_size);
+/* makes room for at least `bytes` more characters (plus the terminator) */
+static void writer_reserve(lisp_writer_t *writer, size_t bytes) {
+  if (writer->length + bytes < writer->capacity)
+    return;
 
-  switch (object->type) {
+  while (writer->length + bytes >= writer->capacity)
+    writer->capacity *= 2;
 
-  case SYMBOL:
-    temp = snprintf(dest, string_size, "%s", object->datum.symbol);
+  writer->buffer = realloc(writer->buffer, writer->capacity);
+
+  if (!writer->buffer) {
+    fprintf(stderr, "Error: out of memory.\n");
+    exit(1);
+  }
+}
+
+void writer_write(lisp_writer_t *writer, const char *text, size_t length) {
+  if (writer->file) {
+    fwrite(text, 1, length, writer->file);
+
+    if (writer->buffering == WRITER_UNBUFFERED
+        || (writer->buffering == WRITER_LINE_BUFFERED && memchr(text, '\n', length)))
+      fflush(writer->file);
+
+    return;
+  }
+
+  writer_reserve(writer, length);
+  memcpy(writer->buffer + writer->length, text, length);
+  writer->length += length;
+  writer->buffer[writer->length] = 0;
+}
+
+void writer_puts(lisp_writer_t *writer, const char *text) {
+  writer_write(writer, text, strlen(text));
+}
+
+char* writer_finish(lisp_writer_t *writer) {
+  char *result = writer->buffer;
+
+  if (writer->file && writer->close_file)
+    fclose(writer->file);
+  else if (writer->file)
+    fflush(writer->file);
+
+  writer->file = NULL;
+
+  writer->buffer = NULL;
+  writer->length = 0;
+  writer->capacity = 0;
+
+  return result;
+}
+
+static void write_number(lisp_writer_t *writer, double number) {
+  char digits[64];
+  int length = snprintf(digits, sizeof(digits), "%f", number);
+
+  if (length < (int) sizeof(digits)) {
+    writer_write(writer, digits, length);
+    return;
+  }
+
+  /* very large magnitudes don't fit, so we format into a temporary */
+  char *big_digits = xmalloc(length + 1);
+  snprintf(big_digits, length + 1, "%f", number);
+  writer_write(writer, big_digits, length);
+  free(big_digits);
+}
+
+/* written as #f64(...) or #i64(...), which the reader doesn't read back */
+static void write_vector(lisp_writer_t *writer, lisp_object_t *object) {
+  lisp_vector_t *vector = object->datum.vector;
 
-    if (temp >= string_size) {
-      string_size = temp + 1;
-      dest = realloc(dest, string_size);
-      memset(dest, 0, string_size);
-      strlen = snprintf(dest, string_size, "%s", object->datum.symbol);
+  writer_puts(writer, object->type == F64VECTOR ? "#f64(" : "#i64(");
+
+  for (size_t i = 0; i < vector->length; i++) {
+    if (i > 0)
+      writer_write(writer, " ", 1);
+
+    if (object->type == F64VECTOR) {
+      write_number(writer, vector->data.f64[i]);
     } else {
-      strlen = temp;
+      char digits[32];
+      writer_write(writer, digits, snprintf(digits, sizeof(digits), "%" PRId64,
+                                            vector->data.i64[i]));
     }
+  }
+
+  writer_write(writer, ")", 1);
+}
+
+void write_object(lisp_writer_t *writer, lisp_object_t *object) {
+  lisp_object_t *cdr;
+
+  switch (object->type) {
+
+  case SYMBOL:
+    writer_puts(writer, object->datum.symbol);
     break;
 
   case STRING:
-    temp = snprintf(dest, string_size, "\"%s\"", object->datum.string);
-
-    if (temp >= string_size) {
-      string_size = temp + 1;
-      dest = realloc(dest, string_size);
-      memset(dest, 0, string_size);
-      strlen = snprintf(dest, string_size, "\"%s\"", object->datum.string);
-    } else {
-      strlen = temp;
+    if (writer->display) {
+      writer_puts(writer, object->datum.string);
+      break;
     }
+
+    writer_write(writer, "\"", 1);
+    writer_puts(writer, object->datum.string);
+    writer_write(writer, "\"", 1);
     break;
 
   case NUMBER:
-    strlen = snprintf(dest, string_size, "%f", object->datum.number);
-
-    if (strlen >= string_size) {
-      dest = realloc(dest, strlen + 1);
-      memset(dest, 0, strlen + 1);
-      snprintf(dest, strlen + 1, "%f", object->datum.number);
-    }
-    break; 
+    write_number(writer, object->datum.number);
+    break;
 
-  case CONS: 
-    cdr = object;
+  case CONS:
     if (object == NIL) {
-      strcpy(dest, "nil");
-      dest[3] = 0;
+      writer_write(writer, "nil", 3);
       break;
     }
 
-    temp = snprintf(dest, string_size, "(");
-    if (temp >= string_size) {
-      string_size += temp + 1;
-      dest = realloc(dest, string_size);
-      memset(dest + strlen, 0, string_size - strlen);
-
-      temp = snprintf(dest + strlen, string_size, "(");
-      strlen += temp;
-    } else {
-      strlen += temp;
-    }
+    writer_write(writer, "(", 1);
 
+    /* we walk the spine iteratively so long lists don't recurse */
+    cdr = object;
     while (cdr != NIL) {
-      lisp_object_t *car = ((cons*) cdr->datum.cons)->car;
-      lisp_object_t *car_str = print_object(car);
-
-      temp = snprintf(dest + strlen, string_size - strlen, "%s", car_str->datum.string);
-
-      if (temp >= (string_size - strlen)) {
-        string_size += temp + 1;
-        dest = realloc(dest, string_size);
-        memset(dest + strlen, 0, string_size - strlen);
-
-        temp = snprintf(dest + strlen, string_size - strlen, "%s", car_str->datum.string);
-        strlen += temp;
-      } else {
-        strlen += temp;
-      }
-
-      if (((cons*) cdr->datum.cons)->cdr->type != CONS) {
-        cdr = ((cons*) cdr->datum.cons)->cdr;
-        lisp_object_t *cdr_str = print_object(cdr);
-        temp = snprintf(dest + strlen, string_size - strlen, " . %s", cdr_str->datum.string);
-        if (temp >= (string_size - strlen)) {
-          string_size += temp + 1;
-          dest = realloc(dest, string_size);
-          memset(dest + strlen, 0, string_size - strlen);
-          strlen += snprintf(dest + strlen, string_size - strlen, " . %s", cdr_str->datum.string);
-        } else {
-          strlen += temp;
-        }
+      write_object(writer, CONS_VALUE(cdr)->car);
 
+      if (CONS_VALUE(cdr)->cdr->type != CONS) {
+        writer_write(writer, " . ", 3);
+        write_object(writer, CONS_VALUE(cdr)->cdr);
         break;
       }
 
-      cdr = ((cons*) cdr->datum.cons)->cdr;
-
-      if (cdr != NIL) {
-        temp = snprintf(dest + strlen, string_size - strlen, " ");
-        if (temp >= (string_size - strlen)) {
-          string_size += temp + 1;
-          dest = realloc(dest, string_size);
-          memset(dest + strlen, 0, string_size - strlen);
-          strlen += snprintf(dest + strlen, string_size - strlen, " ");
-        } else {
-          strlen += temp;
-        }
-
-      }
-    }
+      cdr = CONS_VALUE(cdr)->cdr;
 
-    temp = snprintf(dest + strlen, string_size - strlen, ")");
-    if (temp >= string_size) {
-      string_size += temp + 1;
-      dest = realloc(dest, string_size);
-      memset(dest + strlen, 0, string_size - strlen);
-      snprintf(dest + strlen, string_size, ")");
+      if (cdr != NIL)
+        writer_write(writer, " ", 1);
     }
 
+    writer_write(writer, ")", 1);
     break;
 
   case NATIVE_FUNCTION:
-    dest = strdup("NATIVE_FUNCTION");
+    writer_puts(writer, "NATIVE_FUNCTION");
     break;
 
   case LAMBDA:
-    dest = strdup("LAMBDA_CLOSURE");
+    writer_puts(writer, "LAMBDA_CLOSURE");
     break;
 
   case MACRO:
-    dest = strdup("META_LAMBDA_CLOSURE");
+    writer_puts(writer, "META_LAMBDA_CLOSURE");
     break;
 
-  default:
-    fprintf(stderr, "ERROR: print_object() not defined on given type. Panicing like a coward.\n");
+  case INPUT_PORT:
+    writer_puts(writer, "INPUT_PORT");
     break;
-  }
 
-  lisp_string->type = STRING;
-  lisp_string->datum.string = dest;
+  case CONTINUATION:
+    writer_puts(writer, "CONTINUATION");
+    break;
 
-  return lisp_string;
-}
+  case ERROR:
+    writer_puts(writer, "ERROR");
+    break;
 
-/*
- * This is a simple ``mark and sweep'' algorithm.
- * We go ahead and mark each object in the environment (and related
- * children) as used.
- * 
+  case THREAD:
+    writer_puts(writer, "THREAD");
+    break;
+
+  case CHANNEL:
+    writer_puts(writer, "CHANNEL");
+    break;
+
+  case BYTES:
+    writer_puts(writer, "BYTES");
+    break;
+
+  case STREAM:
+    writer_puts(writer, "STREAM");
+    break;
+
+  case OUTPUT_PORT:
+    writer_puts(writer, "OUTPUT_PORT");
+    break;
+
+  case HOST_FUNCTION:
+    writer_puts(writer, "HOST_FUNCTION");
+    break;
+
+  case F64VECTOR:
+  case I64VECTOR:
+    write_vector(writer, object);
+    break;
+
+  default:
+    fprintf(stderr, "ERROR: write_object() not defined on given type. Panicing like a coward.\n");
+    break;
+  }
+}
+
+void display_object(lisp_writer_t *writer, lisp_object_t *object) {
+  int display = writer->display;
+
+  writer->display = 1;
+  write_object(writer, object);
+  writer->display = display;
+}
+
+lisp_object_t* make_output_port(FILE *file, int close_file) {
+  lisp_object_t *port = make_lisp_object();
+  port->type = OUTPUT_PORT;
+  port->datum.writer = xmalloc(sizeof(lisp_writer_t));
+
+  if (file)
+    init_file_writer(port->datum.writer, file);
+  else
+    init_string_writer(port->datum.writer);
+
+  port->datum.writer->close_file = close_file;
+
+  return port;
+}
+
+lisp_object_t* current_output_port() {
+  return vm->output_port;
+}
+
+void set_current_output_port(lisp_object_t *port) {
+  vm->output_port = port;
+}
+
+lisp_object_t* print_object(lisp_object_t *object) {
+  lisp_writer_t writer;
+  init_string_writer(&writer);
+  write_object(&writer, object);
+
+  lisp_object_t *lisp_string = make_string(writer_finish(&writer));
+
+  return lisp_string;
+}
+
+/*
+ * This is a simple ``mark and sweep'' algorithm.
+ * We go ahead and mark each object in the environment (and related
+ * children) as used.
+ * 
  * Then, we go through the reference list and delete unused references.
  */
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* bookkeeping at the end of every collection */
+static void finish_gc(double started, size_t freed) {
+  double pause = now_ms() - started;
+
+  vm->stats.gc_count++;
+  vm->stats.last_pause_ms = pause;
+  vm->stats.total_pause_ms += pause;
+  if (pause > vm->stats.max_pause_ms)
+    vm->stats.max_pause_ms = pause;
+
+  vm->stats.last_freed = freed;
+  vm->stats.live_objects -= freed;
+  vm->stats.last_survivors = vm->stats.live_objects;
+  vm->allocated_at_gc = vm->objects_allocated;
+
+  if (vm->stats_log && vm->stats.gc_count % vm->stats_log_interval == 0)
+    log_memory_stats();
+}
+
+lisp_pin_t* pin_object(lisp_object_t *object) {
+  lisp_pin_t *pin = xmalloc(sizeof(lisp_pin_t));
+
+  pin->object = object;
+  pin->next = vm->pins;
+  pin->link = &vm->pins;
+
+  if (vm->pins)
+    vm->pins->link = &pin->next;
+
+  vm->pins = pin;
+
+  return pin;
+}
+
+lisp_object_t* pinned_object(lisp_pin_t *pin) {
+  return pin->object;
+}
+
+void unpin_object(lisp_pin_t *pin) {
+  *pin->link = pin->next;
+
+  if (pin->next)
+    pin->next->link = pin->link;
+
+  free(pin);
+}
+
+int lisp_evaluating() {
+  return vm->toplevel_point != NULL;
+}
+
+int maybe_gc(lisp_object_t *root) {
+  size_t threshold = vm->stats.last_survivors;
+
+  /* forked VMs allocate into the same objects */
+  if (heap_shared())
+    return 0;
+
+  if (threshold < GC_MIN_ALLOCATIONS)
+    threshold = GC_MIN_ALLOCATIONS;
+
+  if (vm->objects_allocated - vm->allocated_at_gc < threshold)
+    return 0;
+
+  do_gc(root);
+
+  return 1;
+}
+
 void do_gc(lisp_object_t *root) {
+  double started = now_ms();
+  size_t freed = 0;
+
+  /* calls in progress, the current thread's or those of suspended green
+     threads, keep whatever their stacks hold */
+  int scan_stacks = lisp_evaluating() || green_threads_alive();
+
+  if (scan_stacks && !os_stack_top())
+    return;
+
   unmark_all_references();
   mark(root);
 
+  /* interned symbols live as long as the runtime does */
+  for (size_t i = 0; i < vm->symbol_table_capacity; i++) {
+    if (vm->symbol_table[i])
+      vm->symbol_table[i]->marked = 1;
+  }
+
+  profile_mark_roots(mark);
+
+  for (lisp_pin_t *pin = vm->pins; pin; pin = pin->next)
+    mark(pin->object);
+
+  mark(vm->stdout_port);
+  mark(vm->output_port);
+
+  if (scan_stacks)
+    mark_stacks();
+
+  for (size_t i = 0; i < vm->marked_cells_count; i++)
+    vm->marked_cells[i]->marked = 0;
+
+  vm->marked_cells_count = 0;
+
   /* cleans the head of the list */
-  while (references != NULL && !references->node->marked) {
-    reference_list_t *next_ptr = references->next;
-    delete_object(references->node);
-    free(references);
-    references = next_ptr;
+  while (vm->references != NULL && !vm->references->node->marked) {
+    reference_list_t *next_ptr = vm->references->next;
+    delete_object(vm->references->node);
+    free(vm->references);
+    vm->references = next_ptr;
+    freed++;
   }
 
-  reference_list_t *previous_reference = references;
+  reference_list_t *previous_reference = vm->references;
   
-  if (!references) {
+  if (!vm->references) {
+    finish_gc(started, freed);
     return;
   }
 
-  reference_list_t *current_reference = references->next;
+  reference_list_t *current_reference = vm->references->next;
   
   /* Finally, we can iterate through the rest of the list */
   while (current_reference) {
@@ -345,12 +1265,15 @@ void do_gc(lisp_object_t *root) {
       delete_object(current_reference->node);
       free(current_reference);
       previous_reference->next = next_reference;
+      freed++;
     } else {
       previous_reference = current_reference;
     }
 
     current_reference = next_reference;
   }
+
+  finish_gc(started, freed);
 }
 
 void delete_object(lisp_object_t *object) {
@@ -372,6 +1295,8 @@ void delete_object(lisp_object_t *object) {
     break;
 
   case LAMBDA:
+  case MACRO:
+  case ERROR:
     if (object->datum.cons)
       free(object->datum.cons);
     break;
@@ -379,6 +1304,52 @@ void delete_object(lisp_object_t *object) {
   case NATIVE_FUNCTION:
     break;
 
+  case INPUT_PORT:
+    if (object->datum.reader)
+      close_reader(object->datum.reader);
+    break;
+
+  case CONTINUATION:
+    free(object->datum.continuation);
+    break;
+
+  case THREAD:
+  case CHANNEL:
+    green_delete_object(object);
+    break;
+
+  case BYTES:
+    if (!object->datum.bytes->borrowed)
+      free(object->datum.bytes->data);
+    else if (object->datum.bytes->release)
+      object->datum.bytes->release(object->datum.bytes->context);
+
+    free(object->datum.bytes);
+    break;
+
+  case F64VECTOR:
+  case I64VECTOR:
+    free(object->datum.vector->data.f64);
+    free(object->datum.vector);
+    break;
+
+  case HOST_FUNCTION:
+    if (object->datum.host->free_data)
+      object->datum.host->free_data(object->datum.host->data);
+
+    free(object->datum.host->name);
+    free(object->datum.host);
+    break;
+
+  case STREAM:
+    io_delete_stream(object);
+    break;
+
+  case OUTPUT_PORT:
+    free(writer_finish(object->datum.writer));
+    free(object->datum.writer);
+    break;
+
   default:
     break;
   }
@@ -387,7 +1358,7 @@ void delete_object(lisp_object_t *object) {
 }
 
 static void unmark_all_references() {
-  reference_list_t *reference = references;
+  reference_list_t *reference = vm->references;
 
   while (reference) {
     reference->node->marked = 0;
@@ -395,60 +1366,645 @@ static void unmark_all_references() {
   }
 }
 
+static void keep_marked_cell(lisp_object_t *cell) {
+  if (vm->marked_cells_count == vm->marked_cells_capacity) {
+    vm->marked_cells_capacity = vm->marked_cells_capacity ? vm->marked_cells_capacity * 2 : 256;
+    vm->marked_cells = realloc(vm->marked_cells,
+                               vm->marked_cells_capacity * sizeof(lisp_object_t*));
+
+    if (!vm->marked_cells) {
+      fprintf(stderr, "Error: out of memory.\n");
+      exit(1);
+    }
+  }
+
+  vm->marked_cells[vm->marked_cells_count++] = cell;
+}
+
+/* follows cdrs in a loop, so long lists don't nest calls as deep */
 static void mark(lisp_object_t *root) {
-  if (!root)
+  while (root && !root->marked) {
+    root->marked = 1;
+
+    if (root->type == CONS && has_flag(root, CONS_FRAME))
+      keep_marked_cell(root);
+
+    if ((root->type == CONS &&
+         root != NIL) || root->type == LAMBDA || root->type == MACRO || root->type == ERROR) {
+      mark(((cons*) root->datum.cons)->car);
+      mark(((cons*) root->datum.cons)->cache);
+      root = ((cons*) root->datum.cons)->cdr;
+    } else {
+      if (root->type == THREAD || root->type == CHANNEL)
+        green_mark_object(root, mark);
+
+      return;
+    }
+  }
+}
+
+/*
+ * While calls are in progress, what they hold is on their stacks. The
+ * evaluator's own, arg_stack and frame_stack, are marked exactly. The C
+ * stacks of eval() and the natives are scanned conservatively: a word
+ * that's the address of an object on the heap keeps it alive, whatever
+ * it really is. Addresses inside an object don't count, and nothing on
+ * the stacks is modified, so nothing there needs to be known precisely.
+ */
+typedef struct {
+  lisp_object_t **slots;        /* open addressed by address */
+  size_t mask;
+  uintptr_t low;                /* every object lies in [low, high] */
+  uintptr_t high;
+} object_table_t;
+
+static size_t address_hash(uintptr_t address, size_t mask) {
+  return (size_t) (((uint64_t) (address >> 4) * UINT64_C(0x9E3779B97F4A7C15)) >> 24) & mask;
+}
+
+static void build_object_table(object_table_t *table) {
+  size_t count = 0;
+  size_t capacity = 64;
+
+  for (reference_list_t *reference = vm->references; reference; reference = reference->next)
+    count++;
+
+  while (capacity < count * 2)
+    capacity *= 2;
+
+  table->slots = calloc(capacity, sizeof(lisp_object_t*));
+
+  if (!table->slots) {
+    fprintf(stderr, "Error: out of memory.\n");
+    exit(1);
+  }
+
+  table->mask = capacity - 1;
+  table->low = UINTPTR_MAX;
+  table->high = 0;
+
+  for (reference_list_t *reference = vm->references; reference; reference = reference->next) {
+    uintptr_t address = (uintptr_t) reference->node;
+    size_t i = address_hash(address, table->mask);
+
+    while (table->slots[i])
+      i = (i + 1) & table->mask;
+
+    table->slots[i] = reference->node;
+
+    if (address < table->low)
+      table->low = address;
+    if (address > table->high)
+      table->high = address;
+  }
+}
+
+static lisp_object_t* find_object(object_table_t *table, uintptr_t word) {
+  if (word < table->low || word > table->high)
+    return NULL;
+
+  for (size_t i = address_hash(word, table->mask); table->slots[i]; i = (i + 1) & table->mask) {
+    if ((uintptr_t) table->slots[i] == word)
+      return table->slots[i];
+  }
+
+  return NULL;
+}
+
+/* marks what the words in [low, high) point at; a stack is read whole,
+   including what the address sanitizer has fenced off */
+static __attribute__((no_sanitize_address)) void mark_range(object_table_t *table, const void *low, const void *high) {
+  uintptr_t start = ((uintptr_t) low + sizeof(uintptr_t) - 1) & ~(uintptr_t) (sizeof(uintptr_t) - 1);
+
+  for (const uintptr_t *word = (const uintptr_t*) start; (const void*) (word + 1) <= high; word++) {
+    lisp_object_t *object = find_object(table, *word);
+
+    if (object)
+      mark(object);
+  }
+}
+
+static void mark_exec(lisp_exec_t *exec) {
+  for (size_t i = 0; i < exec->arg_stack_top; i++)
+    mark(exec->arg_stack[i]);
+
+  for (size_t i = 0; i < exec->frame_stack_top; i++)
+    mark(exec->frame_stack[i]);
+
+  mark(exec->current_form);
+  mark(exec->output_port);
+}
+
+/* The top of the OS thread's stack, or NULL if it can't be found, in
+   which case nothing is collected while it's in use */
+static char* os_stack_top() {
+  static LISP_THREAD_LOCAL char *top;
+  static LISP_THREAD_LOCAL int looked;
+  pthread_attr_t attributes;
+  void *base;
+  size_t size;
+
+  if (!looked && pthread_getattr_np(pthread_self(), &attributes) == 0) {
+    if (pthread_attr_getstack(&attributes, &base, &size) == 0)
+      top = (char*) base + size;
+
+    pthread_attr_destroy(&attributes);
+  }
+
+  looked = 1;
+
+  return top;
+}
+
+/* Its frame lies below its caller's, so everything the calls in
+   progress have on the stack is above it */
+static __attribute__((noinline)) void mark_current_stack(object_table_t *table, char *top) {
+  mark_range(table, __builtin_frame_address(0), top);
+}
+
+static void mark_suspended(lisp_exec_t *exec, void *low, void *high, void *context,
+                           size_t context_size, void *data) {
+  object_table_t *table = data;
+
+  mark_exec(exec);
+  mark_range(table, low, high ? high : os_stack_top());
+  mark_range(table, context, (char*) context + context_size);
+}
+
+static void mark_stacks() {
+  object_table_t table;
+  lisp_exec_t exec;
+
+  build_object_table(&table);
+  lisp_exec_save(&exec);
+  mark_exec(&exec);
+
+  if (lisp_evaluating()) {
+    char *top = green_stack_top();
+
+    /* spills the registers the callers' objects may be in to the stack */
+    __builtin_unwind_init();
+    mark_current_stack(&table, top ? top : os_stack_top());
+  }
+
+  green_mark_threads(mark, mark_suspended, &table);
+  free(table.slots);
+}
+
+/*
+ * Calls don't cons their arguments. They're evaluated onto arg_stack, and
+ * a lambda's frame is built from cells that come from a free list instead
+ * of the heap (see frame_cons()). Those cells go back to the free list
+ * when the call returns, unless a closure has captured the frame, in which
+ * case they're handed over to the GC. A collection during a call marks
+ * through both stacks, see mark_stacks().
+ */
+static void push_arg(lisp_object_t *value) {
+  if (vm->arg_stack_top == vm->arg_stack_capacity) {
+    vm->arg_stack_capacity = vm->arg_stack_capacity ? vm->arg_stack_capacity * 2 : 256;
+    vm->arg_stack = realloc(vm->arg_stack, vm->arg_stack_capacity * sizeof(lisp_object_t*));
+
+    if (!vm->arg_stack) {
+      fprintf(stderr, "Error: out of memory.\n");
+      exit(1);
+    }
+  }
+
+  vm->arg_stack[vm->arg_stack_top++] = value;
+}
+
+/* pushes the elements of an already evaluated list, returning the base */
+static size_t push_list(lisp_object_t *list) {
+  size_t base = vm->arg_stack_top;
+
+  for (; list != NIL && list->type == CONS; list = CONS_VALUE(list)->cdr)
+    push_arg(CONS_VALUE(list)->car);
+
+  return base;
+}
+
+/* evaluates each argument onto the stack */
+static void push_args(lisp_object_t *arg_list, lisp_object_t *env) {
+  while (arg_list != NIL && arg_list->type == CONS) {
+    /* eval the args in applicative order */
+    push_arg(eval(CONS_VALUE(arg_list)->car, env));
+    arg_list = CONS_VALUE(arg_list)->cdr;
+  }
+
+  if (arg_list->type != CONS)
+    lisp_error("improperly formatted arguments to function.");
+}
+
+/* a cons that belongs to a call rather than to the heap */
+static lisp_object_t* frame_cons(lisp_object_t *car, lisp_object_t *cdr) {
+  lisp_object_t *object = vm->free_cells;
+
+  if (object) {
+    vm->free_cells = CONS_VALUE(object)->cdr;
+  } else {
+    object = xmalloc(sizeof(lisp_object_t));
+    object->datum.cons = xmalloc(sizeof(cons));
+    object->type = CONS;
+    object->marked = 0;
+  }
+
+  object->flags = CONS_FRAME;
+
+  cons *object_cons = CONS_VALUE(object);
+  object_cons->car = car;
+  object_cons->cdr = cdr;
+  object_cons->cache = NULL;
+
+  return object;
+}
+
+static void release_cell(lisp_object_t *cell) {
+  if (has_flag(cell, CONS_FRAME)) {
+    CONS_VALUE(cell)->cdr = vm->free_cells;
+    vm->free_cells = cell;
+  }
+}
+
+/* Releases a list of frame cells and the frame pairs in it. The cars of
+   an argument list are values, which are never frame cells. */
+static void release_frame(lisp_object_t *frame) {
+  if (!has_flag(frame, CONS_FRAME))
     return;
 
-  if (root->marked)
+  while (frame != NIL) {
+    lisp_object_t *next = CONS_VALUE(frame)->cdr;
+
+    release_cell(CONS_VALUE(frame)->car);
+    release_cell(frame);
+
+    frame = next;
+  }
+}
+
+/* the frames and argument lists of the calls in progress, innermost last,
+   so that a non-local exit can release them */
+static void push_frame(lisp_object_t *frame) {
+  if (vm->frame_stack_top == vm->frame_stack_capacity) {
+    vm->frame_stack_capacity = vm->frame_stack_capacity ? vm->frame_stack_capacity * 2 : 256;
+    vm->frame_stack = realloc(vm->frame_stack, vm->frame_stack_capacity * sizeof(lisp_object_t*));
+
+    if (!vm->frame_stack) {
+      fprintf(stderr, "Error: out of memory.\n");
+      exit(1);
+    }
+  }
+
+  vm->frame_stack[vm->frame_stack_top++] = frame;
+}
+
+static void pop_frame() {
+  release_frame(vm->frame_stack[--vm->frame_stack_top]);
+}
+
+static void promote_cell(lisp_object_t *cell) {
+  if (has_flag(cell, CONS_FRAME)) {
+    cell->flags &= ~CONS_FRAME;
+    create_reference(cell);
+    count_allocation(ALLOC_CONS, sizeof(cons));
+  }
+}
+
+/* A closure is keeping all of environment, so each of its frames that
+   still belongs to a call has to outlive it. Besides the innermost, that
+   can be the frames around a loop's, see push_loop_frame(). */
+static void capture_environment(lisp_object_t *environment) {
+  for (; is_frame(environment); environment = CONS_VALUE(CONS_VALUE(environment)->car)->cdr) {
+    if (!has_flag(environment, CONS_FRAME))
+      continue;
+
+    for (lisp_object_t *cell = environment; cell != NIL; cell = CONS_VALUE(cell)->cdr) {
+      promote_cell(CONS_VALUE(cell)->car);
+      promote_cell(cell);
+    }
+  }
+}
+
+/* the arguments from base up, as a list on the heap */
+static lisp_object_t* heap_list(size_t base) {
+  lisp_object_t *list = NIL;
+
+  for (size_t i = vm->arg_stack_top; i > base; i--)
+    list = make_cons(vm->arg_stack[i - 1], list);
+
+  return list;
+}
+
+static lisp_object_t* eval_arg_list(lisp_object_t *arg_list, lisp_object_t *env) {
+  size_t base = vm->arg_stack_top;
+
+  push_args(arg_list, env);
+
+  lisp_object_t *args = heap_list(base);
+  vm->arg_stack_top = base;
+
+  return args;
+}
+
+/* Returns the (symbol . value) pair binding symbol, searching each frame
+ * and then the frame it closes over, or NULL. A frame is an alist whose
+ * *lisp-super-env* binding (if any) points to the enclosing environment.
+ */
+static lisp_object_t* lookup_binding(lisp_object_t *symbol, lisp_object_t *environment) {
+  while (environment) {
+    lisp_object_t *super_env = NULL;
+
+    for (lisp_object_t *it = environment; it != NIL; it = CONS_VALUE(it)->cdr) {
+      lisp_object_t *binding = CONS_VALUE(it)->car;
+
+      if (CONS_VALUE(binding)->car == symbol)
+        return binding;
+      else if (CONS_VALUE(binding)->car == vm->super_env_symbol)
+        super_env = CONS_VALUE(binding)->cdr;
+    }
+
+    environment = super_env;
+  }
+
+  return NULL;
+}
+
+/*
+ * Resolves the operator of a call. Every call site (the call's own cons)
+ * caches the global binding its operator resolved to. That's only safe
+ * for symbols that have never been a lambda parameter, since anything
+ * else could be shadowed by a frame, and a binding found in a frame is
+ * never cached whatever the flag says. The cache needs no invalidation:
+ * set rebinds a global by changing the pair's value, and global pairs are
+ * never removed or replaced.
+ */
+static lisp_object_t* lookup_operator(lisp_object_t *call, lisp_object_t *symbol,
+                                      lisp_object_t *environment) {
+  cons *site = CONS_VALUE(call);
+  /* relaxed, as forked VMs may fill the same cache with the same binding */
+  lisp_object_t *cached = __atomic_load_n(&site->cache, __ATOMIC_RELAXED);
+
+  if (cached && !has_flag(symbol, SYMBOL_LEXICAL))
+    return CONS_VALUE(cached)->cdr;
+
+  lisp_object_t *binding = lookup_binding(symbol, environment);
+
+  if (!binding) {
+    vm->current_form = symbol;
+    return lisp_error("symbol \"%s\" not bound.", symbol->datum.symbol);
+  }
+
+  if (!has_flag(symbol, SYMBOL_LEXICAL) && !lookup_lexical(symbol, environment))
+    __atomic_store_n(&site->cache, binding, __ATOMIC_RELAXED);
+
+  return CONS_VALUE(binding)->cdr;
+}
+
+/*
+ * Closures are flat: instead of the whole environment, a closure made
+ * inside a call gets a new frame holding just the lexical bindings its
+ * body might refer to, followed by the global environment. Those bindings
+ * are the very pairs the enclosing frames hold, so set through either
+ * one is seen by both -- the pair is the box.
+ *
+ * The analysis is conservative. Every symbol in the form counts, as does
+ * every symbol in the definitions of the macros it calls, since their
+ * expansions may refer to variables the body never names. A body that
+ * uses eval, load, *lisp-super-env* or set on a computed symbol may touch
+ * any variable, so it captures the whole environment as before.
+ */
+typedef struct {
+  lisp_object_t *environment;   /* where macros are looked up */
+  lisp_object_t *symbols;
+  lisp_object_t *macros;
+  int full_capture;
+} closure_scan_t;
+
+static int list_contains(lisp_object_t *list, lisp_object_t *object);
+
+static int is_frame(lisp_object_t *environment) {
+  return environment != NIL
+    && CONS_VALUE(CONS_VALUE(environment)->car)->car == vm->super_env_symbol;
+}
+
+static void add_symbol(closure_scan_t *scan, lisp_object_t *symbol) {
+  if (has_flag(symbol, SYMBOL_SEEN))
     return;
 
-  root->marked = 1;
+  set_flag(symbol, SYMBOL_SEEN);
+  scan->symbols = make_cons(symbol, scan->symbols);
+}
+
+static void clear_seen(lisp_object_t *symbols) {
+  for (; symbols != NIL; symbols = CONS_VALUE(symbols)->cdr)
+    clear_flag(CONS_VALUE(symbols)->car, SYMBOL_SEEN);
+}
+
+/* is args of the form ((quote symbol) ...)? */
+static int quoted_symbol(lisp_object_t *args) {
+  if (args == NIL || args->type != CONS)
+    return 0;
+
+  lisp_object_t *first = CONS_VALUE(args)->car;
+
+  return first->type == CONS && first != NIL
+    && CONS_VALUE(first)->car == vm->quote_symbol
+    && CONS_VALUE(first)->cdr->type == CONS && CONS_VALUE(first)->cdr != NIL
+    && CONS_VALUE(CONS_VALUE(first)->cdr)->car->type == SYMBOL;
+}
+
+static void scan_form(closure_scan_t *scan, lisp_object_t *form) {
+  if (form->type == SYMBOL) {
+    if (form == vm->super_env_symbol)
+      scan->full_capture = 1;
+
+    add_symbol(scan, form);
+    return;
+  } else if (form->type != CONS || form == NIL) {
+    return;
+  }
+
+  lisp_object_t *head = CONS_VALUE(form)->car;
+
+  if (head == vm->eval_symbol || head == vm->load_symbol) {
+    scan->full_capture = 1;
+  } else if (head == vm->set_symbol) {
+    if (!quoted_symbol(CONS_VALUE(form)->cdr))
+      scan->full_capture = 1;
+  } else if (head->type == SYMBOL && !has_flag(head, SYMBOL_SPECIAL_FORM)) {
+    lisp_object_t *binding = lookup_binding(head, scan->environment);
+
+    if (binding && CONS_VALUE(binding)->cdr->type == MACRO
+        && !list_contains(scan->macros, CONS_VALUE(binding)->cdr))
+      scan->macros = make_cons(CONS_VALUE(binding)->cdr, scan->macros);
+  }
+
+  for (; form->type == CONS && form != NIL; form = CONS_VALUE(form)->cdr)
+    scan_form(scan, CONS_VALUE(form)->car);
+
+  scan_form(scan, form);
+}
+
+static lisp_object_t* analyze_form(lisp_object_t *form, lisp_object_t *environment,
+                                   lisp_object_t *in_progress) {
+  cons *form_cons = CONS_VALUE(form);
 
-  if ((root->type == CONS &&
-       root != NIL) || root->type == LAMBDA || root->type == MACRO) {
-    mark(((cons*) root->datum.cons)->car);
-    mark(((cons*) root->datum.cons)->cdr);
-  } 
+  if (form_cons->cache)
+    return form_cons->cache;
+
+  /* for macros whose expansions call themselves */
+  if (list_contains(in_progress, form))
+    return make_cons(NIL, NIL);
+
+  in_progress = make_cons(form, in_progress);
+
+  closure_scan_t scan = {environment, NIL, NIL, 0};
+  scan_form(&scan, form_cons->cdr);
+  clear_seen(scan.symbols);
+
+  for (lisp_object_t *it = scan.macros; it != NIL; it = CONS_VALUE(it)->cdr) {
+    lisp_object_t *macro = CONS_VALUE(it)->car;
+    lisp_object_t *used = analyze_form(CONS_VALUE(macro)->car, CONS_VALUE(macro)->cdr,
+                                       in_progress);
+
+    for (lisp_object_t *symbol = scan.symbols; symbol != NIL; symbol = CONS_VALUE(symbol)->cdr)
+      set_flag(CONS_VALUE(symbol)->car, SYMBOL_SEEN);
+
+    for (used = CONS_VALUE(used)->cdr; used != NIL; used = CONS_VALUE(used)->cdr)
+      add_symbol(&scan, CONS_VALUE(used)->car);
+
+    clear_seen(scan.symbols);
+  }
+
+  lisp_object_t *analysis = make_cons(scan.full_capture ? T : NIL, scan.symbols);
+  __atomic_store_n(&form_cons->cache, analysis, __ATOMIC_RELEASE);
+
+  return analysis;
+}
+
+/* Returns (full-capture . symbols) for a lambda or meta-lambda form,
+   caching it in the form's cons. Forked VMs may analyze the same form at
+   once, and the scratch marks on symbols only work for one at a time. */
+static lisp_object_t* analyze_closure(lisp_object_t *form, lisp_object_t *environment) {
+  lisp_object_t *analysis = __atomic_load_n(&CONS_VALUE(form)->cache, __ATOMIC_ACQUIRE);
+
+  if (analysis)
+    return analysis;
+
+  if (!heap_shared())
+    return analyze_form(form, environment, NIL);
+
+  pthread_mutex_lock(&analysis_lock);
+  analysis = analyze_form(form, environment, NIL);
+  pthread_mutex_unlock(&analysis_lock);
+
+  return analysis;
+}
+
+/* like lookup_binding(), but ignores the global environment */
+static lisp_object_t* lookup_lexical(lisp_object_t *symbol, lisp_object_t *environment) {
+  while (is_frame(environment)) {
+    for (lisp_object_t *it = CONS_VALUE(environment)->cdr; it != NIL; it = CONS_VALUE(it)->cdr) {
+      if (CONS_VALUE(CONS_VALUE(it)->car)->car == symbol)
+        return CONS_VALUE(it)->car;
+    }
+
+    environment = CONS_VALUE(CONS_VALUE(environment)->car)->cdr;
+  }
+
+  return NULL;
+}
+
+/* the environment a closure of form made in environment keeps */
+static lisp_object_t* closure_environment(lisp_object_t *form, lisp_object_t *environment) {
+  if (!is_frame(environment))
+    return environment;
+
+  lisp_object_t *analysis = analyze_closure(form, environment);
+
+  if (CONS_VALUE(analysis)->car == T) {
+    capture_environment(environment);
+    return environment;
+  }
+
+  lisp_object_t *global = environment;
+  while (is_frame(global))
+    global = CONS_VALUE(CONS_VALUE(global)->car)->cdr;
+
+  lisp_object_t *flat = make_cons(make_cons(vm->super_env_symbol, global), NIL);
+  lisp_object_t *last = flat;
+
+  for (lisp_object_t *it = CONS_VALUE(analysis)->cdr; it != NIL; it = CONS_VALUE(it)->cdr) {
+    lisp_object_t *symbol = CONS_VALUE(it)->car;
+    lisp_object_t *binding = NULL;
+
+    /* only symbols that have been parameters can be bound in a frame,
+       which images keep track of too, see write_image() */
+    if (!has_flag(symbol, SYMBOL_LEXICAL) || !(binding = lookup_lexical(symbol, environment)))
+      continue;
+
+    promote_cell(binding);
+    CONS_VALUE(last)->cdr = make_cons(binding, NIL);
+    last = CONS_VALUE(last)->cdr;
+  }
+
+  return flat;
+}
+
+void describe_uncaught(lisp_writer_t *writer, lisp_object_t *tag, lisp_object_t *value) {
+  if (tag == vm->error_symbol && value->type == ERROR) {
+    writer_puts(writer, CONS_VALUE(value)->car->datum.string);
+
+    if (CONS_VALUE(value)->cdr != NIL) {
+      writer_puts(writer, "\n  in: ");
+      write_object(writer, CONS_VALUE(value)->cdr);
+    }
+  } else {
+    writer_puts(writer, "no catch for tag ");
+    write_object(writer, tag);
+    writer_puts(writer, ".");
+  }
 }
 
-static lisp_object_t* eval_arg_list(lisp_object_t *arg_list, lisp_object_t *env) {
-  lisp_object_t *arg_ptr = arg_list;
-  lisp_object_t *args_cons  = make_cons(NULL, NULL);
-  lisp_object_t *to_return  = args_cons;
-  lisp_object_t **prev_ref  = &args_cons;
+void report_uncaught(lisp_object_t *tag, lisp_object_t *value) {
+  lisp_writer_t writer;
+  init_file_writer(&writer, stderr);
 
-  while (arg_ptr != NIL && arg_ptr->type == CONS) {
-    /* eval the args in applicative order */
-    lisp_object_t *arg_value = eval(CONS_VALUE(arg_ptr)->car, env);
+  writer_puts(&writer, "Error: ");
+  describe_uncaught(&writer, tag, value);
+  writer_write(&writer, "\n", 1);
+  writer_finish(&writer);
+}
 
-    if (arg_value == NULL)
-      return NULL;
+/* Runs an evaluation that nothing outside of it can catch, returning NULL
+   if it throws */
+static lisp_object_t* eval_toplevel(lisp_object_t *expression, lisp_object_t *environment) {
+  escape_point_t point;
+  lisp_object_t *result = NULL;
 
-    /* add the value to the car of the arg list*/
-    CONS_VALUE(args_cons)->car = arg_value;
-    prev_ref = &(CONS_VALUE(args_cons)->cdr);
-    CONS_VALUE(args_cons)->cdr = make_cons(NULL, NULL);
+  push_escape(&point, ESCAPE_CATCH_ALL, NULL);
 
-    arg_ptr = CONS_VALUE(arg_ptr)->cdr;
-    args_cons = CONS_VALUE(args_cons)->cdr;
+  if (setjmp(point.jump) == 0) {
+    result = eval(expression, environment);
+  } else {
+    report_uncaught(point.tag, point.value);
+    result = NULL;
   }
 
-  if (arg_ptr->type != CONS) {
-    fprintf(stderr, "Error: improperly formatted arguments to function.\n");
-    return NULL;
-  }
+  pop_escape(&point);
 
-  *prev_ref = NIL;
-  if (args_cons == NIL)
-    return NIL;
+  /* green threads it spawned get to run before the next top-level form */
+  green_run_pending();
 
-  return to_return;
+  return result;
 }
 
 lisp_object_t* eval(lisp_object_t *expression, lisp_object_t *environment) {
   lisp_object_t *expr = NULL;
-  lisp_object_t *super_env = NULL;
   lisp_object_t *car;
+  size_t base;
+
+  if (!vm->toplevel_point)
+    return eval_toplevel(expression, environment);
 
   switch (expression->type) {
 
@@ -456,21 +2012,13 @@ lisp_object_t* eval(lisp_object_t *expression, lisp_object_t *environment) {
     return expression;
 
   case SYMBOL:
-    expr = get(expression, environment);
-
-    if (expr == NULL) {
-      super_env = nice_get("*lisp-super-env*", environment);
+    expr = lookup_binding(expression, environment);
 
-      if (super_env != NULL) {
-        expr = eval(expression, super_env);
-      }
-    }
-
-    if (!expr && !super_env) {
-      fprintf(stderr, "Error: symbol \"%s\" not bound.\n", expression->datum.symbol);
-      return NULL;
+    if (!expr) {
+      vm->current_form = expression;
+      return lisp_error("symbol \"%s\" not bound.", expression->datum.symbol);
     }
-    return expr;
+    return CONS_VALUE(expr)->cdr;
 
   case NUMBER:
     return expression;
@@ -478,64 +2026,53 @@ lisp_object_t* eval(lisp_object_t *expression, lisp_object_t *environment) {
   case NATIVE_FUNCTION:
     return expression;
 
+  case HOST_FUNCTION:
+    return expression;
+
   case LAMBDA:
     return expression;
 
   case CONS:
-    /* handles our special cases */
-    if (expression == NIL) {
+    if (expression == NIL)
       return NIL;
-    } else if (CONS_VALUE(expression)->car->type == SYMBOL
-               && strcmp(CONS_VALUE(expression)->car->datum.symbol, "lambda") == 0) {
-      expr = make_cons(expression, environment);
-      expr->type = LAMBDA;
-      return expr;
-    } else if (CONS_VALUE(expression)->car->type == SYMBOL
-               && strcmp(CONS_VALUE(expression)->car->datum.symbol, "meta-lambda") == 0) {
-      expr = make_cons(expression, environment);
-      expr->type = MACRO;
-      return expr;
-    } else if (CONS_VALUE(expression)->car->type == SYMBOL
-               && strcmp(CONS_VALUE(expression)->car->datum.symbol, "quote") == 0) {
+
+    car = CONS_VALUE(expression)->car;
+    vm->current_form = expression;
+
+    /* handles our special cases */
+    if (car->type != SYMBOL || !has_flag(car, SYMBOL_SPECIAL_FORM)) {
+      /* an ordinary call */
+    } else if (car == vm->lambda_symbol) {
+      return make_pair(LAMBDA, ALLOC_CLOSURE, expression,
+                       closure_environment(expression, environment));
+    } else if (car == vm->meta_lambda_symbol) {
+      return make_pair(MACRO, ALLOC_CLOSURE, expression,
+                       closure_environment(expression, environment));
+    } else if (car == vm->quote_symbol) {
       return quote_func(CONS_VALUE(expression)->cdr);
-    } else if (CONS_VALUE(expression)->car->type == SYMBOL
-               && strcmp(CONS_VALUE(expression)->car->datum.symbol, "set") == 0) {
+    } else if (car == vm->set_symbol) {
       return set_func(expression, environment);
-    } else if (CONS_VALUE(expression)->car->type == SYMBOL
-               && strcmp(CONS_VALUE(expression)->car->datum.symbol, "if") == 0) {
+    } else if (car == vm->if_symbol) {
       return if_func(CONS_VALUE(expression)->cdr, environment);
-    } else if (CONS_VALUE(expression)->car->type == SYMBOL
-               && strcmp(CONS_VALUE(expression)->car->datum.symbol, "eval") == 0) {
-      if (CONS_VALUE(expression)->cdr == NIL) {
-        fprintf(stderr, "Error: eval requires 1 argument, but received 0.\n");
-        return NULL;
-      }
+    } else if (car == vm->eval_symbol) {
+      if (CONS_VALUE(expression)->cdr == NIL)
+        return lisp_error("eval requires 1 argument, but received 0.");
 
       return eval(eval(CONS_VALUE(CONS_VALUE(expression)->cdr)->car, environment),
                   environment);
-    } else if (CONS_VALUE(expression)->car->type == SYMBOL
-               && strcmp(CONS_VALUE(expression)->car->datum.symbol, "load") == 0) {
-      lisp_object_t *xargs = eval_arg_list(CONS_VALUE(expression)->cdr, environment);
-      return load(xargs, environment);
-    } else if (CONS_VALUE(expression)->car->type == SYMBOL
-               && strcmp(CONS_VALUE(expression)->car->datum.symbol, "apply") == 0) {
+    } else if (car == vm->load_symbol) {
+      return load(eval_arg_list(CONS_VALUE(expression)->cdr, environment), environment);
+    } else if (car == vm->apply_symbol) {
       if (CONS_VALUE(expression)->cdr == NIL) {
-        fprintf(stderr, "Error: apply requires 2 arguments, but received 0.\n");
-        return NULL;
+        return lisp_error("apply requires 2 arguments, but received 0.");
       } else if (CONS_VALUE(CONS_VALUE(expression)->cdr)->cdr == NIL) {
-        fprintf(stderr, "Error: apply requires 2 arguments, but received 1.\n");
-        return NULL;
+        return lisp_error("apply requires 2 arguments, but received 1.");
       }
 
-      lisp_object_t *quote_obj = make_lisp_object();
-      quote_obj->type = SYMBOL;
-      quote_obj->datum.symbol = strdup("quote");
+      lisp_object_t *quote_obj = vm->quote_symbol;
       
       lisp_object_t *args = eval(CONS_VALUE(CONS_VALUE(CONS_VALUE(expression)->cdr)->cdr)->car, environment);
 
-      if (!args)
-        return NULL;
-      
       lisp_object_t *real_args = make_cons(NULL, NULL);
       lisp_object_t **last_ref = &real_args;
       lisp_object_t *arg_it = args;
@@ -555,96 +2092,311 @@ lisp_object_t* eval(lisp_object_t *expression, lisp_object_t *environment) {
       
       lisp_object_t *f = eval(CONS_VALUE(CONS_VALUE(expression)->cdr)->car, environment);
 
-      if (!f)
-        return NULL;
-      
       return apply(f, real_args, environment);
+    } else if (car == vm->while_symbol) {
+      return while_loop(expression, environment);
+    } else if (car == vm->dotimes_symbol) {
+      return dotimes_loop(expression, environment);
+    } else if (car == vm->dolist_symbol) {
+      return dolist_loop(expression, environment);
     }
 
-    car = eval(CONS_VALUE(expression)->car, environment);
+    if (car->type == SYMBOL)
+      car = lookup_operator(expression, car, environment);
+    else
+      car = eval(car, environment);
+
+    if (car->type != NATIVE_FUNCTION && car->type != LAMBDA && car->type != HOST_FUNCTION) {
+      vm->current_form = expression;
+      return apply(car, CONS_VALUE(expression)->cdr, environment);
+    }
 
-    if (car == NULL)
-      return NULL;
+    /* an ordinary call, where errors are reported against the call */
+    base = vm->arg_stack_top;
+    push_args(CONS_VALUE(expression)->cdr, environment);
+    vm->current_form = expression;
 
-    return apply(car, CONS_VALUE(expression)->cdr, environment);
+    return invoke(car, base);
 
   default:
     return NIL;
   }
 }
 
-lisp_object_t* apply(lisp_object_t *f, lisp_object_t *xargs, lisp_object_t *env) {
-  if (f->type == NATIVE_FUNCTION) {
-    lisp_object_t *cdr = eval_arg_list(xargs, env);
+void push_escape(escape_point_t *point, escape_kind kind, lisp_object_t *tag) {
+  point->kind = kind;
+  point->tag = tag;
+  point->value = NULL;
+  point->pending = NULL;
+  point->id = ++vm->escape_point_count;
+  point->arg_stack_top = vm->arg_stack_top;
+  point->frame_depth = vm->frame_stack_top;
+  point->profile_depth = profile_depth();
+  point->previous = vm->escape_points;
+
+  vm->escape_points = point;
+
+  if (kind == ESCAPE_CATCH_ALL && !vm->toplevel_point)
+    vm->toplevel_point = point;
+}
 
-    if (!cdr)
-      return NULL;
+void pop_escape(escape_point_t *point) {
+  vm->escape_points = point->previous;
 
-    return f->datum.native_func(cdr);
-  } else if (f->type == LAMBDA) {
-    lisp_object_t *cdr = eval_arg_list(xargs, env);
+  /* nothing is being evaluated anymore, so there's no form to blame */
+  if (vm->toplevel_point == point) {
+    vm->toplevel_point = NULL;
+    vm->current_form = NULL;
+  }
+}
 
-    if (!cdr)
-      return NULL;
+void escape_to(escape_point_t *point, lisp_object_t *value) {
+  escape_point_t *target = point;
 
-    return apply_lambda(f, cdr);
-  } else if (f->type == MACRO) {
-    lisp_object_t *expansion = apply_lambda(f, xargs);
+  /* the innermost cleanup on the way gets to run first */
+  for (escape_point_t *it = vm->escape_points; it != point; it = it->previous) {
+    if (it->kind == ESCAPE_CLEANUP) {
+      it->pending = point;
+      target = it;
+      break;
+    }
+  }
+
+  while (vm->frame_stack_top > target->frame_depth)
+    pop_frame();
+
+  vm->arg_stack_top = target->arg_stack_top;
+  profile_unwind(target->profile_depth);
+
+  /* any points in between are gone with the C frames that pushed them */
+  vm->escape_points = target;
+  target->value = value;
+
+  longjmp(target->jump, 1);
+}
+
+void resume_escape(escape_point_t *point) {
+  escape_to(point->pending, point->value);
+}
+
+void throw_to(lisp_object_t *tag, lisp_object_t *value) {
+  for (escape_point_t *point = vm->escape_points; point; point = point->previous) {
+    if (point->kind == ESCAPE_CATCH_ALL) {
+      point->tag = tag;
+      escape_to(point, value);
+    } else if (point->kind == ESCAPE_CATCH && point->tag && point->tag == tag) {
+      escape_to(point, value);
+    }
+  }
+
+  /* only C code calling natives directly gets here */
+  report_uncaught(tag, value);
+  exit(1);
+}
+
+lisp_object_t* make_error(lisp_object_t *message, lisp_object_t *form) {
+  if (!form)
+    form = vm->current_form ? vm->current_form : NIL;
+
+  return make_pair(ERROR, ALLOC_OTHER, message, form);
+}
+
+lisp_object_t* lisp_error(const char *format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+
+  char *message = xmalloc(length + 1);
+
+  va_start(args, format);
+  vsnprintf(message, length + 1, format, args);
+  va_end(args);
+
+  throw_to(vm->error_symbol, make_error(make_string(message), NULL));
+}
+
+lisp_object_t* make_continuation(escape_point_t *point) {
+  lisp_object_t *object = make_lisp_object();
+  object->type = CONTINUATION;
+  object->datum.continuation = xmalloc(sizeof(struct continuation));
+  object->datum.continuation->point = point;
+  object->datum.continuation->id = point->id;
+
+  return object;
+}
+
+/* Continuations can only escape: once the call/cc that made one has
+   returned, there's nothing left to jump to. */
+static lisp_object_t* continue_with(lisp_object_t *k, size_t base) {
+  struct continuation *continuation = k->datum.continuation;
+  size_t argc = vm->arg_stack_top - base;
+  lisp_object_t *value = argc ? vm->arg_stack[base] : NIL;
+
+  vm->arg_stack_top = base;
+
+  if (argc > 1)
+    return lisp_error("a continuation accepts no more than 1 argument.");
 
-    if (!expansion)
-      return NULL;
+  for (escape_point_t *point = vm->escape_points; point; point = point->previous) {
+    if (point == continuation->point && point->id == continuation->id)
+      escape_to(point, value);
+  }
+
+  return lisp_error("continuation called after its extent ended.");
+}
+
+/* Host functions take an array, which is copied off the stack since a
+   call back into Lisp could move it */
+static lisp_object_t* call_host(lisp_object_t *f, size_t base) {
+  lisp_host_t *host = f->datum.host;
+  size_t argc = vm->arg_stack_top - base;
+  lisp_object_t *args[argc ? argc : 1];
+
+  memcpy(args, vm->arg_stack + base, argc * sizeof(lisp_object_t*));
+  vm->arg_stack_top = base;
+
+  if (host->arity >= 0 && argc != (size_t) host->arity)
+    return lisp_error("%s requires %d arguments, but received %lu.",
+                      host->name, host->arity, (unsigned long) argc);
+
+  return host->function(args, argc, host->data);
+}
+
+/* Runs f on the arguments from base up, which it pops */
+static lisp_object_t* call(lisp_object_t *f, size_t base) {
+  if (f->type == CONTINUATION)
+    return continue_with(f, base);
+  else if (f->type == HOST_FUNCTION)
+    return call_host(f, base);
+  else if (f->type != NATIVE_FUNCTION)
+    return apply_lambda(f, base);
+
+  /* natives take a list, which only lives as long as the call */
+  lisp_object_t *args = NIL;
+  for (size_t i = vm->arg_stack_top; i > base; i--)
+    args = frame_cons(vm->arg_stack[i - 1], args);
+  vm->arg_stack_top = base;
+
+  push_frame(args);
+  lisp_object_t *result = f->datum.native_func(args);
+  pop_frame();
+
+  return result;
+}
+
+/* Runs call(), under the profiler when it's recording */
+static lisp_object_t* invoke(lisp_object_t *f, size_t base) {
+  lisp_object_t *result = NULL;
+
+  if (!profile_enabled)
+    return call(f, base);
+
+  profile_enter(f, f->type == MACRO);
+  result = call(f, base);
+  profile_exit();
+
+  return result;
+}
+
+lisp_object_t* apply(lisp_object_t *f, lisp_object_t *xargs, lisp_object_t *env) {
+  size_t base = vm->arg_stack_top;
 
-    return eval(expansion, env);
+  if (f->type == NATIVE_FUNCTION || f->type == LAMBDA || f->type == HOST_FUNCTION) {
+    push_args(xargs, env);
+
+    return invoke(f, base);
+  } else if (f->type == CONTINUATION) {
+    push_args(xargs, env);
+
+    return continue_with(f, base);
+  } else if (f->type == MACRO) {
+    return eval(invoke(f, push_list(xargs)), env);
   } else {
-    fprintf(stderr, "Error: unknown type to apply.\n");
-    return NIL;
+    return lisp_error("unknown type to apply.");
   }
 }
 
-static lisp_object_t* apply_lambda(lisp_object_t *lambda_expr,
-                                   lisp_object_t *xargs) {
+lisp_object_t* funcall(lisp_object_t *f, lisp_object_t *args) {
+  if (f->type == NATIVE_FUNCTION || f->type == LAMBDA || f->type == HOST_FUNCTION) {
+    return invoke(f, push_list(args));
+  } else if (f->type == CONTINUATION) {
+    return continue_with(f, push_list(args));
+  } else {
+    return lisp_error("unknown type to apply.");
+  }
+}
+
+lisp_object_t* funcall_array(lisp_object_t *f, size_t argc, lisp_object_t **argv) {
+  size_t base = vm->arg_stack_top;
+
+  if (f->type != NATIVE_FUNCTION && f->type != LAMBDA && f->type != HOST_FUNCTION
+      && f->type != CONTINUATION)
+    return lisp_error("unknown type to apply.");
+
+  for (size_t i = 0; i < argc; i++)
+    push_arg(argv[i]);
+
+  if (f->type == CONTINUATION)
+    return continue_with(f, base);
+
+  return invoke(f, base);
+}
+
+static lisp_object_t* apply_lambda(lisp_object_t *lambda_expr, size_t base) {
   lisp_object_t *lambda_object = CONS_VALUE(lambda_expr)->car;
   lisp_object_t *lexical_env = CONS_VALUE(lambda_expr)->cdr;
   lisp_object_t *lambda_list = NULL;
   lisp_object_t *lambda_body = NULL;
-  lisp_object_t *lambda_env = NIL;
+  size_t argc = vm->arg_stack_top - base;
+  size_t i = 0;
 
-  if (CONS_VALUE(CONS_VALUE(lambda_object)->cdr)->car->type != CONS) {
-    fprintf(stderr, "Error: lambda is missing a lambda list.\n");
-    return NULL;
-  }
+  if (CONS_VALUE(CONS_VALUE(lambda_object)->cdr)->car->type != CONS)
+    return lisp_error("lambda is missing a lambda list.");
 
   lambda_list = CONS_VALUE(CONS_VALUE(lambda_object)->cdr)->car;
   lambda_body = CONS_VALUE(CONS_VALUE(lambda_object)->cdr)->cdr;
-  lambda_env  = nice_set("*lisp-super-env*", lexical_env, lambda_env);
 
   /* first, we create a new environment w/ variables bound properly */
+  lisp_object_t *lambda_env = frame_cons(frame_cons(vm->super_env_symbol, lexical_env), NIL);
+  lisp_object_t *last_binding = lambda_env;
+  push_frame(lambda_env);
   lisp_object_t *param_nav = lambda_list;
-  lisp_object_t *arg_nav = xargs;
-  while (param_nav != NIL && arg_nav != NIL &&
-         param_nav->type == CONS && arg_nav->type == CONS) {
-    lambda_env = set(CONS_VALUE(param_nav)->car, CONS_VALUE(arg_nav)->car, lambda_env);
+
+  while (param_nav != NIL && param_nav->type == CONS && i < argc) {
+    lisp_object_t *param = CONS_VALUE(param_nav)->car;
+
+    if (param->type != SYMBOL)
+      break;
+
+    if (!has_flag(param, SYMBOL_LEXICAL))
+      set_flag(param, SYMBOL_LEXICAL);
+    CONS_VALUE(last_binding)->cdr = frame_cons(frame_cons(param, vm->arg_stack[base + i]), NIL);
+    last_binding = CONS_VALUE(last_binding)->cdr;
 
     param_nav = CONS_VALUE(param_nav)->cdr;
-    arg_nav = CONS_VALUE(arg_nav)->cdr;
+    i++;
   }
 
   /* then we have a dotted list */
   if (param_nav != NIL && param_nav->type == SYMBOL) {
-    lambda_env = set(param_nav, arg_nav, lambda_env);
+    if (!has_flag(param_nav, SYMBOL_LEXICAL))
+      set_flag(param_nav, SYMBOL_LEXICAL);
+    CONS_VALUE(last_binding)->cdr = frame_cons(frame_cons(param_nav, heap_list(base + i)), NIL);
     param_nav = NIL;
-    arg_nav = NIL;
-  } else if (param_nav != NIL) {
-    fprintf(stderr, "Error: badly named function parameter.\n");
-    return NULL;
+    i = argc;
   }
-  
-  if (param_nav != NIL) {
-    fprintf(stderr, "Error: too few parameters supplied to function.\n");
-    return NULL;
-  } else if (arg_nav != NIL) {
-    fprintf(stderr, "Error: too many parameters supplied to function.\n");
-    return NULL;
+
+  vm->arg_stack_top = base;
+
+  if (param_nav != NIL && (param_nav->type != CONS
+                           || CONS_VALUE(param_nav)->car->type != SYMBOL)) {
+    return lisp_error("badly named function parameter.");
+  } else if (param_nav != NIL) {
+    return lisp_error("too few parameters supplied to function.");
+  } else if (i < argc) {
+    return lisp_error("too many parameters supplied to function.");
   }
 
   lisp_object_t *lambda_it = lambda_body;
@@ -656,26 +2408,353 @@ static lisp_object_t* apply_lambda(lisp_object_t *lambda_expr,
     lambda_it = CONS_VALUE(lambda_it)->cdr;
   }
 
+  pop_frame();
+
   return result;
 }
 
-lisp_object_t* get(lisp_object_t *symbol, lisp_object_t *environment) {
-  if (symbol->type != SYMBOL) {
-    fprintf(stderr, "Error: get expects its first argument to be of type SYMBOL.\n");
-    return NULL;
+static int same_form(lisp_object_t *a, lisp_object_t *b) {
+  while (a != b) {
+    if (a == NULL || b == NULL || a->type != b->type)
+      return 0;
+
+    switch (a->type) {
+
+    case NUMBER:
+      return a->datum.number == b->datum.number;
+
+    case STRING:
+      return strcmp(a->datum.string, b->datum.string) == 0;
+
+    case SYMBOL:
+      return strcmp(a->datum.symbol, b->datum.symbol) == 0;
+
+    case CONS:
+      if (a == NIL || b == NIL)
+        return 0;
+
+      if (!same_form(CONS_VALUE(a)->car, CONS_VALUE(b)->car))
+        return 0;
+
+      a = CONS_VALUE(a)->cdr;
+      b = CONS_VALUE(b)->cdr;
+      break;
+
+    default:
+      return 0;
+    }
   }
 
-  if (environment->type != CONS) {
-    fprintf(stderr, "Error: get expects its second argument to be of type CONS.\n");
-    return NULL;
+  return 1;
+}
+
+static int list_contains(lisp_object_t *list, lisp_object_t *object) {
+  for (; list != NIL && list->type == CONS; list = CONS_VALUE(list)->cdr) {
+    if (CONS_VALUE(list)->car == object)
+      return 1;
   }
 
+  return 0;
+}
+
+/* counts the proper part of a list, noting whether it ends in a dotted tail */
+static size_t count_list(lisp_object_t *list, int *dotted) {
+  size_t count = 0;
+
+  for (; list != NIL && list->type == CONS; list = CONS_VALUE(list)->cdr)
+    count++;
+
+  *dotted = (list != NIL);
+
+  return count;
+}
+
+static lisp_object_t* expand_form(lisp_object_t *form, lisp_object_t *env,
+                                  lisp_object_t *bound, lisp_object_t *in_progress);
+
+static lisp_object_t* expand_list(lisp_object_t *list, lisp_object_t *env,
+                                  lisp_object_t *bound, lisp_object_t *in_progress) {
+  lisp_object_t *expanded = NIL;
+  lisp_object_t **tail = &expanded;
+
+  for (; list != NIL && list->type == CONS; list = CONS_VALUE(list)->cdr) {
+    lisp_object_t *cell = make_cons(expand_form(CONS_VALUE(list)->car, env,
+                                                bound, in_progress), NIL);
+    *tail = cell;
+    tail = &CONS_VALUE(cell)->cdr;
+  }
+  *tail = list;
+
+  return expanded;
+}
+
+/* Expands every macro call in an evaluated position of form. Calls that
+ * can't be expanded safely ahead of time -- the macro name is shadowed,
+ * the arity is off, or the expansion would just produce the same call
+ * again -- are left for eval() to expand when (and if) they run.
+ */
+static lisp_object_t* expand_form(lisp_object_t *form, lisp_object_t *env,
+                                  lisp_object_t *bound, lisp_object_t *in_progress) {
+  if (form == NIL || form->type != CONS)
+    return form;
+
+  lisp_object_t *head = CONS_VALUE(form)->car;
+  lisp_object_t *rest = CONS_VALUE(form)->cdr;
+
+  if (head->type != SYMBOL)
+    return expand_list(form, env, bound, in_progress);
+
+  if (strcmp(head->datum.symbol, "quote") == 0)
+    return form;
+
+  if (strcmp(head->datum.symbol, "lambda") == 0
+      || strcmp(head->datum.symbol, "meta-lambda") == 0) {
+    if (rest == NIL || rest->type != CONS)
+      return form;
+
+    lisp_object_t *params = CONS_VALUE(rest)->car;
+    lisp_object_t *param = params;
+
+    for (; param != NIL && param->type == CONS; param = CONS_VALUE(param)->cdr)
+      bound = make_cons(CONS_VALUE(param)->car, bound);
+
+    if (param != NIL)
+      bound = make_cons(param, bound);
+
+    return make_cons(head, make_cons(params, expand_list(CONS_VALUE(rest)->cdr, env,
+                                                         bound, in_progress)));
+  }
+
+  /* the variable is bound in the body and result, but not the count or list */
+  if (strcmp(head->datum.symbol, "dotimes") == 0 || strcmp(head->datum.symbol, "dolist") == 0) {
+    if (rest == NIL || rest->type != CONS)
+      return form;
+
+    lisp_object_t *spec = CONS_VALUE(rest)->car;
+
+    if (spec == NIL || spec->type != CONS || CONS_VALUE(spec)->cdr == NIL
+        || CONS_VALUE(spec)->cdr->type != CONS)
+      return form;
+
+    lisp_object_t *inner = make_cons(CONS_VALUE(spec)->car, bound);
+    lisp_object_t *spec_rest = CONS_VALUE(spec)->cdr;
+
+    spec = make_cons(CONS_VALUE(spec)->car,
+                     make_cons(expand_form(CONS_VALUE(spec_rest)->car, env, bound, in_progress),
+                               expand_list(CONS_VALUE(spec_rest)->cdr, env, inner,
+                                           in_progress)));
+
+    return make_cons(head, make_cons(spec, expand_list(CONS_VALUE(rest)->cdr, env, inner,
+                                                       in_progress)));
+  }
+
+  lisp_object_t *macro = list_contains(bound, head) ? NULL : get(head, env);
+
+  if (macro == NULL || macro->type != MACRO)
+    return expand_list(form, env, bound, in_progress);
+
+  int params_dotted = 0;
+  int args_dotted = 0;
+  lisp_object_t *lambda_object = CONS_VALUE(macro)->car;
+  size_t params = count_list(CONS_VALUE(CONS_VALUE(lambda_object)->cdr)->car, &params_dotted);
+  size_t args = count_list(rest, &args_dotted);
+
+  if (args_dotted || args < params || (args > params && !params_dotted))
+    return form;
+
+  for (lisp_object_t *it = in_progress; it != NIL; it = CONS_VALUE(it)->cdr) {
+    if (same_form(CONS_VALUE(it)->car, form))
+      return form;
+  }
+
+  /* a macro that fails now is left to fail when the call is evaluated */
+  escape_point_t point;
+  lisp_object_t *expansion = NULL;
+
+  push_escape(&point, ESCAPE_CATCH_ALL, NULL);
+
+  if (setjmp(point.jump) == 0)
+    expansion = apply_lambda(macro, push_list(rest));
+
+  pop_escape(&point);
+
+  if (expansion == NULL)
+    return form;
+
+  return expand_form(expansion, env, bound, make_cons(form, in_progress));
+}
+
+lisp_object_t* macroexpand_all(lisp_object_t *form, lisp_object_t *environment) {
+  return expand_form(form, environment, NIL, NIL);
+}
+
+static lisp_object_t* eval_body(lisp_object_t *body, lisp_object_t *environment) {
+  lisp_object_t *result = NIL;
+
+  for (; body != NIL && body->type == CONS; body = CONS_VALUE(body)->cdr)
+    result = eval(CONS_VALUE(body)->car, environment);
+
+  return result;
+}
+
+/*
+ * Loops run in C, so an iteration costs no C stack and no environment.
+ * dotimes and dolist bind their variable in one frame for the whole loop
+ * and update the binding in place, which means closures made in the body
+ * all share it, and see its latest value. Whatever an iteration leaves
+ * behind can be collected before the next, see loop_safe_point().
+ *
+ * The macros in a loop's body are expanded the first time the loop runs,
+ * as compile-file would, and the expansion is kept in the loop's cons
+ * like a closure's analysis is (see analyze_closure()). So a macro that's
+ * redefined later isn't seen by loops that have already run. Variables
+ * bound in the enclosing frames shadow macros just as they do in eval().
+ */
+static lisp_object_t* expand_loop(lisp_object_t *loop, lisp_object_t *forms,
+                                  lisp_object_t *variable, lisp_object_t *environment) {
+  lisp_object_t *expansion = __atomic_load_n(&CONS_VALUE(loop)->cache, __ATOMIC_ACQUIRE);
+
+  if (expansion)
+    return expansion;
+
+  lisp_object_t *bound = variable ? make_cons(variable, NIL) : NIL;
+
+  for (; is_frame(environment); environment = CONS_VALUE(CONS_VALUE(environment)->car)->cdr) {
+    for (lisp_object_t *it = CONS_VALUE(environment)->cdr; it != NIL; it = CONS_VALUE(it)->cdr)
+      bound = make_cons(CONS_VALUE(CONS_VALUE(it)->car)->car, bound);
+  }
+
+  /* forked VMs may store the same expansion at once */
+  expansion = expand_list(forms, environment, bound, NIL);
+  __atomic_store_n(&CONS_VALUE(loop)->cache, expansion, __ATOMIC_RELEASE);
+
+  return expansion;
+}
+
+/* Top-level forms are where garbage is usually collected, so a loop lets
+   the collector in on each iteration as well */
+static void loop_safe_point() {
+  maybe_gc(vm->global_environment);
+}
+
+static lisp_object_t* while_loop(lisp_object_t *loop, lisp_object_t *environment) {
+  lisp_object_t *args = CONS_VALUE(loop)->cdr;
+
+  if (args == NIL || args->type != CONS)
+    return lisp_error("while requires a test.");
+
+  args = expand_loop(loop, args, NULL, environment);
+
+  while (eval(CONS_VALUE(args)->car, environment) != NIL) {
+    eval_body(CONS_VALUE(args)->cdr, environment);
+    loop_safe_point();
+  }
+
+  return NIL;
+}
+
+/* checks for the (variable form [result]) a dotimes or dolist starts with */
+static lisp_object_t* loop_spec(lisp_object_t *args, const char *name) {
+  lisp_object_t *spec = (args != NIL && args->type == CONS) ? CONS_VALUE(args)->car : NIL;
+  size_t length = 0;
+  lisp_object_t *it = spec;
+
+  for (; it != NIL && it->type == CONS; it = CONS_VALUE(it)->cdr)
+    length++;
+
+  if (it != NIL || length < 2 || length > 3 || CONS_VALUE(spec)->car->type != SYMBOL)
+    lisp_error("%s expects (variable form [result]) as its first argument.", name);
+
+  return spec;
+}
+
+/* A frame holding only the loop's variable, returning its binding */
+static lisp_object_t* push_loop_frame(lisp_object_t *symbol, lisp_object_t *environment,
+                                      lisp_object_t **frame) {
+  lisp_object_t *binding = frame_cons(symbol, NIL);
+
+  if (!has_flag(symbol, SYMBOL_LEXICAL))
+    set_flag(symbol, SYMBOL_LEXICAL);
+
+  *frame = frame_cons(frame_cons(vm->super_env_symbol, environment), frame_cons(binding, NIL));
+  push_frame(*frame);
+
+  return binding;
+}
+
+/* evaluates the result form, if any, and pops the loop's frame */
+static lisp_object_t* finish_loop(lisp_object_t *spec, lisp_object_t *frame) {
+  lisp_object_t *result = CONS_VALUE(CONS_VALUE(spec)->cdr)->cdr;
+
+  result = result == NIL ? NIL : eval(CONS_VALUE(result)->car, frame);
+  pop_frame();
+
+  return result;
+}
+
+static lisp_object_t* dotimes_loop(lisp_object_t *loop, lisp_object_t *environment) {
+  lisp_object_t *args = CONS_VALUE(loop)->cdr;
+  lisp_object_t *spec = loop_spec(args, "dotimes");
+  lisp_object_t *count = eval(CONS_VALUE(CONS_VALUE(spec)->cdr)->car, environment);
+  lisp_object_t *frame;
+  double i = 0;
+
+  if (count->type != NUMBER)
+    return lisp_error("dotimes expects its count to be of type NUMBER.");
+
+  lisp_object_t *body = expand_loop(loop, CONS_VALUE(args)->cdr, CONS_VALUE(spec)->car,
+                                    environment);
+  lisp_object_t *binding = push_loop_frame(CONS_VALUE(spec)->car, environment, &frame);
+
+  for (; i < count->datum.number; i++) {
+    CONS_VALUE(binding)->cdr = make_number(i);
+    eval_body(body, frame);
+    loop_safe_point();
+  }
+
+  /* the result sees how many times the loop ran */
+  CONS_VALUE(binding)->cdr = make_number(i);
+
+  return finish_loop(spec, frame);
+}
+
+static lisp_object_t* dolist_loop(lisp_object_t *loop, lisp_object_t *environment) {
+  lisp_object_t *args = CONS_VALUE(loop)->cdr;
+  lisp_object_t *spec = loop_spec(args, "dolist");
+  lisp_object_t *list = eval(CONS_VALUE(CONS_VALUE(spec)->cdr)->car, environment);
+  lisp_object_t *frame;
+
+  if (list->type != CONS)
+    return lisp_error("dolist expects a list.");
+
+  lisp_object_t *body = expand_loop(loop, CONS_VALUE(args)->cdr, CONS_VALUE(spec)->car,
+                                    environment);
+  lisp_object_t *binding = push_loop_frame(CONS_VALUE(spec)->car, environment, &frame);
+
+  for (; list != NIL && list->type == CONS; list = CONS_VALUE(list)->cdr) {
+    CONS_VALUE(binding)->cdr = CONS_VALUE(list)->car;
+    eval_body(body, frame);
+    loop_safe_point();
+  }
+
+  CONS_VALUE(binding)->cdr = NIL;
+
+  return finish_loop(spec, frame);
+}
+
+lisp_object_t* get(lisp_object_t *symbol, lisp_object_t *environment) {
+  if (symbol->type != SYMBOL)
+    return lisp_error("get expects its first argument to be of type SYMBOL.");
+
+  if (environment->type != CONS)
+    return lisp_error("get expects its second argument to be of type CONS.");
+
   lisp_object_t *current_node = environment;
   while (current_node != NIL) {
     lisp_object_t *symbol_pair = ((cons*) current_node->datum.cons)->car;
 
-    if (strcmp(((cons*) symbol_pair->datum.cons)->car->datum.symbol,
-               symbol->datum.symbol) == 0) {
+    /* symbols are interned, so they compare by identity */
+    if (((cons*) symbol_pair->datum.cons)->car == symbol) {
       return ((cons*) symbol_pair->datum.cons)->cdr;
     }
 
@@ -686,18 +2765,18 @@ lisp_object_t* get(lisp_object_t *symbol, lisp_object_t *environment) {
 }
 
 lisp_object_t* nice_get(char *s, lisp_object_t *environment) {
-  lisp_object_t *symbol = make_lisp_object();
-  symbol->type = SYMBOL;
-  symbol->datum.symbol = strdup(s);
+  return get(intern(s, strlen(s)), environment);
+}
+
+lisp_object_t* lookup_value(lisp_object_t *symbol, lisp_object_t *environment) {
+  lisp_object_t *binding = lookup_binding(symbol, environment);
 
-  return get(symbol, environment);
+  return binding ? CONS_VALUE(binding)->cdr : NULL;
 }
 
 lisp_object_t* set(lisp_object_t *s, lisp_object_t *v, lisp_object_t *e) {
-  if (s->type != SYMBOL) {
-    fprintf(stderr, "Error: set expects its first argument to be of type SYMBOL.\n");
-    return e;
-  }
+  if (s->type != SYMBOL)
+    return lisp_error("set expects its first argument to be of type SYMBOL.");
 
   if (e == NIL) {
     lisp_object_t *env = make_cons(make_cons(s, v), NIL);
@@ -710,7 +2789,7 @@ lisp_object_t* set(lisp_object_t *s, lisp_object_t *v, lisp_object_t *e) {
   while (current_node != NIL) {
     lisp_object_t *symbol_pair = CONS_VALUE(current_node)->car;
 
-    if (strcmp(CONS_VALUE(symbol_pair)->car->datum.symbol, s->datum.symbol) == 0) {
+    if (CONS_VALUE(symbol_pair)->car == s) {
       CONS_VALUE(symbol_pair)->cdr = v;
       return e;
     }
@@ -727,15 +2806,55 @@ lisp_object_t* set(lisp_object_t *s, lisp_object_t *v, lisp_object_t *e) {
 }
 
 lisp_object_t* nice_set(char *symbol_name, lisp_object_t *v, lisp_object_t *e) {
-  lisp_object_t *s = make_lisp_object();
-  s->type = SYMBOL;
-  s->datum.symbol = strdup(symbol_name);
+  return set(intern(symbol_name, strlen(symbol_name)), v, e);
+}
+
+static void add_native_entry(char *function_name, lisp_function function) {
+  for (size_t i = 0; i < vm->native_registry_count; i++) {
+    if (strcmp(vm->native_registry[i].name, function_name) == 0) {
+      vm->native_registry[i].function = function;
+      return;
+    }
+  }
+
+  if (vm->native_registry_count == vm->native_registry_capacity) {
+    vm->native_registry_capacity = vm->native_registry_capacity ? vm->native_registry_capacity * 2 : 64;
+    vm->native_registry = realloc(vm->native_registry,
+                              vm->native_registry_capacity * sizeof(native_entry_t));
+
+    if (!vm->native_registry) {
+      fprintf(stderr, "Error: out of memory.\n");
+      exit(1);
+    }
+  }
+
+  vm->native_registry[vm->native_registry_count].name = strdup(function_name);
+  vm->native_registry[vm->native_registry_count].function = function;
+  vm->native_registry_count++;
+}
+
+const char* native_function_name(lisp_function function) {
+  for (size_t i = 0; i < vm->native_registry_count; i++) {
+    if (vm->native_registry[i].function == function)
+      return vm->native_registry[i].name;
+  }
+
+  return NULL;
+}
 
-  return set(s, v, e);
+lisp_function find_native_function(const char *function_name) {
+  for (size_t i = 0; i < vm->native_registry_count; i++) {
+    if (strcmp(vm->native_registry[i].name, function_name) == 0)
+      return vm->native_registry[i].function;
+  }
+
+  return NULL;
 }
 
 void register_function(char *function_name, lisp_function function,
                        lisp_object_t *environment) {
+  add_native_entry(function_name, function);
+
   lisp_object_t *function_o = make_lisp_object();
   function_o->datum.native_func = function;
   function_o->type = NATIVE_FUNCTION;
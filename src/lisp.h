@@ -1,8 +1,24 @@
 #ifndef LISP_H
 #define LISP_H
 
+#include <stdio.h>
+#include <stdint.h>
+#include <setjmp.h>
+
 #define CONS_VALUE(x) (((cons*) x->datum.cons))
 
+#ifdef __GNUC__
+#define LISP_NORETURN __attribute__((noreturn))
+#else
+#define LISP_NORETURN
+#endif
+
+#ifdef __GNUC__
+#define LISP_THREAD_LOCAL __thread
+#else
+#define LISP_THREAD_LOCAL _Thread_local
+#endif
+
 typedef enum {
   SYMBOL,
   NUMBER,
@@ -10,17 +26,43 @@ typedef enum {
   CONS,
   LAMBDA,
   MACRO,
-  NATIVE_FUNCTION
+  NATIVE_FUNCTION,
+  INPUT_PORT,
+  CONTINUATION,
+  ERROR,                        /* a cons of (message . form) */
+  THREAD,                       /* a green thread, see green.h */
+  CHANNEL,
+  BYTES,
+  STREAM,                       /* a file opened by open, see io.h */
+  OUTPUT_PORT,
+  HOST_FUNCTION,                /* a native with data, see make_host_function() */
+  F64VECTOR,                    /* unboxed numbers, see vectors.h */
+  I64VECTOR
 } lisp_type;
 
 struct lisp_object;
 struct cons_struct;
+struct lisp_reader;
+struct continuation;
+struct green_thread;
+struct green_channel;
+struct lisp_bytes;
+struct lisp_stream;
+struct lisp_host;
+struct lisp_vector;
 
 typedef struct lisp_object* (*lisp_function) (struct lisp_object *param_list);
 
+/* bits of lisp_object.flags */
+#define SYMBOL_LEXICAL       1  /* has been bound as a parameter or loop variable */
+#define SYMBOL_SPECIAL_FORM  2  /* names one of the special forms in eval() */
+#define CONS_FRAME           4  /* owned by a call, not the GC, see frame_cons() */
+#define SYMBOL_SEEN          8  /* scratch mark for analyze_closure() */
+
 struct lisp_object {
   lisp_type type;
   unsigned char marked;
+  unsigned char flags;
 
   union {
     double number;
@@ -28,6 +70,15 @@ struct lisp_object {
     char *symbol;
     struct cons_struct *cons;  /* so we can forward reference cons */
     lisp_function native_func;
+    struct lisp_reader *reader;  /* NULL once the port is closed */
+    struct continuation *continuation;
+    struct green_thread *thread;
+    struct green_channel *channel;
+    struct lisp_bytes *bytes;
+    struct lisp_stream *stream;
+    struct lisp_writer *writer;
+    struct lisp_host *host;
+    struct lisp_vector *vector;
   } datum;
 };
 
@@ -36,8 +87,17 @@ typedef struct lisp_object lisp_object_t;
 typedef struct cons_struct {
   lisp_object_t *car;
   lisp_object_t *cdr;
+  /* A call site's global binding, see eval(), or what's been worked out
+     about a lambda or loop form. Data conses carry it too: it's 8 of the
+     56 bytes counted per cons, see the cons_memory benchmark. */
+  lisp_object_t *cache;
 } cons;
 
+/* the current VM's nil, t and end of file object */
+extern LISP_THREAD_LOCAL lisp_object_t *NIL;
+extern LISP_THREAD_LOCAL lisp_object_t *T;
+extern LISP_THREAD_LOCAL lisp_object_t *EOF_OBJECT;
+
 struct reference_list_t {
   lisp_object_t *node;
   struct reference_list_t *next;
@@ -56,18 +116,254 @@ void delete_object(lisp_object_t *object);
 /* Returns a cons of the two objects */
 lisp_object_t* make_cons(lisp_object_t *car, lisp_object_t *cdr);
 
-/* Must be called before using the lisp module */
+lisp_object_t* make_number(double value);
+
+/* Takes ownership of string, which must come from malloc */
+lisp_object_t* make_string(char *string);
+
+/* Raw data, which unlike a STRING may hold NULs */
+typedef struct lisp_bytes {
+  size_t length;
+  unsigned char *data;
+  int borrowed;                 /* data isn't ours to free, see make_borrowed_bytes() */
+  void (*release)(void *context);
+  void *context;
+} lisp_bytes_t;
+
+/* Takes ownership of data, which must come from malloc */
+lisp_object_t* make_bytes(unsigned char *data, size_t length);
+
+/* Returns BYTES over data without copying it. data must stay valid and
+   unchanged until the object is collected, when release(context) is
+   called unless release is NULL. */
+lisp_object_t* make_borrowed_bytes(unsigned char *data, size_t length,
+                                   void (*release)(void *context), void *context);
+
+/* The elements of an F64VECTOR or I64VECTOR */
+typedef struct lisp_vector {
+  size_t length;
+
+  union {
+    double *f64;
+    int64_t *i64;
+  } data;
+} lisp_vector_t;
+
+/* Returns an F64VECTOR or I64VECTOR of length zeros */
+lisp_object_t* make_numeric_vector(lisp_type type, size_t length);
+
+/* A native function made at run time, which carries data along with it.
+   args holds the argc evaluated arguments and lasts until it returns. */
+typedef lisp_object_t* (*lisp_host_function) (lisp_object_t **args, size_t argc, void *data);
+
+typedef struct lisp_host {
+  lisp_host_function function;
+  void *data;
+  void (*free_data)(void *data);
+  char *name;
+  int arity;                    /* negative when any number is fine */
+} lisp_host_t;
+
+/* Returns a HOST_FUNCTION, which errors unless called with arity
+ * arguments, when arity isn't negative. name is copied, and is what
+ * errors and the profiler call it. Once the function is collected,
+ * free_data(data) is called unless free_data is NULL.
+ */
+lisp_object_t* make_host_function(const char *name, int arity, lisp_host_function function,
+                                  void *data, void (*free_data)(void *data));
+
+/* Allocation counters are kept per kind of object. Objects made with a
+   bare make_lisp_object() are counted as ALLOC_OTHER. */
+typedef enum {
+  ALLOC_CONS,
+  ALLOC_NUMBER,
+  ALLOC_STRING,
+  ALLOC_SYMBOL,
+  ALLOC_CLOSURE,
+  ALLOC_OTHER,
+  ALLOCATION_KINDS
+} allocation_kind;
+
+typedef struct {
+  size_t objects[ALLOCATION_KINDS];  /* allocated since startup */
+  size_t bytes[ALLOCATION_KINDS];    /* headers and payloads, ditto */
+  size_t live_objects;
+  size_t gc_count;
+  size_t last_survivors;
+  size_t last_freed;
+  double last_pause_ms;
+  double total_pause_ms;
+  double max_pause_ms;
+} memory_stats_t;
+
+const memory_stats_t* memory_stats();
+
+const char* allocation_kind_name(allocation_kind kind);
+
+/* Appends a line of memory statistics to file after every interval
+ * collections. A NULL file turns logging off. The file is not closed,
+ * but a log the VM opened itself is.
+ */
+void set_memory_stats_log(FILE *file, size_t interval);
+
+/* Like set_memory_stats_log(), appending to the file at path. The VM
+ * closes it once logging stops or the VM is destroyed. Returns 0, or -1
+ * if the file can't be opened.
+ */
+int open_memory_stats_log(const char *path, size_t interval);
+
+/* when a file writer flushes, besides in writer_finish() */
+typedef enum {
+  WRITER_FULLY_BUFFERED,        /* when the file's buffer fills */
+  WRITER_LINE_BUFFERED,         /* after every newline */
+  WRITER_UNBUFFERED             /* after every write */
+} writer_buffering;
+
+/* An output sink for the printer. When file is NULL, text is appended to
+   a growable, NUL-terminated buffer; otherwise it goes straight to file. */
+typedef struct lisp_writer {
+  char *buffer;
+  size_t length;
+  size_t capacity;
+  FILE *file;
+  writer_buffering buffering;
+  int close_file;               /* on writer_finish(), for ports that opened it */
+  int display;                  /* strings are written without quotes */
+} lisp_writer_t;
+
+/* An interpreter: its heap, symbols, global environment and stacks.
+ * Every thread has a current VM, which is the one the rest of this
+ * interface works on, so N threads can run N VMs side by side. Objects
+ * belong to the VM that made them and mustn't be handed to another.
+ */
+typedef struct lisp_vm lisp_vm_t;
+
+/* Returns an empty VM; init_lisp_module() is the usual way to get one */
+lisp_vm_t* lisp_vm_create();
+
+/* Makes vm the calling thread's current VM. A VM must only be current in
+   one thread at a time. */
+void lisp_vm_enter(lisp_vm_t *vm);
+
+lisp_vm_t* lisp_vm_current();
+
+/* Frees vm and everything allocated in it */
+void lisp_vm_destroy(lisp_vm_t *vm);
+
+/* Returns an OUTPUT_PORT writing to file, or to a string when file is
+   NULL. With close_file, closing the port closes the file. */
+lisp_object_t* make_output_port(FILE *file, int close_file);
+
+/* Where write, display and primitive-print go when given no port. Each
+   green thread has its own, starting with its spawner's. */
+lisp_object_t* current_output_port();
+
+void set_current_output_port(lisp_object_t *port);
+
+/* Where the current VM keeps its green threads, for green.c */
+struct green_scheduler** lisp_vm_scheduler();
+
+/* The part of a VM that belongs to one thread of evaluation: its argument
+ * and frame stacks, escape points and current form. A green thread keeps
+ * its own here while it's switched out, see green.c.
+ */
+typedef struct lisp_exec lisp_exec_t;
+
+/* Returns empty stacks, for a thread of evaluation yet to start */
+lisp_exec_t* lisp_exec_create();
+
+/* Copies the current VM's stacks into exec */
+void lisp_exec_save(lisp_exec_t *exec);
+
+/* Makes exec's stacks the current VM's, after saving the old ones */
+void lisp_exec_load(lisp_exec_t *exec);
+
+/* Frees exec, giving its frame cells back to the current VM */
+void lisp_exec_destroy(lisp_exec_t *exec);
+
+/* Returns a VM sharing the current VM's heap, symbols and global
+ * environment, but with its own stacks and allocations, for running code
+ * in another thread alongside it. The current VM mustn't collect garbage
+ * or be destroyed until the fork is merged back.
+ */
+lisp_vm_t* lisp_vm_fork();
+
+/* Hands what child allocated over to the current VM, its parent, and
+   frees child */
+void lisp_vm_merge(lisp_vm_t *child);
+
+/* Must be called before using the lisp module. Creates a VM, makes it
+   current in the calling thread and loads core.lisp into it. */
 lisp_object_t* init_lisp_module();
 
+/* Alternative to init_lisp_module(): restores the global environment from
+ * an image written by save-image instead of loading core.lisp. Returns
+ * NULL if the image can't be read.
+ */
+lisp_object_t* init_lisp_image(const char *path);
+
+/* Returns the environment created by init_lisp_module() or init_lisp_image() */
+lisp_object_t* get_global_environment();
+
+/* Returns *lisp-super-env*, which a frame's first pair binds to the
+   enclosing environment, without interning it again */
+lisp_object_t* get_super_env_symbol();
+
 /* Returns a deep copy of a lisp_object */
 lisp_object_t* deep_copy(lisp_object_t *src);
 
-/* Runs garbage collection. */
+/* Keeps an object the collector can't reach from its environment alive,
+ * e.g. one a C program holds on to, until it's unpinned. An object may
+ * be pinned more than once.
+ */
+typedef struct lisp_pin lisp_pin_t;
+
+lisp_pin_t* pin_object(lisp_object_t *object);
+
+lisp_object_t* pinned_object(lisp_pin_t *pin);
+
+void unpin_object(lisp_pin_t *pin);
+
+/* Runs garbage collection. What the calls in progress hold, on their
+   stacks or those of suspended green threads, is kept as well. */
 void do_gc(lisp_object_t *environment);
 
+/* Runs garbage collection if enough has been allocated since the last
+ * one: as many objects as survived it, so collecting costs time in
+ * proportion to allocating. Returns whether it collected. Unlike
+ * do_gc(), it's safe to call while forked VMs share the heap, when it
+ * does nothing.
+ */
+int maybe_gc(lisp_object_t *environment);
+
+/* Is an eval() under way in the current VM? */
+int lisp_evaluating();
+
 /* Returns a string representing the given object */
 lisp_object_t* print_object(lisp_object_t *object);
 
+/* Prepares a writer that accumulates into its own buffer */
+void init_string_writer(lisp_writer_t *writer);
+
+/* Prepares a writer that streams directly to file */
+void init_file_writer(lisp_writer_t *writer, FILE *file);
+
+/* Appends length bytes of text to the writer */
+void writer_write(lisp_writer_t *writer, const char *text, size_t length);
+
+void writer_puts(lisp_writer_t *writer, const char *text);
+
+/* Appends the printed representation of object to the writer */
+void write_object(lisp_writer_t *writer, lisp_object_t *object);
+
+/* Like write_object(), but strings are written as they are */
+void display_object(lisp_writer_t *writer, lisp_object_t *object);
+
+/* Returns the accumulated buffer (owned by the caller) and resets the
+   writer. File writers are flushed, or closed if close_file, and return
+   NULL. */
+char* writer_finish(lisp_writer_t *writer);
+
 /* Core function: eval 
  *
  * An environment is a linked list of pairs relating symbols to values,
@@ -81,6 +377,91 @@ lisp_object_t* eval(lisp_object_t *expression, lisp_object_t *environment);
  */
 lisp_object_t* apply(lisp_object_t *f, lisp_object_t *xargs, lisp_object_t *env);
 
+/* Calls f on a list of already evaluated arguments. This is how native
+ * functions call back into Lisp.
+ */
+lisp_object_t* funcall(lisp_object_t *f, lisp_object_t *args);
+
+/* Like funcall(), but takes the arguments as an array, so nothing has to
+   be allocated to pass them */
+lisp_object_t* funcall_array(lisp_object_t *f, size_t argc, lisp_object_t **argv);
+
+/* A place evaluation can jump back to, e.g. the call/cc that made a
+ * continuation or a catch. Use it like this:
+ *
+ *   escape_point_t point;
+ *   push_escape(&point, ESCAPE_CATCH, tag);
+ *   if (setjmp(point.jump) == 0)
+ *     result = ...;
+ *   else
+ *     result = point.value;
+ *   pop_escape(&point);
+ *
+ * escape_to() unwinds the evaluator's own stacks before jumping, so a
+ * jump costs the same however deep the evaluation below the point is.
+ *
+ * A jump stops at every ESCAPE_CLEANUP point on the way, with the real
+ * destination in pending. The cleanup code pops the point, does its
+ * work and then calls resume_escape() to carry on.
+ */
+typedef enum {
+  ESCAPE_CATCH,                 /* catches throws to tag; a NULL tag catches none */
+  ESCAPE_CATCH_ALL,             /* catches every throw, setting tag */
+  ESCAPE_CLEANUP
+} escape_kind;
+
+typedef struct escape_point {
+  jmp_buf jump;
+  escape_kind kind;
+  lisp_object_t *tag;
+  lisp_object_t *value;
+  struct escape_point *pending;
+  unsigned long id;
+  size_t arg_stack_top;
+  size_t frame_depth;
+  size_t profile_depth;
+  struct escape_point *previous;
+} escape_point_t;
+
+void push_escape(escape_point_t *point, escape_kind kind, lisp_object_t *tag);
+
+void pop_escape(escape_point_t *point);
+
+/* Jumps to point, which must still be pushed, returning value there */
+void escape_to(escape_point_t *point, lisp_object_t *value) LISP_NORETURN;
+
+/* Continues the jump an ESCAPE_CLEANUP point interrupted */
+void resume_escape(escape_point_t *point) LISP_NORETURN;
+
+/* Jumps to the innermost catch of tag */
+void throw_to(lisp_object_t *tag, lisp_object_t *value) LISP_NORETURN;
+
+/* Returns a continuation that escapes to point while it's pushed */
+lisp_object_t* make_continuation(escape_point_t *point);
+
+/* Errors are thrown to the symbol error. A NULL form means the form
+   being evaluated. */
+lisp_object_t* make_error(lisp_object_t *message, lisp_object_t *form);
+
+/* Throws an error with a printf style message. Uncaught errors are
+ * reported on stderr and make the eval() that started the evaluation
+ * return NULL.
+ */
+lisp_object_t* lisp_error(const char *format, ...) LISP_NORETURN;
+
+/* Prints what eval() prints when value is thrown to tag and not caught */
+void report_uncaught(lisp_object_t *tag, lisp_object_t *value);
+
+/* Writes the message report_uncaught() prints, without "Error: " and the
+   newline */
+void describe_uncaught(lisp_writer_t *writer, lisp_object_t *tag, lisp_object_t *value);
+
+/* Returns form with its macro calls expanded ahead of time, using the
+ * macros bound in environment. Calls that can't be expanded safely are
+ * left for eval() to expand at run time.
+ */
+lisp_object_t* macroexpand_all(lisp_object_t *form, lisp_object_t *environment);
+
 /* Returns the value that symbol is bound to in environment
  * 
  * If no value is found, NULL (not NIL) is returned. 
@@ -89,6 +470,15 @@ lisp_object_t* get(lisp_object_t *symbol, lisp_object_t *environment);
 
 lisp_object_t* nice_get(char *s, lisp_object_t *e);
 
+/* Like get(), but environment may also be a call's or a closure's, whose
+   outer environments are searched too */
+lisp_object_t* lookup_value(lisp_object_t *symbol, lisp_object_t *environment);
+
+/* Returns the unique SYMBOL named by the first length bytes of name,
+ * creating it on first use. Interned symbols are never collected.
+ */
+lisp_object_t* intern(const char *name, size_t length);
+
 /* Sets a symbol to a value in the current environment
  */
 lisp_object_t* set(lisp_object_t *s, lisp_object_t *v, lisp_object_t *e);
@@ -100,9 +490,18 @@ lisp_object_t* nice_set(char *symbol_name, lisp_object_t *v, lisp_object_t *e);
 void register_function(char *function_name, lisp_function function,
                        lisp_object_t *environment);
 
-/* returns the # of allocated objects */
+/* Returns the name function was registered under, or NULL */
+const char* native_function_name(lisp_function function);
+
+/* Returns the function registered under function_name, or NULL */
+lisp_function find_native_function(const char *function_name);
+
+/* returns the # of live objects */
 size_t allocated_objects();
 
+/* returns the # of objects allocated since startup (collected or not) */
+size_t allocation_count();
+
 /* our malloc implementation */
 void* xmalloc(size_t bytes);
 
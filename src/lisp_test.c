@@ -1,20 +1,65 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "lisp.h"
+#include "reader.h"
+#include "image.h"
+#include "maxlisp.h"
+#include "vectors.h"
 
 static void test_symbol_print();
 static void test_number_print();
 static void test_cons_print();
-
-extern lisp_object_t* NIL;
+static void test_long_list_print();
+static void test_reader();
+static void test_image_round_trip();
+static void test_memory_stats();
+static void test_call_site_cache();
+static void test_call_frames();
+static void test_continuations();
+static void test_conditions();
+static void test_vms();
+static void test_parallel();
+static void test_green_threads();
+static void test_io();
+static void test_output_ports();
+static void test_embedding();
+static void test_ffi();
+static void test_vectors();
+static void test_sort();
+static void test_loops();
+static lisp_object_t* eval_string(const char *text);
 
 int main() {
   init_lisp_module();
   test_symbol_print();
   test_number_print();
   test_cons_print();
+  test_long_list_print();
+  test_reader();
+  test_image_round_trip();
+  test_memory_stats();
+  test_call_site_cache();
+  test_call_frames();
+  test_continuations();
+  test_conditions();
+  test_vms();
+  test_parallel();
+  test_green_threads();
+  test_io();
+  test_output_ports();
+  test_embedding();
+  test_ffi();
+  test_vectors();
+  test_sort();
+  test_loops();
 
   do_gc(NIL);                   /* We manually trigger GC */
 }
@@ -70,10 +115,10 @@ static void test_cons_print() {
   lisp_object_t *nil = NIL;
   lisp_object_t *nil_str = print_object(nil);
 
-  printf("  Making sure NIL is printed correctly...\n");
-  printf("  Expected NIL, found: %s\n", nil_str->datum.string);
+  printf("  Making sure nil is printed correctly...\n");
+  printf("  Expected nil, found: %s\n", nil_str->datum.string);
   printf("  Expected 3, found: %ld\n", strlen(nil_str->datum.string));
-  assert(!strcmp(nil_str->datum.string, "NIL"));
+  assert(!strcmp(nil_str->datum.string, "nil"));
 
   lisp_object_t *number_a = make_lisp_object();
   number_a->type = NUMBER;
@@ -103,3 +148,905 @@ static void test_cons_print() {
 
   printf("Cons printing test passed!\n\n");
 }
+
+static void test_long_list_print() {
+  printf("Testing long list print...\n");
+
+  lisp_object_t *number = make_lisp_object();
+  number->type = NUMBER;
+  number->datum.number = 1;
+
+  lisp_object_t *long_list = NIL;
+  for (int i = 0; i < 10000; i++) {
+    long_list = make_cons(number, long_list);
+  }
+
+  lisp_object_t *list_str = print_object(long_list);
+
+  /* each element prints as "1.000000" followed by a space or paren */
+  printf("  Expected length 90001, found: %ld\n", strlen(list_str->datum.string));
+  assert(strlen(list_str->datum.string) == 90001);
+  assert(!strncmp(list_str->datum.string, "(1.000000 1.000000", 18));
+
+  lisp_writer_t writer;
+  init_string_writer(&writer);
+  write_object(&writer, make_cons(number, NIL));
+  writer_puts(&writer, " and ");
+  write_object(&writer, NIL);
+
+  char *written = writer_finish(&writer);
+  printf("  Expected (1.000000) and nil, found: %s\n", written);
+  assert(!strcmp(written, "(1.000000) and nil"));
+  free(written);
+
+  printf("Long list printing test passed!\n\n");
+}
+
+static void test_reader() {
+  printf("Testing reader...\n");
+
+  FILE *input = tmpfile();
+  fputs("(foo bar . 12) ; a comment\n  foo \"a \\\"b\\\"\" )", input);
+  rewind(input);
+
+  lisp_reader_t *reader = make_file_reader(input);
+
+  lisp_object_t *pair = read_form(reader);
+  lisp_object_t *foo = read_form(reader);
+  lisp_object_t *string = read_form(reader);
+
+  printf("  Making sure symbols are interned...\n");
+  assert(CONS_VALUE(pair)->car == foo);
+  assert(foo == intern("foo", 3));
+
+  printf("  Making sure dotted pairs and strings are read...\n");
+  assert(CONS_VALUE(CONS_VALUE(pair)->cdr)->cdr->type == NUMBER);
+  assert(CONS_VALUE(CONS_VALUE(pair)->cdr)->cdr->datum.number == 12);
+  printf("  Expected a \"b\", found: %s\n", string->datum.string);
+  assert(!strcmp(string->datum.string, "a \"b\""));
+
+  printf("  Making sure positions and conditions are reported...\n");
+  assert(read_form(reader) == NULL);
+  assert(reader->condition == READ_UNBALANCED_PAREN);
+  assert(reader->line == 2);
+  assert(read_form(reader) == NULL);
+  assert(reader->condition == READ_EOF);
+
+  free_reader(reader);
+  fclose(input);
+
+  printf("  Making sure input ending inside a form isn't taken for the end...\n");
+  const char *truncated[] = {"(a (b", "\"abc", "'", "(a . ", "(a . b"};
+
+  for (int i = 0; i < 5; i++) {
+    reader = make_memory_reader(truncated[i], strlen(truncated[i]));
+    assert(read_form(reader) == NULL);
+    assert(reader->condition == READ_TRUNCATED);
+    assert(reader->error && reader->error_line == 1);
+    free_reader(reader);
+  }
+
+  printf("Reader test passed!\n\n");
+}
+
+static void test_image_round_trip() {
+  printf("Testing image round trip...\n");
+
+  lisp_object_t *number = make_lisp_object();
+  number->type = NUMBER;
+  number->datum.number = 42;
+
+  lisp_object_t *string = make_lisp_object();
+  string->type = STRING;
+  string->datum.string = strdup("forty two");
+
+  /* a shared tail and a cycle through a closure's environment */
+  lisp_object_t *tail = make_cons(string, NIL);
+  lisp_object_t *closure = make_cons(NIL, NIL);
+  closure->type = LAMBDA;
+  lisp_object_t *root = make_cons(intern("answer", 6),
+                                  make_cons(number, make_cons(tail, make_cons(tail, make_cons(closure, NIL)))));
+  CONS_VALUE(closure)->cdr = root;
+
+  char path[] = "/tmp/lisp_test_imageXXXXXX";
+  close(mkstemp(path));
+
+  printf("  Making sure the image is written...\n");
+  assert(write_image(path, root) == 0);
+
+  lisp_object_t *copy = read_image(path);
+  remove(path);
+
+  printf("  Making sure the copy prints the same...\n");
+  lisp_object_t *copy_str = print_object(CONS_VALUE(CONS_VALUE(copy)->cdr)->cdr);
+  printf("  Expected ((\"forty two\") (\"forty two\") LAMBDA_CLOSURE), found: %s\n",
+         copy_str->datum.string);
+  assert(!strcmp(copy_str->datum.string,
+                 "((\"forty two\") (\"forty two\") LAMBDA_CLOSURE)"));
+
+  printf("  Making sure sharing, cycles and symbols are preserved...\n");
+  lisp_object_t *rest = CONS_VALUE(CONS_VALUE(copy)->cdr)->cdr;
+  assert(copy != root);
+  assert(CONS_VALUE(copy)->car == intern("answer", 6));
+  assert(CONS_VALUE(rest)->car == CONS_VALUE(CONS_VALUE(rest)->cdr)->car);
+  lisp_object_t *copy_closure = CONS_VALUE(CONS_VALUE(CONS_VALUE(rest)->cdr)->cdr)->car;
+  assert(copy_closure->type == LAMBDA);
+  assert(CONS_VALUE(copy_closure)->cdr == copy);
+
+  eval_string("(defun image-compose (image-f image-g) (lambda (image-x) (image-f (image-g image-x))))"
+              "(setq composed (list (image-compose car cdr) (image-compose cdr car) "
+              "                     ((lambda (image-a) "
+              "                        (lambda (image-b) (lambda (image-c) (+ image-a image-b image-c)))) "
+              "                      5)))");
+
+  char closures_path[] = "/tmp/lisp_test_imageXXXXXX";
+  close(mkstemp(closures_path));
+  assert(write_image(closures_path, eval_string("composed")) == 0);
+
+  /* as in a process that loads the image without ever binding the
+     parameters that were bound when it was saved */
+  const char *parameters[] = {"image-f", "image-g", "image-a"};
+
+  for (int i = 0; i < 3; i++)
+    intern(parameters[i], strlen(parameters[i]))->flags &= ~SYMBOL_LEXICAL;
+
+  printf("  Making sure call sites don't cache bindings from frames...\n");
+  assert(eval_string("((car composed) '(1 2 3))")->datum.number == 2);
+  assert(eval_string("(car ((car (cdr composed)) '((1 2) 3)))")->datum.number == 2);
+
+  printf("  Making sure restored symbols are still known to be parameters...\n");
+  nice_set("restored", read_image(closures_path), get_global_environment());
+  remove(closures_path);
+
+  for (int i = 0; i < 3; i++)
+    assert(intern(parameters[i], strlen(parameters[i]))->flags & SYMBOL_LEXICAL);
+
+  assert(eval_string("((car restored) '(1 2 3))")->datum.number == 2);
+  assert(eval_string("(car ((car (cdr restored)) '((1 2) 3)))")->datum.number == 2);
+
+  printf("  Making sure restored closures still capture their variables...\n");
+  assert(eval_string("(((car (cdr (cdr restored))) 1) 2)")->datum.number == 8);
+
+  printf("Image round trip test passed!\n\n");
+}
+
+static void test_memory_stats() {
+  printf("Testing memory stats...\n");
+
+  const memory_stats_t *stats = memory_stats();
+  size_t numbers = stats->objects[ALLOC_NUMBER];
+  size_t conses = stats->objects[ALLOC_CONS];
+
+  lisp_object_t *list = make_cons(make_number(1), make_cons(make_number(2), NIL));
+  assert(list);
+
+  printf("  Making sure allocations are counted by kind...\n");
+  assert(stats->objects[ALLOC_NUMBER] == numbers + 2);
+  assert(stats->objects[ALLOC_CONS] == conses + 2);
+
+  printf("  Making sure a collection updates the counters...\n");
+  size_t collections = stats->gc_count;
+  do_gc(get_global_environment());
+  assert(stats->gc_count == collections + 1);
+  assert(stats->last_freed >= 4);
+  assert(stats->last_survivors == allocated_objects());
+
+  printf("  Making sure maybe_gc waits for enough allocations...\n");
+  assert(!maybe_gc(get_global_environment()));
+
+  for (size_t i = 0; i < 100000 || i < stats->last_survivors; i++)
+    make_number(i);
+
+  collections = stats->gc_count;
+  assert(maybe_gc(get_global_environment()));
+  assert(stats->gc_count == collections + 1);
+  assert(!maybe_gc(get_global_environment()));
+
+  printf("Memory stats test passed!\n\n");
+}
+
+/* evaluates every form in text, returning the last value */
+static lisp_object_t* eval_string(const char *text) {
+  lisp_reader_t *reader = make_memory_reader(text, strlen(text));
+  lisp_object_t *form, *value = NULL;
+
+  while ((form = read_form(reader)))
+    value = eval(form, get_global_environment());
+
+  free_reader(reader);
+
+  return value;
+}
+
+static void test_call_site_cache() {
+  printf("Testing call site caches...\n");
+
+  eval_string("(defun cached-callee () 1)"
+              "(defun cached-caller () (cached-callee))");
+  assert(eval_string("(cached-caller)")->datum.number == 1);
+
+  printf("  Making sure a cached call sees the callee redefined...\n");
+  eval_string("(defun cached-callee () 2)");
+  assert(eval_string("(cached-caller)")->datum.number == 2);
+
+  printf("  Making sure parameters still shadow cached globals...\n");
+  eval_string("(defun cached-shadow (cached-callee) (cached-callee))");
+  assert(eval_string("(cached-shadow (lambda () 3))")->datum.number == 3);
+  assert(eval_string("(cached-caller)")->datum.number == 2);
+
+  printf("Call site cache test passed!\n\n");
+}
+
+static void test_call_frames() {
+  printf("Testing call frames...\n");
+
+  eval_string("(defun frame-identity (x) x)"
+              "(defun frame-adder (n) (lambda (x) (+ x n)))"
+              "(setq frame-add-5 (frame-adder 5))");
+
+  printf("  Making sure a call allocates nothing by itself...\n");
+  lisp_object_t *form = eval_string("'(frame-identity (quote a))");
+  size_t allocations = allocation_count();
+  assert(eval(form, get_global_environment()) == intern("a", 1));
+  assert(allocation_count() == allocations);
+
+  printf("  Making sure captured frames outlive their call...\n");
+  do_gc(get_global_environment());
+  eval_string("(frame-identity 1) (frame-adder 100)");
+  assert(eval_string("(frame-add-5 1)")->datum.number == 6);
+
+  printf("  Making sure closures only keep the variables they use...\n");
+  eval_string("(defun frame-keep (big) (let ((small 1)) (lambda () small)))");
+  do_gc(get_global_environment());
+  size_t live = allocated_objects();
+  eval_string("(setq frame-kept (frame-keep (repeat 'x 1000)))");
+  do_gc(get_global_environment());
+  assert(allocated_objects() < live + 1000);
+  assert(eval_string("(frame-kept)")->datum.number == 1);
+
+  printf("Call frames test passed!\n\n");
+}
+
+static void test_continuations() {
+  printf("Testing continuations...\n");
+
+  eval_string("(defun escape-sum (limit seq)"
+              "  (call/cc (lambda (return)"
+              "    (primitive-reduce (lambda (acc x)"
+              "                        (if (< limit (+ acc x)) (return acc) (+ acc x)))"
+              "                      0 seq))))");
+
+  printf("  Making sure an escape returns from call/cc...\n");
+  assert(eval_string("(escape-sum 10 (repeat 1 100))")->datum.number == 10);
+  assert(eval_string("(+ 1 (call/cc (lambda (k) (+ 100 (k 2)))))")->datum.number == 3);
+
+  printf("  Making sure dead continuations are refused...\n");
+  eval_string("(setq saved-k (call/cc (lambda (k) k)))");
+  assert(eval_string("(saved-k 1)") == NULL);
+
+  printf("Continuations test passed!\n\n");
+}
+
+static void test_conditions() {
+  printf("Testing conditions...\n");
+
+  printf("  Making sure errors carry their message and form...\n");
+  lisp_object_t *error = eval_string("(catch 'error (+ 1 (car 'x)))");
+  assert(error->type == ERROR);
+  assert(!strcmp(eval_string("(error-message (catch 'error (car 'x)))")->datum.string,
+                 "car defined on CONS."));
+  assert(!strcmp(print_object(CONS_VALUE(error)->cdr)->datum.string, "(car (quote x))"));
+  error = eval_string("(catch 'error ((car (list 1 2))))");
+  assert(!strcmp(print_object(CONS_VALUE(error)->cdr)->datum.string, "((car (list 1.000000 2.000000)))"));
+
+  printf("  Making sure throw returns from the matching catch...\n");
+  assert(eval_string("(catch 'outer (+ 1 (catch 'inner (throw 'outer 2))))")->datum.number == 2);
+
+  printf("  Making sure cleanups run however their form exits...\n");
+  eval_string("(setq cleanups 0)"
+              "(defun note-cleanup () (setq cleanups (+ cleanups 1)))");
+  eval_string("(catch 'error (unwind-protect (car 'x) (note-cleanup)))");
+  eval_string("(call/cc (lambda (k) (unwind-protect (k 1) (note-cleanup))))");
+  eval_string("(unwind-protect 1 (note-cleanup))");
+  assert(eval_string("cleanups")->datum.number == 3);
+
+  printf("  Making sure uncaught errors leave the runtime usable...\n");
+  assert(eval_string("(car 'x)") == NULL);
+  assert(eval_string("(+ 1 2)")->datum.number == 3);
+
+  printf("Conditions test passed!\n\n");
+}
+
+static void* run_vm_thread(void *result) {
+  init_lisp_module();
+  eval_string("(defun vm-fib (n) (if (< n 2) n (+ (vm-fib (- n 1)) (vm-fib (- n 2)))))");
+  *(double*) result = eval_string("(vm-fib 15)")->datum.number;
+  do_gc(get_global_environment());
+  lisp_vm_destroy(lisp_vm_current());
+
+  return NULL;
+}
+
+static void test_vms() {
+  printf("Testing VMs...\n");
+
+  lisp_vm_t *main_vm = lisp_vm_current();
+  eval_string("(setq vm-private 1)");
+
+  char log_path[] = "/tmp/lisp_test_statsXXXXXX";
+  close(mkstemp(log_path));
+  nice_set("stats-path", make_string(strdup(log_path)), get_global_environment());
+  eval_string("(memory-stats-log stats-path)");
+
+  printf("  Making sure VMs don't share globals...\n");
+  init_lisp_module();
+  assert(lisp_vm_current() != main_vm);
+  assert(eval_string("vm-private") == NULL);
+
+  printf("  Making sure VMs don't share memory stats logs...\n");
+  eval_string("(memory-stats-log nil)");
+  lisp_vm_destroy(lisp_vm_current());
+
+  lisp_vm_enter(main_vm);
+  assert(eval_string("vm-private")->datum.number == 1);
+  do_gc(get_global_environment());
+  eval_string("(memory-stats-log nil)");
+
+  char line[16] = "";
+  FILE *log = fopen(log_path, "r");
+  assert(fgets(line, sizeof(line), log) && !strncmp(line, "gc=", 3));
+  fclose(log);
+  remove(log_path);
+
+  printf("  Making sure VMs run side by side in threads...\n");
+  pthread_t threads[4];
+  double results[4];
+
+  for (int i = 0; i < 4; i++)
+    assert(pthread_create(&threads[i], NULL, run_vm_thread, &results[i]) == 0);
+
+  for (int i = 0; i < 4; i++) {
+    pthread_join(threads[i], NULL);
+    assert(results[i] == 610);
+  }
+
+  assert(lisp_vm_current() == main_vm);
+
+  printf("VMs test passed!\n\n");
+}
+
+static void test_parallel() {
+  printf("Testing parallel functions...\n");
+
+  /* more threads than processors still interleave the workers */
+  setenv("MAXLISP_THREADS", "4", 0);
+  eval_string("(defun iota (n) (if (< n 1) nil (cons n (iota (- n 1)))))"
+              "(setq numbers (iota 200))");
+
+  printf("  Making sure pmap keeps the list's order...\n");
+  lisp_object_t *squares = eval_string("(pmap (lambda (x) (* x x)) numbers)");
+  assert(CONS_VALUE(squares)->car->datum.number == 40000);
+  assert(eval_string("(length (pmap (lambda (x) (* x x)) numbers))")->datum.number == 200);
+  assert(eval_string("(pmap car nil)") == NIL);
+
+  printf("  Making sure preduce folds every element...\n");
+  assert(eval_string("(preduce + 0 numbers)")->datum.number == 20100);
+  assert(eval_string("(preduce + 5 nil)")->datum.number == 5);
+
+  printf("  Making sure pfor-each returns nil...\n");
+  assert(eval_string("(pfor-each (lambda (x) (list x)) numbers)") == NIL);
+
+  printf("  Making sure errors in workers reach the caller...\n");
+  lisp_object_t *error = eval_string("(catch 'error (pmap car numbers))");
+  assert(error->type == ERROR);
+  assert(eval_string("(catch 'done (pfor-each (lambda (x) (throw 'done x)) '(7)))")
+         ->datum.number == 7);
+
+  printf("  Making sure a continuation out of pmap waits for the workers...\n");
+  eval_string("(defun spin (x) (dotimes (i 2000) (list i)) x)");
+  lisp_object_t *escaped = eval_string("(call/cc (lambda (k) "
+                                       "  (pmap (lambda (x) (if (< x 3) (k x) (spin x))) "
+                                       "        '(1 2 3 4 5 6 7 8))))");
+  assert(escaped->type == NUMBER && escaped->datum.number < 3);
+  assert(eval_string("(preduce + 0 numbers)")->datum.number == 20100);
+
+  const memory_stats_t *stats = memory_stats();
+  size_t collections = stats->gc_count;
+
+  for (size_t i = 0; i < 100000 || i < stats->last_survivors; i++)
+    make_number(i);
+
+  assert(maybe_gc(get_global_environment()));
+  assert(stats->gc_count == collections + 1);
+
+  printf("Parallel functions test passed!\n\n");
+}
+
+static void test_green_threads() {
+  printf("Testing green threads...\n");
+
+  printf("  Making sure touch waits for a future...\n");
+  assert(eval_string("(touch (future (+ 1 2)))")->datum.number == 3);
+  assert(eval_string("(catch 'error (touch (future (car 'x))))")->type == ERROR);
+
+  printf("  Making sure threads pass values over channels...\n");
+  eval_string("(setq queue (make-channel 4))"
+              "(defun produce (n) (if (< n 1) (send queue nil) "
+              "                     (progn (send queue n) (produce (- n 1)))))"
+              "(defun consume (total) (let ((n (recv queue))) "
+              "                         (if n (consume (+ total n)) total)))");
+  eval_string("(spawn (lambda () (produce 100)))");
+  assert(eval_string("(touch (future (consume 0)))")->datum.number == 5050);
+
+  printf("  Making sure spawned threads run after the top-level form...\n");
+  eval_string("(setq ran nil)");
+  eval_string("(spawn (lambda () (setq ran t)))");
+  assert(eval_string("ran") == T);
+
+  printf("  Making sure waiting forever is an error...\n");
+  assert(eval_string("(recv (make-channel))") == NULL);
+
+  printf("  Making sure a waiting thread doesn't hold up collection...\n");
+  eval_string("(setq idle (make-channel))"
+              "(spawn (lambda () (let ((kept (list 1 2 3))) "
+              "                    (setq woken (cons (recv idle) kept)))))");
+
+  const memory_stats_t *stats = memory_stats();
+  size_t collections = stats->gc_count;
+
+  for (size_t i = 0; i < 100000 || i < stats->last_survivors; i++)
+    make_number(i);
+
+  assert(maybe_gc(get_global_environment()));
+  assert(stats->gc_count == collections + 1);
+  eval_string("(send idle 7)");
+  assert(eval_string("(apply + woken)")->datum.number == 13);
+
+  printf("Green threads test passed!\n\n");
+}
+
+static void test_io() {
+  printf("Testing file I/O...\n");
+
+  char path[] = "/tmp/lisp_test_ioXXXXXX";
+  close(mkstemp(path));
+  nice_set("io-path", make_string(strdup(path)), get_global_environment());
+
+  printf("  Making sure written bytes read back...\n");
+  eval_string("(let ((out (open io-path \"w\"))) "
+              "  (write-bytes out \"first\nsecond\n\") "
+              "  (write-bytes out (string->bytes \"last\")) "
+              "  (close-port out))");
+  lisp_object_t *bytes = eval_string("(read-bytes (open io-path) 100)");
+  assert(bytes->type == BYTES && bytes->datum.bytes->length == 17);
+  assert(!memcmp(bytes->datum.bytes->data, "first\nsecond\nlast", 17));
+
+  printf("  Making sure read-line splits lines...\n");
+  eval_string("(setq lines (open io-path))");
+  assert(!strcmp(eval_string("(read-line lines)")->datum.string, "first"));
+  assert(eval_string("(bytes-length (read-bytes lines 3))")->datum.number == 3);
+  assert(!strcmp(eval_string("(read-line lines)")->datum.string, "ond"));
+  assert(!strcmp(eval_string("(read-line lines)")->datum.string, "last"));
+  assert(eval_string("(read-line lines)") == EOF_OBJECT);
+
+  printf("  Making sure green threads can read side by side...\n");
+  eval_string("(defun count-lines (stream n) "
+              "  (if (eof-object? (read-line stream)) n (count-lines stream (+ n 1))))");
+  assert(eval_string("(let ((a (future (count-lines (open io-path) 0))) "
+                     "      (b (future (count-lines (open io-path) 0)))) "
+                     "  (+ (touch a) (touch b)))")->datum.number == 6);
+
+  printf("  Making sure for-each-form doesn't keep the forms it's done with...\n");
+  FILE *forms = fopen(path, "w");
+
+  for (int i = 0; i < 20000; i++)
+    fprintf(forms, "(form %d of many)\n", i);
+
+  fclose(forms);
+
+  const memory_stats_t *stats = memory_stats();
+  size_t collections = stats->gc_count;
+
+  eval_string("(setq forms-read 0)"
+              "(for-each-form io-path (lambda (form) (set 'forms-read (+ forms-read 1))))");
+  assert(eval_string("forms-read")->datum.number == 20000);
+  assert(stats->gc_count > collections);
+  assert(stats->last_survivors < 100000);
+
+  printf("  Making sure a truncated form is an error, not the end...\n");
+  forms = fopen(path, "w");
+  fputs("(set 'forms-read 1)\n(set 'forms-read (+ forms-read", forms);
+  fclose(forms);
+
+  eval_string("(setq truncated (open-input-file io-path))");
+  assert(eval_string("(read truncated)")->type == CONS);
+  assert(eval_string("(catch 'error (read truncated))")->type == ERROR);
+  eval_string("(close-port truncated)");
+
+  assert(eval_string("(catch 'error (load io-path))")->type == ERROR);
+  assert(eval_string("forms-read")->datum.number == 1);
+  eval_string("(setq forms-read 0)");
+  assert(eval_string("(catch 'error (for-each-form io-path (lambda (form) (set 'forms-read (+ forms-read 1)))))")
+         ->type == ERROR);
+  assert(eval_string("forms-read")->datum.number == 1);
+
+  remove(path);
+
+  printf("  Making sure load only trusts a compiled file newer than its source...\n");
+  char source[64], fasl[64];
+  snprintf(source, sizeof(source), "/tmp/lisp_test_fasl_%d.lisp", (int) getpid());
+  snprintf(fasl, sizeof(fasl), "/tmp/lisp_test_fasl_%d.fasl", (int) getpid());
+  nice_set("fasl-source", make_string(strdup(source)), get_global_environment());
+
+  forms = fopen(source, "w");
+  fputs("(set 'fasl-version 1)", forms);
+  fclose(forms);
+  eval_string("(compile-file fasl-source)");
+
+  forms = fopen(source, "w");
+  fputs("(set 'fasl-version 2)", forms);
+  fclose(forms);
+
+  /* edited within the same instant as compile-file */
+  struct stat fasl_stat;
+  assert(stat(fasl, &fasl_stat) == 0);
+  struct timespec times[2] = {fasl_stat.st_mtim, fasl_stat.st_mtim};
+  assert(utimensat(AT_FDCWD, source, times, 0) == 0);
+  eval_string("(load fasl-source)");
+  assert(eval_string("fasl-version")->datum.number == 2);
+
+  times[0].tv_sec = times[1].tv_sec = fasl_stat.st_mtim.tv_sec - 1;
+  assert(utimensat(AT_FDCWD, source, times, 0) == 0);
+  eval_string("(load fasl-source)");
+  assert(eval_string("fasl-version")->datum.number == 1);
+
+  remove(source);
+  remove(fasl);
+
+  printf("File I/O test passed!\n\n");
+}
+
+static void test_output_ports() {
+  printf("Testing output ports...\n");
+
+  printf("  Making sure output is captured in a string...\n");
+  lisp_object_t *output = eval_string("(with-output-to-string "
+                                      "  (write \"quoted\") (display \" plain\") (newline) "
+                                      "  (display (list 1 \"two\")))");
+  printf("  Expected \"quoted\" plain\\n(1.000000 two), found: %s\n", output->datum.string);
+  assert(!strcmp(output->datum.string, "\"quoted\" plain\n(1.000000 two)"));
+
+  printf("  Making sure primitive-print quotes strings only inside lists...\n");
+  output = eval_string("(with-output-to-string "
+                       "  (primitive-print \"a\") (primitive-print (list \"a\" \"b\")))");
+  assert(!strcmp(output->datum.string, "a (\"a\" \"b\") "));
+
+  printf("  Making sure the previous port is restored after a throw...\n");
+  lisp_object_t *port = eval_string("(current-output-port)");
+  assert(eval_string("(catch 'error (with-output-to-string (display 1) (car 1)))")->type == ERROR);
+  assert(eval_string("(current-output-port)") == port);
+
+  printf("  Making sure file ports write through their buffer...\n");
+  char path[] = "/tmp/lisp_test_portXXXXXX";
+  close(mkstemp(path));
+  nice_set("port-path", make_string(strdup(path)), get_global_environment());
+  eval_string("(let ((out (open-output-file port-path))) "
+              "  (set-port-buffering out 'none) (write '(a \"b\") out) (close-port out))");
+  assert(!strcmp(eval_string("(read-line (open port-path))")->datum.string, "(a \"b\")"));
+  remove(path);
+
+  printf("Output ports test passed!\n\n");
+}
+
+static maxlisp_value* count_calls(maxlisp_vm *vm, size_t argc, maxlisp_value **argv,
+                                  void *userdata) {
+  (void) argc;
+  (*(int*) userdata)++;
+
+  return maxlisp_number(vm, maxlisp_to_number(argv[0]) * 2);
+}
+
+static maxlisp_value* always_fail(maxlisp_vm *vm, size_t argc, maxlisp_value **argv,
+                                  void *userdata) {
+  (void) argc;
+  (void) argv;
+  (void) userdata;
+  maxlisp_fail(vm, "always fails.");
+
+  return NULL;
+}
+
+static void count_release(void *context) {
+  (*(int*) context)++;
+}
+
+static void test_embedding() {
+  printf("Testing the embedding interface...\n");
+
+  lisp_vm_t *own_vm = lisp_vm_current();
+  maxlisp_vm *vm = maxlisp_create();
+  maxlisp_value *result;
+  int calls = 0;
+  int releases = 0;
+
+  printf("  Making sure the caller's VM stays current...\n");
+  assert(lisp_vm_current() == own_vm);
+
+  printf("  Making sure functions can be called by name...\n");
+  const char *source = "(defun add3 (a b c) (+ a (+ b c)))";
+  assert(maxlisp_eval(vm, source, strlen(source), NULL) == MAXLISP_OK);
+
+  maxlisp_value *args[3] = {maxlisp_number(vm, 1), maxlisp_number(vm, 2), maxlisp_number(vm, 3)};
+  assert(maxlisp_call(vm, "add3", 3, args, &result) == MAXLISP_OK);
+  assert(maxlisp_type_of(vm, result) == MAXLISP_NUMBER);
+  assert(maxlisp_to_number(result) == 6);
+
+  printf("  Making sure natives get their userdata...\n");
+  maxlisp_register(vm, "double-it", 1, count_calls, &calls);
+  source = "(double-it (double-it 5))";
+  assert(maxlisp_eval(vm, source, strlen(source), &result) == MAXLISP_OK);
+  assert(maxlisp_to_number(result) == 20);
+  assert(calls == 2);
+
+  printf("  Making sure errors come back as messages...\n");
+  source = "(double-it 1 2)";
+  assert(maxlisp_eval(vm, source, strlen(source), NULL) == MAXLISP_ERROR);
+  assert(strstr(maxlisp_error_message(vm), "double-it requires 1 arguments"));
+
+  maxlisp_register(vm, "always-fail", 0, always_fail, NULL);
+  assert(maxlisp_call(vm, "always-fail", 0, NULL, NULL) == MAXLISP_ERROR);
+  assert(!strcmp(maxlisp_error_message(vm), "always fails."));
+
+  source = "(catch 'error (always-fail))";
+  assert(maxlisp_eval(vm, source, strlen(source), &result) == MAXLISP_OK);
+  assert(maxlisp_type_of(vm, result) != MAXLISP_NIL);
+
+  printf("  Making sure pinned values survive collections...\n");
+  maxlisp_pin *pin = maxlisp_pin_value(vm, maxlisp_string(vm, "kept"));
+  for (int i = 0; i < 100; i++) {
+    source = "(repeat 'x 1000)";
+    assert(maxlisp_eval(vm, source, strlen(source), NULL) == MAXLISP_OK);
+  }
+
+  source = "(defun stat (name stats) "
+           "  (if (eq (car (car stats)) name) (cdr (car stats)) (stat name (cdr stats))))"
+           "(stat 'gc-count (memory-stats))";
+  assert(maxlisp_eval(vm, source, strlen(source), &result) == MAXLISP_OK);
+  assert(maxlisp_to_number(result) > 0);
+  assert(!strcmp(maxlisp_to_string(maxlisp_pinned(pin)), "kept"));
+  maxlisp_unpin(vm, pin);
+
+  printf("  Making sure borrowed bytes aren't copied...\n");
+  static const char host_buffer[] = "borrowed";
+  maxlisp_value *bytes = maxlisp_borrow_bytes(vm, host_buffer, 8, count_release, &releases);
+  size_t length;
+
+  assert(maxlisp_bytes_data(bytes, &length) == host_buffer && length == 8);
+  assert(maxlisp_call(vm, "bytes-length", 1, &bytes, &result) == MAXLISP_OK);
+  assert(maxlisp_to_number(result) == 8);
+
+  maxlisp_destroy(vm);
+  assert(releases == 1);
+  assert(lisp_vm_current() == own_vm);
+
+  printf("Embedding test passed!\n\n");
+}
+
+static void test_ffi() {
+  printf("Testing foreign functions...\n");
+
+  printf("  Making sure numbers are passed both ways...\n");
+  eval_string("(setq c-cos (foreign-function \"libm.so.6\" \"cos\" 'double '(double)))"
+              "(setq c-labs (foreign-function nil \"labs\" 'long '(long)))"
+              "(setq c-ldexp (foreign-function \"libm.so.6\" \"ldexp\" 'double '(double int)))");
+  assert(eval_string("(c-cos 0)")->datum.number == 1);
+  assert(eval_string("(c-labs -42)")->datum.number == 42);
+  assert(eval_string("(c-ldexp 3 4)")->datum.number == 48);
+
+  printf("  Making sure BYTES are passed without copying...\n");
+  eval_string("(setq c-memset (foreign-function nil \"memset\" 'void '(pointer int long)))"
+              "(setq buffer (make-bytes 4 65))"
+              "(c-memset buffer 66 2)");
+  assert(!strcmp(eval_string("(bytes->string buffer)")->datum.string, "BBAA"));
+
+  printf("  Making sure strings are passed and returned...\n");
+  eval_string("(setq c-strlen (foreign-function nil \"strlen\" 'long '(string)))"
+              "(setq c-strchr (foreign-function nil \"strchr\" 'string '(string int)))");
+  assert(eval_string("(c-strlen \"seven!!\")")->datum.number == 7);
+  assert(!strcmp(eval_string("(c-strchr \"key=value\" 61)")->datum.string, "=value"));
+  assert(eval_string("(c-strchr \"key\" 61)") == NIL);
+
+  printf("  Making sure bad bindings and calls are errors...\n");
+  assert(eval_string("(foreign-function nil \"no_such_function\" 'void '())") == NULL);
+  assert(eval_string("(foreign-function nil \"labs\" 'float '(long))") == NULL);
+  assert(eval_string("(c-labs \"x\")") == NULL);
+  assert(eval_string("(c-labs 1 2)") == NULL);
+
+  printf("Foreign functions test passed!\n\n");
+}
+
+static void test_vectors() {
+  printf("Testing numeric vectors...\n");
+
+  printf("  Making sure vectors print...\n");
+  assert(!strcmp(print_object(eval_string("(i64vector 1 -2 3)"))->datum.string,
+                 "#i64(1 -2 3)"));
+  assert(!strcmp(print_object(eval_string("(make-f64vector 2 0.5)"))->datum.string,
+                 "#f64(0.500000 0.500000)"));
+
+  /* 9 elements, so the kernels have a tail after their groups of four */
+  eval_string("(setq fv (f64vector 1 2 3 4 5 6 7 8 9))"
+              "(setq iv (i64vector 1 2 3 4 5 6 7 8 9))");
+
+  for (int simd = 1; simd >= 0; simd--) {
+    printf("  Making sure the %s kernels are right...\n", simd ? "SIMD" : "scalar");
+    set_vector_simd(simd);
+
+    assert(eval_string("(sum fv)")->datum.number == 45);
+    assert(eval_string("(sum iv)")->datum.number == 45);
+    assert(eval_string("(dot fv fv)")->datum.number == 285);
+    assert(eval_string("(dot iv iv)")->datum.number == 285);
+    assert(eval_string("(vec-ref (vec+ fv fv) 8)")->datum.number == 18);
+    assert(eval_string("(vec-ref (vec* iv iv) 8)")->datum.number == 81);
+    assert(eval_string("(vec-ref (scale iv 3) 8)")->datum.number == 27);
+    assert(eval_string("(sum (scale fv 0.5))")->datum.number == 22.5);
+
+    printf("  Making sure vec-map's kernels match calling the function...\n");
+    assert(eval_string("(sum (vec-map (lambda (x) (* x x)) iv))")->datum.number == 285);
+    assert(eval_string("(sum (vec-map (lambda (x) (- 10 x)) fv))")->datum.number == 45);
+    assert(eval_string("(sum (vec-map (lambda (x) (+ x 1)) iv))")->datum.number == 54);
+    assert(eval_string("(vec-ref (vec-map (lambda (x) (- x 1)) fv) 0)")->datum.number == 0);
+    assert(eval_string("(sum (vec-map (lambda (x) (if (< x 5) x 0)) iv))")->datum.number == 10);
+  }
+
+  printf("  Making sure vec-map falls back to calling the function where it must...\n");
+  eval_string("(setq k 2)");
+  assert(eval_string("(sum (vec-map (lambda (x) (* x k)) iv))")->datum.number == 90);
+  assert(eval_string("(sum (vec-map (lambda (x) (* x 1.5)) fv))")->datum.number == 67.5);
+  assert(eval_string("(vec-map (lambda (x) (* x 1.5)) iv)") == NULL);
+  assert(eval_string("(sum (vec-map (lambda (x) (/ x 1)) iv))")->datum.number == 45);
+
+  printf("  Making sure bad arguments are errors...\n");
+  assert(eval_string("(i64vector 1.5)") == NULL);
+  assert(eval_string("(vec+ fv iv)") == NULL);
+  assert(eval_string("(vec+ fv (f64vector 1))") == NULL);
+  assert(eval_string("(vec-ref fv 9)") == NULL);
+  assert(eval_string("(sum '(1 2))") == NULL);
+
+  printf("Numeric vectors test passed!\n\n");
+}
+
+static void test_sort() {
+  printf("Testing sort and binary-search...\n");
+
+  printf("  Making sure lists sort with the fast path and without...\n");
+  eval_string("(setq xs '(5 3 9 1 3 7 2 8 6 4 0 11 10 12 15 14 13 16 19 18 17))");
+  lisp_object_t *fast = eval_string("(sort xs <)");
+  lisp_object_t *slow = eval_string("(sort xs (lambda (a b) (< a b)))");
+
+  for (int i = 0; fast != NIL; i++) {
+    lisp_object_t *expected = CONS_VALUE(fast)->car;
+
+    assert(expected->datum.number == (i < 4 ? i : i - 1));
+    assert(CONS_VALUE(slow)->car->datum.number == expected->datum.number);
+    fast = CONS_VALUE(fast)->cdr;
+    slow = CONS_VALUE(slow)->cdr;
+  }
+
+  assert(eval_string("(car (sort xs >))")->datum.number == 19);
+  assert(eval_string("(car xs)")->datum.number == 5);
+  assert(eval_string("(sort '() <)") == NIL);
+
+  printf("  Making sure sorting by key is stable...\n");
+  lisp_object_t *records = eval_string("(sort '((b . 2) (a . 1) (c . 2) (d . 0) (e . 1)) "
+                                        "  < cdr)");
+  assert(!strcmp(print_object(records)->datum.string,
+                 "((d . 0.000000) (a . 1.000000) (e . 1.000000) (b . 2.000000) (c . 2.000000))"));
+
+  printf("  Making sure vectors sort and can be searched...\n");
+  eval_string("(setq sorted "
+              "  (sort (i64vector 40 10 30 20 30 50 0 60 70 90 80 30 20 10 0 5 15 25) <))");
+  assert(!strcmp(print_object(eval_string("sorted"))->datum.string,
+                 "#i64(0 0 5 10 10 15 20 20 25 30 30 30 40 50 60 70 80 90)"));
+  assert(eval_string("(binary-search sorted 30)")->datum.number == 9);
+  assert(eval_string("(binary-search sorted 0)")->datum.number == 0);
+  assert(eval_string("(binary-search sorted 90)")->datum.number == 17);
+  assert(eval_string("(binary-search sorted 31)") == NIL);
+  assert(eval_string("(binary-search sorted 30.5)") == NIL);
+  assert(eval_string("(vec-ref (sort (f64vector 0.5 -1 2) >) 0)")->datum.number == 2);
+  assert(eval_string("(vec-ref (sort (f64vector 0.5 -1 2) (lambda (a b) (> a b))) 2)")
+         ->datum.number == -1);
+
+  printf("  Making sure bad arguments are errors...\n");
+  assert(eval_string("(sort 5 <)") == NULL);
+  assert(eval_string("(sort '(1 a) <)") == NULL);
+  assert(eval_string("(sort '(1 2) 5)") == NULL);
+  assert(eval_string("(binary-search '(1 2) 1)") == NULL);
+
+  printf("Sort test passed!\n\n");
+}
+
+static size_t cons_count() {
+  return memory_stats()->objects[ALLOC_CONS];
+}
+
+static void test_loops() {
+  printf("Testing loops...\n");
+
+  printf("  Making sure while, dotimes and dolist return what they should...\n");
+  eval_string("(setq loop-total 0)"
+              "(while (< loop-total 5) (setq loop-total (+ loop-total 1)))");
+  assert(eval_string("loop-total")->datum.number == 5);
+  assert(eval_string("(dotimes (i 4 i))")->datum.number == 4);
+  assert(eval_string("(dotimes (i 4))") == NIL);
+  assert(eval_string("(let ((sum 0)) (dolist (x '(1 2 3) sum) (setq sum (+ sum x))))")
+         ->datum.number == 6);
+
+  printf("  Making sure loops run far deeper than recursion could...\n");
+  assert(eval_string("(let ((sum 0)) (dotimes (i 200000 sum) (set 'sum (+ sum 1))))")
+         ->datum.number == 200000);
+
+  printf("  Making sure iterations don't allocate environments...\n");
+  eval_string("(defun loop-count (n) (let ((count 0)) (dotimes (i n count) (setq count i))))"
+              "(loop-count 1)");
+  size_t conses = cons_count();
+  eval_string("(loop-count 10)");
+  size_t short_loop = cons_count() - conses;
+
+  conses = cons_count();
+  assert(eval_string("(loop-count 10000)")->datum.number == 9999);
+  assert(cons_count() - conses == short_loop);
+
+  printf("  Making sure the variable is one binding, updated in place...\n");
+  eval_string("(setq loop-closures nil)"
+              "(defun collect-closures () "
+              "  (dotimes (i 3) (setq loop-closures (cons (lambda () i) loop-closures))))"
+              "(collect-closures)");
+  assert(eval_string("((car loop-closures))")->datum.number == 3);
+  assert(eval_string("((car (cdr loop-closures)))")->datum.number == 3);
+
+  printf("  Making sure closures in loops keep the frames around the loop...\n");
+  eval_string("(defun make-getter (x) "
+              "  (dotimes (i 1) (setq loop-getter (lambda () (eval 'x)))))"
+              "(make-getter 42)"
+              "(defun reuse-frames (a b c) (list a b c))"
+              "(reuse-frames 1 2 3)");
+  assert(eval_string("(loop-getter)")->datum.number == 42);
+
+  printf("  Making sure a loop's body is expanded once, not every time it runs...\n");
+  eval_string("(setq loop-expansions 0)"
+              "(defmacro counted-expansion (x) "
+              "  (progn (setq loop-expansions (+ loop-expansions 1)) x))"
+              "(defun expand-once () (dotimes (i 3 i) (counted-expansion i)))");
+  eval_string("(expand-once)");
+  eval_string("(expand-once)");
+  assert(eval_string("loop-expansions")->datum.number == 1);
+
+  printf("  Making sure garbage is collected while a loop runs...\n");
+  const memory_stats_t *stats = memory_stats();
+  size_t collections = stats->gc_count;
+
+  assert(eval_string("(let ((sum 0)) (dotimes (i 300000 sum) (setq sum (+ sum (car (list i))))))")
+         ->datum.number == 44999850000.0);
+  assert(stats->gc_count > collections);
+  assert(stats->last_survivors < 100000);
+
+  printf("  Making sure natives keep what they hold while a loop collects...\n");
+  eval_string("(defun churn (x) (dotimes (i 60000) (list i i)) x)");
+  assert(eval_string("(car (sort '(1 3 2) < (lambda (x) (churn (- 0 x)))))")->datum.number == 3);
+  assert(eval_string("(car (pmap (lambda (x) (churn (* x 2))) '(4)))")->datum.number == 8);
+  assert(eval_string("(preduce (lambda (a b) (churn (+ a b))) 0 '(1 2 3))")->datum.number == 6);
+
+  printf("  Making sure macros are shadowed by variables in loops...\n");
+  assert(eval_string("((lambda (when) (let ((r nil)) (dotimes (i 3 r) (setq r (when i))))) "
+                     " (lambda (x) (* x 10)))")->datum.number == 20);
+
+  printf("  Making sure throws leave loops cleanly...\n");
+  assert(eval_string("(catch 'found (dolist (x '(1 2 3)) (if (= x 2) (throw 'found x))))")
+         ->datum.number == 2);
+  assert(eval_string("(dotimes (i 'a))") == NULL);
+  assert(eval_string("(dolist (x 5))") == NULL);
+  assert(eval_string("(dotimes i)") == NULL);
+
+  printf("Loops test passed!\n\n");
+}
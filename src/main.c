@@ -1,31 +1,60 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "lisp.h"
 #include "reader.h"
+#include "profile.h"
+
+static void usage() {
+  fprintf(stderr, "usage: lisp_main [--image path] [--profile path] [script [args...]]\n");
+  exit(1);
+}
 
-extern lisp_object_t *NIL;
-extern lisp_object_t *T;
+/* the reader doesn't print its own errors */
+static void report_read_error(lisp_reader_t *reader) {
+  fprintf(stderr, "Error: %s (line %d, column %d).\n", reader->error,
+          reader->error_line, reader->error_column);
+}
 
-extern enum read_condition read_flag;
+/* Reads forms from stdin, printing what each evaluates to */
+static int repl(lisp_object_t *global_environment) {
+  lisp_reader_t *reader = make_file_reader(stdin);
+  lisp_writer_t out;
 
-int main() {
-  lisp_object_t *global_environment = init_lisp_module();
+  init_file_writer(&out, stdout);
+
+  /* piped input needn't see each result before the next form is read */
+  int interactive = isatty(fileno(stdin));
 
   while (1) {
-    do_gc(global_environment);
+    maybe_gc(global_environment);
     /* printf("Total number of objects: %ld\n", allocated_objects()); */
 
-    lisp_object_t *object = read_object(stdin, "> ");
+    printf("> ");
+
+    if (interactive)
+      fflush(stdout);
+
+    lisp_object_t *object = read_form(reader);
 
-    if (read_flag == READ_UNBALANCED_PAREN) {
+    if (reader->condition == READ_UNBALANCED_PAREN) {
       fprintf(stderr, "Error: unbalanced parenthesis.\n");
       continue;
-    } else if (read_flag == READ_DOT) {
+    } else if (reader->condition == READ_DOT) {
       fprintf(stderr, "Error: unexpected '.'.\n");
       continue;
+    } else if (reader->condition == READ_ERROR) {
+      report_read_error(reader);
+      continue;
+    } else if (reader->condition == READ_TRUNCATED) {
+      report_read_error(reader);
+      break;
     }
-    
+
     if (object == NULL)
       break;
 
@@ -34,10 +63,113 @@ int main() {
     if (new_object == NULL)
       continue;
 
-    lisp_object_t *pro = print_object(new_object);
-
-    printf("%s\n", pro->datum.string);
+    write_object(&out, new_object);
+    writer_write(&out, "\n", 1);
     /* printf("Total number of objects: %ld\n\n", allocated_objects()); */
-    fflush(stdout);
+
+    if (interactive)
+      fflush(stdout);
+  }
+
+  free_reader(reader);
+
+  return 0;
+}
+
+/* Evaluates the forms in the file at path without printing them. Returns
+   0, or 1 as soon as a form can't be read or throws. */
+static int run_script(const char *path, lisp_object_t *global_environment) {
+  lisp_reader_t *reader = open_file_reader(path);
+
+  if (!reader) {
+    fprintf(stderr, "Error: unable to open script: \"%s\"\n", path);
+    return 1;
+  }
+
+  int status = 0;
+
+  while (1) {
+    lisp_object_t *object = read_form(reader);
+
+    if (reader->condition == READ_UNBALANCED_PAREN) {
+      fprintf(stderr, "Error: unbalanced parenthesis.\n");
+      status = 1;
+      break;
+    } else if (reader->condition == READ_DOT) {
+      fprintf(stderr, "Error: unexpected '.'.\n");
+      status = 1;
+      break;
+    } else if (reader->condition == READ_ERROR || reader->condition == READ_TRUNCATED) {
+      report_read_error(reader);
+      status = 1;
+      break;
+    }
+
+    if (object == NULL)
+      break;
+
+    if (eval(object, global_environment) == NULL) {
+      status = 1;
+      break;
+    }
+
+    maybe_gc(global_environment);
+  }
+
+  close_reader(reader);
+
+  return status;
+}
+
+int main(int argc, char **argv) {
+  char *image_path = NULL;
+  char *profile_path = NULL;
+  int script = 0;               /* where the script's path is in argv */
+
+  for (int i = 1; i < argc && !script; i++) {
+    if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+      image_path = argv[++i];
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      profile_path = argv[++i];
+    } else if (argv[i][0] == '-') {
+      usage();
+    } else {
+      script = i;
+    }
+  }
+
+  lisp_object_t *global_environment = NULL;
+
+  if (image_path) {
+    global_environment = init_lisp_image(image_path);
+
+    if (!global_environment)
+      return 1;
+  } else {
+    global_environment = init_lisp_module();
+  }
+
+  /* the arguments after the script's path */
+  lisp_object_t *arguments = NIL;
+
+  for (int i = argc - 1; script && i > script; i--)
+    arguments = make_cons(make_string(strdup(argv[i])), arguments);
+
+  nice_set("*command-line-args*", arguments, global_environment);
+
+  if (profile_path)
+    profile_start();
+
+  int status = script ? run_script(argv[script], global_environment)
+                      : repl(global_environment);
+
+  if (profile_path) {
+    profile_stop();
+    profile_report(stderr);
+
+    if (profile_write_collapsed(profile_path) != 0)
+      return 1;
   }
+
+  return status;
 }
@@ -0,0 +1,416 @@
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include "lisp.h"
+#include "reader.h"
+#include "green.h"
+#include "maxlisp.h"
+
+struct maxlisp_vm {
+  lisp_vm_t *vm;
+  lisp_object_t *environment;
+  char *error;                  /* the last error's message */
+  char *failure;                /* see maxlisp_fail() */
+};
+
+/* what a native registered by maxlisp_register() is called with */
+typedef struct {
+  maxlisp_vm *host;
+  maxlisp_native native;
+  void *userdata;
+} native_binding_t;
+
+typedef struct {
+  lisp_object_t *function;
+  const char *name;             /* looked up when function is NULL */
+  size_t argc;
+  lisp_object_t **argv;
+} call_job_t;
+
+/* Makes host's VM current, returning the one to go back to, since a
+   native may call into another VM */
+static lisp_vm_t* enter(maxlisp_vm *host) {
+  lisp_vm_t *previous = lisp_vm_current();
+
+  lisp_vm_enter(host->vm);
+
+  return previous;
+}
+
+static void set_error(maxlisp_vm *host, char *message) {
+  free(host->error);
+  host->error = message;
+}
+
+/*
+ * Runs body under a point that catches whatever it throws, so nothing
+ * unwinds through the host's frames. Once the outermost evaluation is
+ * done, green threads get to run and garbage may be collected, keeping
+ * the result.
+ */
+static maxlisp_status protect(maxlisp_vm *host, lisp_object_t* (*body)(void *data), void *data,
+                              maxlisp_value **result) {
+  escape_point_t point;
+  lisp_object_t *value = NULL;
+  maxlisp_status status = MAXLISP_OK;
+
+  push_escape(&point, ESCAPE_CATCH_ALL, NULL);
+
+  if (setjmp(point.jump) == 0) {
+    value = body(data);
+  } else {
+    lisp_writer_t writer;
+
+    init_string_writer(&writer);
+    describe_uncaught(&writer, point.tag, point.value);
+    set_error(host, writer_finish(&writer));
+    status = MAXLISP_ERROR;
+  }
+
+  pop_escape(&point);
+
+  if (!lisp_evaluating()) {
+    green_run_pending();
+
+    lisp_pin_t *pin = value ? pin_object(value) : NULL;
+    maybe_gc(host->environment);
+
+    if (pin)
+      unpin_object(pin);
+  }
+
+  if (result)
+    *result = value;
+
+  return status;
+}
+
+static maxlisp_vm* wrap(lisp_object_t *environment) {
+  maxlisp_vm *host = xmalloc(sizeof(maxlisp_vm));
+
+  host->vm = lisp_vm_current();
+  host->environment = environment;
+  host->error = NULL;
+  host->failure = NULL;
+
+  return host;
+}
+
+maxlisp_vm* maxlisp_create(void) {
+  lisp_vm_t *previous = lisp_vm_current();
+  maxlisp_vm *host = wrap(init_lisp_module());
+
+  lisp_vm_enter(previous);
+
+  return host;
+}
+
+maxlisp_vm* maxlisp_create_from_image(const char *path) {
+  lisp_vm_t *previous = lisp_vm_current();
+  lisp_object_t *environment = init_lisp_image(path);
+  maxlisp_vm *host = NULL;
+
+  if (environment)
+    host = wrap(environment);
+  else
+    lisp_vm_destroy(lisp_vm_current());
+
+  lisp_vm_enter(previous);
+
+  return host;
+}
+
+void maxlisp_destroy(maxlisp_vm *host) {
+  lisp_vm_t *previous = lisp_vm_current();
+
+  lisp_vm_destroy(host->vm);
+
+  if (previous != host->vm)
+    lisp_vm_enter(previous);
+
+  free(host->error);
+  free(host->failure);
+  free(host);
+}
+
+static lisp_object_t* eval_forms(void *data) {
+  lisp_reader_t *reader = data;
+  lisp_object_t *value = NIL;
+  lisp_object_t *form;
+
+  while ((form = read_form(reader)))
+    value = eval(form, get_global_environment());
+
+  if (reader->condition == READ_UNBALANCED_PAREN)
+    return lisp_error("unbalanced parenthesis.");
+  else if (reader->condition == READ_DOT)
+    return lisp_error("unexpected '.'.");
+  else if (reader->condition == READ_ERROR || reader->condition == READ_TRUNCATED)
+    return lisp_error("%s (line %d, column %d).", reader->error,
+                      reader->error_line, reader->error_column);
+
+  return value;
+}
+
+maxlisp_status maxlisp_eval(maxlisp_vm *host, const char *source, size_t length,
+                            maxlisp_value **result) {
+  lisp_vm_t *previous = enter(host);
+  lisp_reader_t *reader = make_memory_reader(source, length);
+  maxlisp_status status = protect(host, eval_forms, reader, result);
+
+  free_reader(reader);
+  lisp_vm_enter(previous);
+
+  return status;
+}
+
+static lisp_object_t* call_function(void *data) {
+  call_job_t *job = data;
+  lisp_object_t *function = job->function;
+
+  if (!function) {
+    function = get(intern(job->name, strlen(job->name)), get_global_environment());
+
+    if (!function)
+      return lisp_error("symbol \"%s\" not bound.", job->name);
+  }
+
+  return funcall_array(function, job->argc, job->argv);
+}
+
+maxlisp_status maxlisp_call(maxlisp_vm *host, const char *name, size_t argc,
+                            maxlisp_value **argv, maxlisp_value **result) {
+  call_job_t job = {NULL, name, argc, argv};
+  lisp_vm_t *previous = enter(host);
+  maxlisp_status status = protect(host, call_function, &job, result);
+
+  lisp_vm_enter(previous);
+
+  return status;
+}
+
+maxlisp_status maxlisp_call_value(maxlisp_vm *host, maxlisp_value *function, size_t argc,
+                                  maxlisp_value **argv, maxlisp_value **result) {
+  call_job_t job = {function, NULL, argc, argv};
+  lisp_vm_t *previous = enter(host);
+  maxlisp_status status = protect(host, call_function, &job, result);
+
+  lisp_vm_enter(previous);
+
+  return status;
+}
+
+const char* maxlisp_error_message(maxlisp_vm *host) {
+  return host->error ? host->error : "";
+}
+
+maxlisp_value* maxlisp_lookup(maxlisp_vm *host, const char *name) {
+  lisp_vm_t *previous = enter(host);
+  lisp_object_t *value = get(intern(name, strlen(name)), host->environment);
+
+  lisp_vm_enter(previous);
+
+  return value;
+}
+
+void maxlisp_define(maxlisp_vm *host, const char *name, maxlisp_value *value) {
+  lisp_vm_t *previous = enter(host);
+
+  set(intern(name, strlen(name)), value, host->environment);
+  lisp_vm_enter(previous);
+}
+
+static lisp_object_t* call_native(lisp_object_t **args, size_t argc, void *data) {
+  native_binding_t *binding = data;
+  maxlisp_vm *host = binding->host;
+  lisp_object_t *result = binding->native(host, argc, args, binding->userdata);
+
+  if (result)
+    return result;
+
+  /* thrown from here, where the native's frames are already gone */
+  char *message = host->failure ? host->failure : strdup("native function failed.");
+  host->failure = NULL;
+
+  throw_to(intern("error", 5), make_error(make_string(message), NULL));
+}
+
+void maxlisp_register(maxlisp_vm *host, const char *name, int arity, maxlisp_native native,
+                      void *userdata) {
+  lisp_vm_t *previous = enter(host);
+  native_binding_t *binding = xmalloc(sizeof(native_binding_t));
+
+  binding->host = host;
+  binding->native = native;
+  binding->userdata = userdata;
+
+  set(intern(name, strlen(name)), make_host_function(name, arity, call_native, binding, free),
+      host->environment);
+  lisp_vm_enter(previous);
+}
+
+void maxlisp_fail(maxlisp_vm *host, const char *message) {
+  free(host->failure);
+  host->failure = strdup(message);
+}
+
+maxlisp_pin* maxlisp_pin_value(maxlisp_vm *host, maxlisp_value *value) {
+  lisp_vm_t *previous = enter(host);
+  lisp_pin_t *pin = pin_object(value);
+
+  lisp_vm_enter(previous);
+
+  return pin;
+}
+
+maxlisp_value* maxlisp_pinned(maxlisp_pin *pin) {
+  return pinned_object(pin);
+}
+
+void maxlisp_unpin(maxlisp_vm *host, maxlisp_pin *pin) {
+  (void) host;
+
+  unpin_object(pin);
+}
+
+maxlisp_value* maxlisp_nil(maxlisp_vm *host) {
+  lisp_vm_t *previous = enter(host);
+  lisp_object_t *value = NIL;
+
+  lisp_vm_enter(previous);
+
+  return value;
+}
+
+maxlisp_value* maxlisp_true(maxlisp_vm *host) {
+  lisp_vm_t *previous = enter(host);
+  lisp_object_t *value = T;
+
+  lisp_vm_enter(previous);
+
+  return value;
+}
+
+maxlisp_value* maxlisp_number(maxlisp_vm *host, double number) {
+  lisp_vm_t *previous = enter(host);
+  lisp_object_t *value = make_number(number);
+
+  lisp_vm_enter(previous);
+
+  return value;
+}
+
+maxlisp_value* maxlisp_string(maxlisp_vm *host, const char *string) {
+  lisp_vm_t *previous = enter(host);
+  lisp_object_t *value = make_string(strdup(string));
+
+  lisp_vm_enter(previous);
+
+  return value;
+}
+
+maxlisp_value* maxlisp_symbol(maxlisp_vm *host, const char *name) {
+  lisp_vm_t *previous = enter(host);
+  lisp_object_t *value = intern(name, strlen(name));
+
+  lisp_vm_enter(previous);
+
+  return value;
+}
+
+maxlisp_value* maxlisp_cons(maxlisp_vm *host, maxlisp_value *car, maxlisp_value *cdr) {
+  lisp_vm_t *previous = enter(host);
+  lisp_object_t *value = make_cons(car, cdr);
+
+  lisp_vm_enter(previous);
+
+  return value;
+}
+
+maxlisp_value* maxlisp_bytes(maxlisp_vm *host, const void *data, size_t length) {
+  lisp_vm_t *previous = enter(host);
+  unsigned char *copy = xmalloc(length ? length : 1);
+
+  memcpy(copy, data, length);
+
+  lisp_object_t *value = make_bytes(copy, length);
+
+  lisp_vm_enter(previous);
+
+  return value;
+}
+
+maxlisp_value* maxlisp_borrow_bytes(maxlisp_vm *host, const void *data, size_t length,
+                                    void (*release)(void *context), void *context) {
+  lisp_vm_t *previous = enter(host);
+  lisp_object_t *value = make_borrowed_bytes((unsigned char*) data, length, release, context);
+
+  lisp_vm_enter(previous);
+
+  return value;
+}
+
+maxlisp_type maxlisp_type_of(maxlisp_vm *host, maxlisp_value *value) {
+  lisp_vm_t *previous = enter(host);
+  maxlisp_type type;
+
+  switch (value->type) {
+  case NUMBER:
+    type = MAXLISP_NUMBER;
+    break;
+
+  case STRING:
+    type = MAXLISP_STRING;
+    break;
+
+  case SYMBOL:
+    type = MAXLISP_SYMBOL;
+    break;
+
+  case CONS:
+    type = value == NIL ? MAXLISP_NIL : MAXLISP_CONS;
+    break;
+
+  case BYTES:
+    type = MAXLISP_BYTES;
+    break;
+
+  case LAMBDA:
+  case NATIVE_FUNCTION:
+  case HOST_FUNCTION:
+  case CONTINUATION:
+    type = MAXLISP_FUNCTION;
+    break;
+
+  default:
+    type = MAXLISP_OTHER;
+    break;
+  }
+
+  lisp_vm_enter(previous);
+
+  return type;
+}
+
+double maxlisp_to_number(maxlisp_value *value) {
+  return value->datum.number;
+}
+
+const char* maxlisp_to_string(maxlisp_value *value) {
+  return value->type == SYMBOL ? value->datum.symbol : value->datum.string;
+}
+
+maxlisp_value* maxlisp_car(maxlisp_value *value) {
+  return CONS_VALUE(value)->car;
+}
+
+maxlisp_value* maxlisp_cdr(maxlisp_value *value) {
+  return CONS_VALUE(value)->cdr;
+}
+
+const void* maxlisp_bytes_data(maxlisp_value *value, size_t *length) {
+  *length = value->datum.bytes->length;
+
+  return value->datum.bytes->data;
+}
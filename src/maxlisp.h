@@ -0,0 +1,142 @@
+#ifndef MAXLISP_H
+#define MAXLISP_H
+
+#include <stddef.h>
+
+/*
+ * The interface for C and C++ programs that embed MaxLisp, e.g. to use
+ * it as a configuration or rules language. lisp.h is the interpreter's
+ * own, and isn't needed alongside this.
+ *
+ * Values belong to the VM that made them. Garbage is collected between
+ * top-level forms and between iterations of Lisp loops, so it can happen
+ * during any maxlisp_eval() or maxlisp_call(). Values in the program's
+ * local variables are kept then, as the C stack is scanned; pin the ones
+ * kept anywhere else.
+ *
+ * Nothing thrown in Lisp unwinds through the program's frames. It's
+ * caught by the call that started the evaluation, which returns
+ * MAXLISP_ERROR and leaves the message in maxlisp_error_message().
+ *
+ * A VM must only be used by one thread at a time, but different threads
+ * can use different VMs.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct maxlisp_vm maxlisp_vm;
+typedef struct lisp_object maxlisp_value;
+typedef struct lisp_pin maxlisp_pin;
+
+typedef enum {
+  MAXLISP_OK,
+  MAXLISP_ERROR
+} maxlisp_status;
+
+typedef enum {
+  MAXLISP_NIL,
+  MAXLISP_NUMBER,
+  MAXLISP_STRING,
+  MAXLISP_SYMBOL,
+  MAXLISP_CONS,
+  MAXLISP_BYTES,
+  MAXLISP_FUNCTION,
+  MAXLISP_OTHER
+} maxlisp_type;
+
+/* Returns a VM with core.lisp loaded from the working directory */
+maxlisp_vm* maxlisp_create(void);
+
+/* Returns a VM restored from an image written by save-image, or NULL if
+   it can't be read */
+maxlisp_vm* maxlisp_create_from_image(const char *path);
+
+/* Frees the VM and all of its values */
+void maxlisp_destroy(maxlisp_vm *vm);
+
+/* Evaluates each form in the length bytes at source, setting *result,
+   unless result is NULL, to the last one's value */
+maxlisp_status maxlisp_eval(maxlisp_vm *vm, const char *source, size_t length,
+                            maxlisp_value **result);
+
+/* Calls the function bound to name */
+maxlisp_status maxlisp_call(maxlisp_vm *vm, const char *name, size_t argc,
+                            maxlisp_value **argv, maxlisp_value **result);
+
+/* Calls function, e.g. one looked up once with maxlisp_lookup() and
+   pinned, which saves finding it by name every time */
+maxlisp_status maxlisp_call_value(maxlisp_vm *vm, maxlisp_value *function, size_t argc,
+                                  maxlisp_value **argv, maxlisp_value **result);
+
+/* What the last call to return MAXLISP_ERROR threw */
+const char* maxlisp_error_message(maxlisp_vm *vm);
+
+/* Returns the value bound to name, or NULL if it isn't bound */
+maxlisp_value* maxlisp_lookup(maxlisp_vm *vm, const char *name);
+
+void maxlisp_define(maxlisp_vm *vm, const char *name, maxlisp_value *value);
+
+/* A function written in C. argv holds argc values and lasts until it
+   returns. It returns its result, or NULL to throw the error given to
+   maxlisp_fail(). */
+typedef maxlisp_value* (*maxlisp_native)(maxlisp_vm *vm, size_t argc, maxlisp_value **argv,
+                                         void *userdata);
+
+/* Binds name to native, which errors unless it's called with arity
+   arguments, when arity isn't negative */
+void maxlisp_register(maxlisp_vm *vm, const char *name, int arity, maxlisp_native native,
+                      void *userdata);
+
+/* Sets the message a native that returns NULL throws */
+void maxlisp_fail(maxlisp_vm *vm, const char *message);
+
+/* Keeps value from being collected until it's unpinned */
+maxlisp_pin* maxlisp_pin_value(maxlisp_vm *vm, maxlisp_value *value);
+
+maxlisp_value* maxlisp_pinned(maxlisp_pin *pin);
+
+void maxlisp_unpin(maxlisp_vm *vm, maxlisp_pin *pin);
+
+maxlisp_value* maxlisp_nil(maxlisp_vm *vm);
+
+maxlisp_value* maxlisp_true(maxlisp_vm *vm);
+
+maxlisp_value* maxlisp_number(maxlisp_vm *vm, double number);
+
+/* Copies string */
+maxlisp_value* maxlisp_string(maxlisp_vm *vm, const char *string);
+
+maxlisp_value* maxlisp_symbol(maxlisp_vm *vm, const char *name);
+
+maxlisp_value* maxlisp_cons(maxlisp_vm *vm, maxlisp_value *car, maxlisp_value *cdr);
+
+/* Copies length bytes of data into BYTES */
+maxlisp_value* maxlisp_bytes(maxlisp_vm *vm, const void *data, size_t length);
+
+/* Returns BYTES over data without copying it. data must stay valid and
+   unchanged until the value is collected, when release(context) is called
+   unless release is NULL. */
+maxlisp_value* maxlisp_borrow_bytes(maxlisp_vm *vm, const void *data, size_t length,
+                                    void (*release)(void *context), void *context);
+
+maxlisp_type maxlisp_type_of(maxlisp_vm *vm, maxlisp_value *value);
+
+/* The accessors expect a value of the right type */
+double maxlisp_to_number(maxlisp_value *value);
+
+/* The text of a STRING or the name of a SYMBOL */
+const char* maxlisp_to_string(maxlisp_value *value);
+
+maxlisp_value* maxlisp_car(maxlisp_value *value);
+
+maxlisp_value* maxlisp_cdr(maxlisp_value *value);
+
+const void* maxlisp_bytes_data(maxlisp_value *value, size_t *length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,268 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "lisp.h"
+#include "parallel.h"
+
+/*
+ * A work-stealing pool. The helper threads are started on first use and
+ * live for the rest of the process. A call to parallel_for() is a job,
+ * split into a few chunks per thread; every thread taking part gets a
+ * slot, holding a deque of chunks and a VM forked from the caller's.
+ * A slot's thread takes chunks from the bottom of its own deque, and once
+ * that's empty steals from the top of the others'.
+ */
+
+/* chunks per slot, so threads that finish early have something to steal */
+#define CHUNKS_PER_SLOT 4
+
+typedef struct {
+  pthread_mutex_t lock;
+  size_t top;                   /* the next chunk to steal */
+  size_t bottom;                /* one past the owner's next chunk */
+} chunk_deque_t;
+
+typedef struct parallel_job {
+  size_t count;
+  size_t chunk_size;
+  void (*body)(size_t start, size_t end, void *data);
+  void *data;
+
+  size_t slots;
+  chunk_deque_t *deques;
+  lisp_vm_t **vms;
+
+  /* the rest are guarded by pool_lock, besides failed which is atomic */
+  size_t next_slot;             /* the next slot a helper may claim */
+  size_t running;               /* helpers working on the job */
+  int failed;
+  lisp_object_t *tag;
+  lisp_object_t *value;
+
+  struct parallel_job *next;
+} parallel_job_t;
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+static parallel_job_t *jobs;
+static size_t helper_count;
+
+/* Takes the owner's next chunk, or steals one when stealing. Returns 0
+   when the deque is empty. */
+static int take_chunk(chunk_deque_t *deque, int stealing, size_t *chunk) {
+  int found = 0;
+
+  pthread_mutex_lock(&deque->lock);
+
+  if (deque->top < deque->bottom) {
+    *chunk = stealing ? deque->top++ : --deque->bottom;
+    found = 1;
+  }
+
+  pthread_mutex_unlock(&deque->lock);
+
+  return found;
+}
+
+static void run_chunk(parallel_job_t *job, size_t chunk) {
+  size_t start = chunk * job->chunk_size;
+  size_t end = start + job->chunk_size;
+  escape_point_t point;
+
+  if (end > job->count)
+    end = job->count;
+
+  push_escape(&point, ESCAPE_CATCH_ALL, NULL);
+
+  if (setjmp(point.jump) == 0) {
+    job->body(start, end, job->data);
+  } else {
+    pthread_mutex_lock(&pool_lock);
+
+    if (!job->failed) {
+      job->tag = point.tag;
+      job->value = point.value;
+      __atomic_store_n(&job->failed, 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+  }
+
+  pop_escape(&point);
+}
+
+/* Runs chunks in the current VM until there are none left anywhere */
+static void run_slot(parallel_job_t *job, size_t slot) {
+  size_t chunk;
+
+  while (!__atomic_load_n(&job->failed, __ATOMIC_ACQUIRE)) {
+    int found = take_chunk(&job->deques[slot], 0, &chunk);
+
+    for (size_t i = 1; !found && i < job->slots; i++)
+      found = take_chunk(&job->deques[(slot + i) % job->slots], 1, &chunk);
+
+    if (!found)
+      return;
+
+    run_chunk(job, chunk);
+  }
+}
+
+static void* helper_main(void *unused) {
+  (void) unused;
+
+  pthread_mutex_lock(&pool_lock);
+
+  for (;;) {
+    parallel_job_t *job = jobs;
+
+    while (job && job->next_slot == job->slots)
+      job = job->next;
+
+    if (!job) {
+      pthread_cond_wait(&work_ready, &pool_lock);
+      continue;
+    }
+
+    size_t slot = job->next_slot++;
+    job->running++;
+    pthread_mutex_unlock(&pool_lock);
+
+    lisp_vm_enter(job->vms[slot]);
+    run_slot(job, slot);
+    lisp_vm_enter(NULL);
+
+    pthread_mutex_lock(&pool_lock);
+
+    if (--job->running == 0)
+      pthread_cond_broadcast(&job_done);
+  }
+
+  return NULL;
+}
+
+/* The pool has a thread per processor, counting the caller's, unless
+   MAXLISP_THREADS says otherwise */
+static void start_pool() {
+  const char *setting = getenv("MAXLISP_THREADS");
+  long threads = setting ? atol(setting) : sysconf(_SC_NPROCESSORS_ONLN);
+
+  for (long i = 1; i < threads; i++) {
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, helper_main, NULL) != 0)
+      break;
+
+    pthread_detach(thread);
+    helper_count++;
+  }
+}
+
+static void unlink_job(parallel_job_t *job) {
+  parallel_job_t **link = &jobs;
+
+  while (*link != job)
+    link = &(*link)->next;
+
+  *link = job->next;
+}
+
+/* Waits out the helpers and folds their VMs back into the caller's */
+static void finish_job(parallel_job_t *job) {
+  if (job->slots > 1) {
+    pthread_mutex_lock(&pool_lock);
+    unlink_job(job);
+
+    while (job->running)
+      pthread_cond_wait(&job_done, &pool_lock);
+
+    pthread_mutex_unlock(&pool_lock);
+  }
+
+  for (size_t slot = 0; slot < job->slots; slot++) {
+    pthread_mutex_destroy(&job->deques[slot].lock);
+
+    if (slot)
+      lisp_vm_merge(job->vms[slot]);
+  }
+
+  free(job->deques);
+  free(job->vms);
+}
+
+int parallel_for(size_t count, void (*body)(size_t start, size_t end, void *data), void *data,
+                 lisp_object_t **tag, lisp_object_t **value) {
+  parallel_job_t job;
+  escape_point_t cleanup;
+
+  pthread_once(&pool_once, start_pool);
+
+  memset(&job, 0, sizeof(job));
+  job.count = count;
+  job.body = body;
+  job.data = data;
+  job.slots = helper_count + 1;
+
+  if (job.slots > count)
+    job.slots = count ? count : 1;
+
+  size_t chunks = job.slots * CHUNKS_PER_SLOT;
+
+  if (chunks > count)
+    chunks = count ? count : 1;
+
+  job.chunk_size = (count + chunks - 1) / chunks;
+  chunks = job.chunk_size ? (count + job.chunk_size - 1) / job.chunk_size : 0;
+
+  job.deques = xmalloc(job.slots * sizeof(chunk_deque_t));
+  job.vms = xmalloc(job.slots * sizeof(lisp_vm_t*));
+
+  /* slot 0 is the caller's, which runs in the caller's VM */
+  for (size_t slot = 0; slot < job.slots; slot++) {
+    pthread_mutex_init(&job.deques[slot].lock, NULL);
+    job.deques[slot].top = chunks * slot / job.slots;
+    job.deques[slot].bottom = chunks * (slot + 1) / job.slots;
+    job.vms[slot] = slot ? lisp_vm_fork() : lisp_vm_current();
+  }
+
+  job.next_slot = 1;
+
+  if (job.slots > 1) {
+    pthread_mutex_lock(&pool_lock);
+    job.next = jobs;
+    jobs = &job;
+    pthread_cond_broadcast(&work_ready);
+    pthread_mutex_unlock(&pool_lock);
+  }
+
+  /* a continuation called from body jumps straight past run_chunk, so
+     the helpers are stopped and joined before it goes on */
+  push_escape(&cleanup, ESCAPE_CLEANUP, NULL);
+
+  if (setjmp(cleanup.jump) != 0) {
+    pop_escape(&cleanup);
+    __atomic_store_n(&job.failed, 1, __ATOMIC_RELEASE);
+    finish_job(&job);
+    resume_escape(&cleanup);
+  }
+
+  run_slot(&job, 0);
+  pop_escape(&cleanup);
+  finish_job(&job);
+
+  if (job.failed) {
+    *tag = job.tag;
+    *value = job.value;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+#include "lisp.h"
+
+/* Calls body on ranges covering [0, count), spread over a process-wide
+ * pool of threads with one VM forked from the current one per thread.
+ * The calling thread does its share in the current VM. Ranges are dealt
+ * out up front and idle threads steal from busy ones.
+ *
+ * Returns 0 once every range is done. If body throws, the remaining
+ * ranges are skipped and -1 is returned with the first tag and value
+ * thrown, for the caller to throw again. A jump out of body on the
+ * calling thread, say to a continuation, waits for the other threads
+ * before it carries on.
+ */
+int parallel_for(size_t count, void (*body)(size_t start, size_t end, void *data), void *data,
+                 lisp_object_t **tag, lisp_object_t **value);
+
+#endif
@@ -0,0 +1,399 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lisp.h"
+#include "profile.h"
+
+/* the profiler records the thread that started it */
+LISP_THREAD_LOCAL int profile_enabled = 0;
+
+/* Statistics for one function. Closures made from the same lambda
+ * expression share an entry, so the key is the expression (or the native
+ * function object itself).
+ */
+typedef struct profile_entry {
+  lisp_object_t *key;
+  int macro;
+  char *name;
+  size_t calls;
+  size_t active;                /* recursion depth, for inclusive time */
+  double inclusive;
+  double exclusive;
+  size_t allocations;
+} profile_entry_t;
+
+/* a node of the call tree, one per distinct stack of entries */
+typedef struct profile_node {
+  profile_entry_t *entry;
+  struct profile_node *parent;
+  struct profile_node *children;
+  struct profile_node *next_sibling;
+  double self;
+} profile_node_t;
+
+typedef struct {
+  profile_node_t *node;
+  double start;
+  double children;
+  size_t allocations;
+} profile_frame_t;
+
+static LISP_THREAD_LOCAL profile_entry_t **entries = NULL;
+static LISP_THREAD_LOCAL size_t entries_capacity = 0;
+static LISP_THREAD_LOCAL size_t entries_count = 0;
+
+static LISP_THREAD_LOCAL profile_node_t root_node = {NULL, NULL, NULL, NULL, 0};
+
+static LISP_THREAD_LOCAL profile_frame_t *frames = NULL;
+static LISP_THREAD_LOCAL size_t frames_capacity = 0;
+static LISP_THREAD_LOCAL size_t frames_count = 0;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void free_nodes(profile_node_t *node) {
+  while (node) {
+    profile_node_t *next = node->next_sibling;
+
+    free_nodes(node->children);
+    free(node);
+    node = next;
+  }
+}
+
+static void clear_profile() {
+  for (size_t i = 0; i < entries_capacity; i++) {
+    if (entries[i]) {
+      free(entries[i]->name);
+      free(entries[i]);
+    }
+  }
+
+  free(entries);
+  entries = NULL;
+  entries_capacity = 0;
+  entries_count = 0;
+
+  free_nodes(root_node.children);
+  root_node.children = NULL;
+}
+
+void profile_start() {
+  clear_profile();
+  frames_count = 0;
+  profile_enabled = 1;
+}
+
+void profile_stop() {
+  profile_enabled = 0;
+}
+
+static lisp_object_t* entry_key(lisp_object_t *f) {
+  if (f->type == LAMBDA || f->type == MACRO)
+    return CONS_VALUE(f)->car;
+
+  return f;
+}
+
+static size_t hash_key(lisp_object_t *key, size_t capacity) {
+  return (((size_t) key >> 4) * 2654435761u) & (capacity - 1);
+}
+
+static void grow_entries() {
+  profile_entry_t **old_entries = entries;
+  size_t old_capacity = entries_capacity;
+
+  entries_capacity = old_capacity ? old_capacity * 2 : 256;
+  entries = calloc(entries_capacity, sizeof(profile_entry_t*));
+
+  if (!entries) {
+    fprintf(stderr, "Error: out of memory.\n");
+    exit(1);
+  }
+
+  for (size_t i = 0; i < old_capacity; i++) {
+    if (!old_entries[i])
+      continue;
+
+    size_t slot = hash_key(old_entries[i]->key, entries_capacity);
+    while (entries[slot])
+      slot = (slot + 1) & (entries_capacity - 1);
+
+    entries[slot] = old_entries[i];
+  }
+
+  free(old_entries);
+}
+
+static profile_entry_t* find_entry(lisp_object_t *f) {
+  lisp_object_t *key = entry_key(f);
+
+  if ((entries_count + 1) * 2 >= entries_capacity)
+    grow_entries();
+
+  size_t slot = hash_key(key, entries_capacity);
+  while (entries[slot]) {
+    if (entries[slot]->key == key)
+      return entries[slot];
+
+    slot = (slot + 1) & (entries_capacity - 1);
+  }
+
+  profile_entry_t *entry = xmalloc(sizeof(profile_entry_t));
+  memset(entry, 0, sizeof(profile_entry_t));
+  entry->key = key;
+  entry->macro = (f->type == MACRO);
+
+  if (f->type == NATIVE_FUNCTION && native_function_name(f->datum.native_func))
+    entry->name = strdup(native_function_name(f->datum.native_func));
+  else if (f->type == HOST_FUNCTION)
+    entry->name = strdup(f->datum.host->name);
+
+  entries[slot] = entry;
+  entries_count++;
+
+  return entry;
+}
+
+void profile_name_function(lisp_object_t *function, lisp_object_t *symbol) {
+  if (function->type != LAMBDA && function->type != MACRO
+      && function->type != NATIVE_FUNCTION)
+    return;
+
+  profile_entry_t *entry = find_entry(function);
+
+  if (!entry->name)
+    entry->name = strdup(symbol->datum.symbol);
+}
+
+void profile_enter(lisp_object_t *f, int macro_expansion) {
+  profile_entry_t *entry = find_entry(f);
+  profile_node_t *parent = frames_count ? frames[frames_count - 1].node : &root_node;
+  profile_node_t *node = parent->children;
+
+  entry->macro = entry->macro || macro_expansion;
+
+  while (node && node->entry != entry)
+    node = node->next_sibling;
+
+  if (!node) {
+    node = xmalloc(sizeof(profile_node_t));
+    node->entry = entry;
+    node->parent = parent;
+    node->children = NULL;
+    node->self = 0;
+    node->next_sibling = parent->children;
+    parent->children = node;
+  }
+
+  if (frames_count == frames_capacity) {
+    frames_capacity = frames_capacity ? frames_capacity * 2 : 256;
+    frames = realloc(frames, frames_capacity * sizeof(profile_frame_t));
+
+    if (!frames) {
+      fprintf(stderr, "Error: out of memory.\n");
+      exit(1);
+    }
+  }
+
+  profile_frame_t *frame = &frames[frames_count++];
+  frame->node = node;
+  frame->children = 0;
+  frame->allocations = allocation_count();
+  frame->start = now();
+
+  entry->calls++;
+  entry->active++;
+}
+
+void profile_exit() {
+  if (frames_count == 0)
+    return;
+
+  profile_frame_t *frame = &frames[--frames_count];
+  profile_entry_t *entry = frame->node->entry;
+  double elapsed = now() - frame->start;
+  size_t allocations = allocation_count() - frame->allocations;
+
+  /* recursive calls are only counted once toward inclusive time */
+  if (--entry->active == 0)
+    entry->inclusive += elapsed;
+
+  entry->exclusive += elapsed - frame->children;
+  frame->node->self += elapsed - frame->children;
+  entry->allocations += allocations;
+
+  if (frames_count) {
+    frames[frames_count - 1].children += elapsed;
+    frames[frames_count - 1].allocations += allocations;
+  }
+}
+
+size_t profile_depth() {
+  return frames_count;
+}
+
+void profile_unwind(size_t depth) {
+  while (frames_count > depth)
+    profile_exit();
+}
+
+/* anything never bound by set is labelled with its lambda list */
+static void name_entries() {
+  lisp_object_t *env = get_global_environment();
+
+  for (; env && env != NIL; env = CONS_VALUE(env)->cdr) {
+    lisp_object_t *binding = CONS_VALUE(env)->car;
+    lisp_object_t *value = CONS_VALUE(binding)->cdr;
+
+    if (value->type != LAMBDA && value->type != MACRO && value->type != NATIVE_FUNCTION)
+      continue;
+
+    for (size_t i = 0; i < entries_capacity; i++) {
+      if (entries[i] && !entries[i]->name && entries[i]->key == entry_key(value))
+        entries[i]->name = strdup(CONS_VALUE(binding)->car->datum.symbol);
+    }
+  }
+
+  for (size_t i = 0; i < entries_capacity; i++) {
+    profile_entry_t *entry = entries[i];
+
+    if (!entry || entry->name)
+      continue;
+
+    if (entry->key->type == CONS && entry->key != NIL) {
+      lisp_writer_t writer;
+      init_string_writer(&writer);
+      writer_puts(&writer, CONS_VALUE(entry->key)->car->datum.symbol);
+      writer_write(&writer, " ", 1);
+
+      if (CONS_VALUE(entry->key)->cdr->type == CONS && CONS_VALUE(entry->key)->cdr != NIL)
+        write_object(&writer, CONS_VALUE(CONS_VALUE(entry->key)->cdr)->car);
+
+      entry->name = writer_finish(&writer);
+    } else {
+      entry->name = strdup("<anonymous>");
+    }
+  }
+}
+
+static int compare_exclusive(const void *a, const void *b) {
+  double difference = (*(profile_entry_t**) b)->exclusive - (*(profile_entry_t**) a)->exclusive;
+
+  return (difference > 0) - (difference < 0);
+}
+
+void profile_report(FILE *out) {
+  profile_entry_t **sorted = xmalloc((entries_count + 1) * sizeof(profile_entry_t*));
+  size_t count = 0;
+
+  name_entries();
+
+  for (size_t i = 0; i < entries_capacity; i++) {
+    if (entries[i])
+      sorted[count++] = entries[i];
+  }
+
+  qsort(sorted, count, sizeof(profile_entry_t*), compare_exclusive);
+
+  fprintf(out, "%10s %12s %12s %12s  %s\n", "calls", "incl ms", "excl ms", "self allocs", "function");
+
+  for (size_t i = 0; i < count; i++) {
+    fprintf(out, "%10zu %12.3f %12.3f %12zu  %s%s\n", sorted[i]->calls,
+            sorted[i]->inclusive * 1000, sorted[i]->exclusive * 1000,
+            sorted[i]->allocations, sorted[i]->macro ? "[macro] " : "",
+            sorted[i]->name);
+  }
+
+  free(sorted);
+}
+
+static int compare_allocations(const void *a, const void *b) {
+  size_t x = (*(profile_entry_t**) a)->allocations;
+  size_t y = (*(profile_entry_t**) b)->allocations;
+
+  return (x < y) - (x > y);
+}
+
+lisp_object_t* profile_allocation_sites() {
+  profile_entry_t **sorted = xmalloc((entries_count + 1) * sizeof(profile_entry_t*));
+  size_t count = 0;
+
+  name_entries();
+
+  for (size_t i = 0; i < entries_capacity; i++) {
+    if (entries[i] && entries[i]->allocations)
+      sorted[count++] = entries[i];
+  }
+
+  qsort(sorted, count, sizeof(profile_entry_t*), compare_allocations);
+
+  /* built back to front so the list comes out in sorted order */
+  lisp_object_t *sites = NIL;
+
+  while (count--) {
+    lisp_object_t *site = make_cons(make_string(strdup(sorted[count]->name)),
+                                    make_number(sorted[count]->allocations));
+    sites = make_cons(site, sites);
+  }
+
+  free(sorted);
+
+  return sites;
+}
+
+static void write_stack(FILE *out, profile_node_t *node) {
+  if (node->parent != &root_node) {
+    write_stack(out, node->parent);
+    fputc(';', out);
+  }
+
+  if (node->entry->macro)
+    fputs("[macro] ", out);
+
+  /* ';' separates frames in the collapsed format */
+  for (char *c = node->entry->name; *c; c++)
+    fputc(*c == ';' || *c == '\n' ? '_' : *c, out);
+}
+
+static void write_nodes(FILE *out, profile_node_t *node) {
+  for (; node; node = node->next_sibling) {
+    long microseconds = (long) (node->self * 1e6);
+
+    if (microseconds > 0) {
+      write_stack(out, node);
+      fprintf(out, " %ld\n", microseconds);
+    }
+
+    write_nodes(out, node->children);
+  }
+}
+
+int profile_write_collapsed(const char *path) {
+  FILE *out = fopen(path, "w");
+
+  if (!out) {
+    fprintf(stderr, "Error: unable to open profile output: \"%s\"\n", path);
+    return -1;
+  }
+
+  name_entries();
+  write_nodes(out, root_node.children);
+
+  return fclose(out);
+}
+
+void profile_mark_roots(void (*mark)(lisp_object_t *object)) {
+  for (size_t i = 0; i < entries_capacity; i++) {
+    if (entries[i])
+      mark(entries[i]->key);
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include "lisp.h"
+
+/* Non-zero while the profiler is recording in this thread. Checked on
+   every call, so it's a plain variable rather than a function. */
+extern LISP_THREAD_LOCAL int profile_enabled;
+
+/* Discards any previous data and starts recording */
+void profile_start();
+
+/* Stops recording; the data is kept for reporting */
+void profile_stop();
+
+/* Records entry into f. Macro expansions are counted separately from
+ * calls. Every profile_enter() must be matched by a profile_exit().
+ */
+void profile_enter(lisp_object_t *f, int macro_expansion);
+
+void profile_exit();
+
+/* The number of profile_enter()s not yet exited */
+size_t profile_depth();
+
+/* Exits frames until only depth are left, after a non-local exit */
+void profile_unwind(size_t depth);
+
+/* Remembers symbol as the name of function, for the report */
+void profile_name_function(lisp_object_t *function, lisp_object_t *symbol);
+
+/* Writes a table of calls, inclusive and exclusive time, and allocations
+ * per function, sorted by exclusive time.
+ */
+void profile_report(FILE *out);
+
+/* Returns ((name . allocations) ...) for every function that allocated
+ * while the profiler was recording, the heaviest allocator first.
+ */
+lisp_object_t* profile_allocation_sites();
+
+/* Writes the call tree as collapsed stacks ("a;b;c microseconds"), the
+ * input format of flamegraph.pl and friends. Returns 0 on success.
+ */
+int profile_write_collapsed(const char *path);
+
+/* Marks everything the profiler refers to, so it survives collection */
+void profile_mark_roots(void (*mark)(lisp_object_t *object));
+
+#endif
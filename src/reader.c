@@ -1,302 +1,496 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "lisp.h"
 #include "reader.h"
 
-enum read_condition read_flag = 0;
+#define NO_MARK ((size_t) -1)
+#define READER_BUFFER_SIZE 4096
+
+static int fill(lisp_reader_t *reader);
+static int peek_char(lisp_reader_t *reader);
+static int next_char(lisp_reader_t *reader);
+static void skip_whitespace(lisp_reader_t *reader);
+static void reader_error(lisp_reader_t *reader, const char *message);
+
+static lisp_object_t *read_string(lisp_reader_t *reader);
+static lisp_object_t *read_atom(lisp_reader_t *reader);
+static lisp_object_t *read_list(lisp_reader_t *reader);
+static lisp_object_t *read_prefixed(lisp_reader_t *reader, char *symbol_name);
+
+static void clear_rest_of_list(lisp_reader_t *reader, int num_open_parens);
+
+lisp_reader_t* make_file_reader(FILE *file) {
+  lisp_reader_t *reader = xmalloc(sizeof(lisp_reader_t));
+
+  reader->file = file;
+  reader->capacity = READER_BUFFER_SIZE;
+  reader->buffer = xmalloc(reader->capacity);
+  reader->position = 0;
+  reader->limit = 0;
+  reader->mark = NO_MARK;
+  reader->line = 1;
+  reader->column = 1;
+  reader->condition = 0;
+  reader->error = NULL;
+  reader->error_line = 0;
+  reader->error_column = 0;
+  reader->fd = -1;
+  reader->mapping = NULL;
+  reader->mapping_size = 0;
+
+  return reader;
+}
 
-extern int yylex();
+lisp_reader_t* make_memory_reader(const char *data, size_t length) {
+  lisp_reader_t *reader = xmalloc(sizeof(lisp_reader_t));
+
+  reader->file = NULL;
+  reader->buffer = (char*) data;
+  reader->capacity = length;
+  reader->position = 0;
+  reader->limit = length;
+  reader->mark = NO_MARK;
+  reader->line = 1;
+  reader->column = 1;
+  reader->condition = 0;
+  reader->error = NULL;
+  reader->error_line = 0;
+  reader->error_column = 0;
+  reader->fd = -1;
+  reader->mapping = NULL;
+  reader->mapping_size = 0;
+
+  return reader;
+}
 
-extern FILE *yyin;
-extern char *yytext;
-extern int yyleng;
+lisp_reader_t* open_file_reader(const char *path) {
+  int fd = open(path, O_RDONLY);
+  struct stat file_stat;
 
-extern void my_savior(int c, char *yytexptr);
-extern void switch_buffer(FILE *file);
+  if (fd < 0)
+    return NULL;
+
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return NULL;
+  }
 
-extern lisp_object_t *NIL;
-extern lisp_object_t *T;
+  size_t size = file_stat.st_size;
+  void *mapping = MAP_FAILED;
+  lisp_reader_t *reader = NULL;
 
-static lisp_object_t *read_string();
-static lisp_object_t *read_double();
-static lisp_object_t *read_symbol();
-static lisp_object_t *read_cons(FILE *file);
-static lisp_object_t *read_quoted(FILE *file);
-static lisp_object_t *read_backquote(FILE *file);
-static lisp_object_t *read_comma(FILE *file);
-static lisp_object_t *read_comma_at(FILE *file);
+  if (S_ISREG(file_stat.st_mode) && size > 0)
+    mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-static void clear_rest_of_list(int num_open_parens);
+  if (mapping != MAP_FAILED) {
+    posix_madvise(mapping, size, POSIX_MADV_SEQUENTIAL);
+    reader = make_memory_reader(mapping, size);
+    reader->mapping = mapping;
+    reader->mapping_size = size;
+  } else if (size > 0 || !S_ISREG(file_stat.st_mode)) {
+    /* pipes and friends can't be mapped */
+    FILE *file = fdopen(fd, "r");
 
-lisp_object_t* read_object(FILE *input, char *prompt) {
-  static FILE *in = NULL;
-  read_flag = 0;
+    if (!file) {
+      close(fd);
+      return NULL;
+    }
 
-  if (in != input) {
-    switch_buffer(input);
-    in = input;
+    reader = make_file_reader(file);
+  } else {
+    reader = make_memory_reader("", 0);
   }
 
-  if (prompt != NULL)
-    printf("%s", prompt);
+  reader->fd = fd;
 
-  enum token next_token = yylex();
+  return reader;
+}
 
-  switch(next_token) {
+void close_reader(lisp_reader_t *reader) {
+  if (reader->mapping)
+    munmap(reader->mapping, reader->mapping_size);
 
-  case TOKEN_QUOTE:
-    return read_string();
+  if (reader->file)
+    fclose(reader->file);
+  else if (reader->fd >= 0)
+    close(reader->fd);
 
-  case TOKEN_NUMBER:
-    return read_double();
+  free_reader(reader);
+}
 
-  case TOKEN_SYMBOL:
-    return read_symbol();
+void free_reader(lisp_reader_t *reader) {
+  /* memory readers borrow their buffer */
+  if (reader->file)
+    free(reader->buffer);
 
-  case TOKEN_LEFT_PAREN:
-    return read_cons(input);
+  free(reader);
+}
 
-  case TOKEN_EOF:
-    read_flag = READ_EOF;
-    return NULL;
+lisp_object_t* read_form(lisp_reader_t *reader) {
+  reader->condition = 0;
+  skip_whitespace(reader);
+
+  int c = next_char(reader);
 
-  case TOKEN_RIGHT_PAREN:
-    read_flag = READ_UNBALANCED_PAREN;
+  switch (c) {
+
+  case EOF:
+    reader->condition = READ_EOF;
     return NULL;
 
-  case TOKEN_SINGLE_QUOTE:
-    return read_quoted(input);
+  case '(':
+    return read_list(reader);
 
-  case TOKEN_DOT:
-    read_flag = READ_DOT;
+  case ')':
+    reader->condition = READ_UNBALANCED_PAREN;
     return NULL;
 
-  case TOKEN_BACKQUOTE:
-    return read_backquote(input);
+  case '"':
+    return read_string(reader);
+
+  case '\'':
+    return read_prefixed(reader, "quote");
 
-  case TOKEN_COMMA:
-    return read_comma(input);
+  case '`':
+    return read_prefixed(reader, "backquote");
+
+  case ',':
+    if (peek_char(reader) == '@') {
+      next_char(reader);
+      return read_prefixed(reader, "comma-at");
+    }
 
-  case TOKEN_COMMA_AT:
-    return read_comma_at(input);
+    return read_prefixed(reader, "comma");
+
+  case '@':
+    reader_error(reader, "unexpected '@'");
+    return NULL;
 
   default:
-    break;
+    /* the atom starts with the character we just consumed */
+    reader->mark = reader->position - 1;
+    return read_atom(reader);
   }
-
-  return NIL;
 }
 
-static lisp_object_t* read_quoted(FILE *file) {
-  lisp_object_t *quote_symbol = make_lisp_object();
-  quote_symbol->type = SYMBOL;
-  quote_symbol->datum.symbol = strdup("quote");
+/* Reads more input into the buffer, sliding any token in progress to the
+   front first. Returns 0 once the input is exhausted. */
+static int fill(lisp_reader_t *reader) {
+  if (reader->file == NULL)
+    return 0;
 
-  lisp_object_t *quote_object = read_object(file, NULL);
+  size_t keep = (reader->mark == NO_MARK) ? reader->position : reader->mark;
+  size_t kept = reader->limit - keep;
 
-  return make_cons(quote_symbol, make_cons(quote_object, NIL));
-}
+  memmove(reader->buffer, reader->buffer + keep, kept);
+  reader->limit = kept;
+  reader->position -= keep;
 
-static lisp_object_t* read_string() {
-  lisp_object_t *string = make_lisp_object();
-  char *target_str = malloc(yyleng);
-  char *target_ptr = target_str;
-  char *ptr = yytext;
+  if (reader->mark != NO_MARK)
+    reader->mark = 0;
 
-  ptr++;
+  if (reader->capacity - reader->limit < 2) {
+    reader->capacity *= 2;
+    reader->buffer = realloc(reader->buffer, reader->capacity);
 
-  while (*ptr) {
-    if (*ptr == '\\' && *(ptr + 1) == '"') {
-      ptr += 2;
-      *target_ptr = '"';
-      target_ptr++;
-      continue;
-    } else if (*ptr == '\\' && *(ptr + 1) == 'n') {
-      ptr += 2;
-      *target_ptr = '\n';
-      target_ptr++;
-      continue;
-    } else if (*ptr == '"') {
-      break;
+    if (!reader->buffer) {
+      fprintf(stderr, "Error: out of memory.\n");
+      exit(1);
     }
-
-    *target_ptr = *ptr;
-    target_ptr++;
-    ptr++;
   }
-  *target_ptr = 0;
 
-  string->type = STRING;
-  string->datum.string = target_str;
+  /* line at a time, so an interactive reader never blocks on a full buffer */
+  if (!fgets(reader->buffer + reader->limit, reader->capacity - reader->limit,
+             reader->file))
+    return 0;
 
-  return string;
-}
+  reader->limit += strlen(reader->buffer + reader->limit);
 
-static lisp_object_t* read_double() {
-  lisp_object_t *double_o = make_lisp_object();
+  return 1;
+}
 
-  double_o->type = NUMBER;
-  double_o->datum.number = atof(yytext);
+static int peek_char(lisp_reader_t *reader) {
+  while (reader->position == reader->limit) {
+    if (!fill(reader))
+      return EOF;
+  }
 
-  return double_o;
+  return (unsigned char) reader->buffer[reader->position];
 }
 
-static lisp_object_t* read_symbol() {
-  lisp_object_t *symbol_o = make_lisp_object();
-  char *symbol_contents = malloc(yyleng + 1);
+static int next_char(lisp_reader_t *reader) {
+  int c = peek_char(reader);
 
-  symbol_o->type = SYMBOL;
-  strncpy(symbol_contents, yytext, yyleng);
-  symbol_contents[yyleng] = 0;
+  if (c == EOF)
+    return EOF;
 
-  symbol_o->datum.symbol = symbol_contents;
+  reader->position++;
 
-  /* we have a wasteful alloc going on here, but it works (for now) */
-  if (!strcmp(symbol_contents, "nil"))
-    return NIL;
+  if (c == '\n') {
+    reader->line++;
+    reader->column = 1;
+  } else {
+    reader->column++;
+  }
 
-  return symbol_o;
+  return c;
 }
 
-static lisp_object_t* read_cons(FILE *file) {
-  lisp_object_t *cons_o = make_cons(NULL, NULL); /* we can clean this up, maybe. */
-  lisp_object_t *next_cons = cons_o;
-  lisp_object_t **next_cons_ref = &cons_o;
+static int is_delimiter(int c) {
+  switch (c) {
 
-  int num_parens = 1;
+  case EOF: case 0:
+  case ' ': case '\t': case '\n': case '\r':
+  case '"': case '\'': case '`': case ';':
+  case '(': case ')': case ',': case '@':
+    return 1;
 
-  while (num_parens) {
-    enum token next_token = yylex();
+  default:
+    return 0;
+  }
+}
 
-    if (next_token == TOKEN_RIGHT_PAREN) {
-      --num_parens;
-      continue;
-    } else if (next_token == TOKEN_EOF) {
-      fprintf(stderr, "Error: encountered unexpected EOF.\n");
-      exit(1);
+static void skip_whitespace(lisp_reader_t *reader) {
+  int c;
+
+  while ((c = peek_char(reader)) != EOF) {
+    if (c == ';') {
+      while ((c = next_char(reader)) != EOF && c != '\n')
+        ;
+    } else if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      next_char(reader);
+    } else {
+      break;
     }
+  }
+}
 
-    char *yycopy = strdup(yytext);
-    for (int i = yyleng - 1; i >= 0; --i) {
-      my_savior(yycopy[i], yytext);
+static void reader_error(lisp_reader_t *reader, const char *message) {
+  reader->error = message;
+  reader->error_line = reader->line;
+  reader->error_column = reader->column;
+  reader->condition = READ_ERROR;
+}
+
+static lisp_object_t* read_prefixed(lisp_reader_t *reader, char *symbol_name) {
+  lisp_object_t *object = read_form(reader);
+
+  if (object == NULL) {
+    if (reader->condition == READ_EOF) {
+      reader_error(reader, "unexpected EOF");
+      reader->condition = READ_TRUNCATED;
+    } else if (reader->condition != READ_ERROR && reader->condition != READ_TRUNCATED) {
+      reader_error(reader, "expected an object to follow a reader macro");
     }
-    free(yycopy);
 
-    lisp_object_t *next_object = read_object(file, NULL);
+    return NULL;
+  }
 
-    /* handles improper lists */
-    if (read_flag == READ_DOT) {
-      if (CONS_VALUE(cons_o)->car == NULL) {
-        fprintf(stderr, "Error: invalid usage of '.'.\n");
-        return NULL;
-      }
+  return make_cons(intern(symbol_name, strlen(symbol_name)),
+                   make_cons(object, NIL));
+}
 
-      next_object = read_object(file, NULL);
-      if (next_object == NULL) {
-        return NULL;            /* some other help message should be printed */
-      }
-      *next_cons_ref = next_object;
-      
-      next_token = yylex();
-
-      /* make sure the last element of the list is actually the last! */
-      if (next_token != TOKEN_RIGHT_PAREN && next_token != TOKEN_EOF) {
-        clear_rest_of_list(num_parens);
-        fprintf(stderr, "Error: invalid usage of '.'.\n");
-        return NULL;
-      } else if (next_token == TOKEN_EOF) {
-        fprintf(stderr, "Error: unexpected EOF.\n");
-        read_flag = READ_EOF;
-        return NULL;
-      }
+static lisp_object_t* read_string(lisp_reader_t *reader) {
+  int c;
 
-      return cons_o;
-    }
+  reader->mark = reader->position;
 
-    if (!next_object) {
-      fprintf(stderr, "Error: read_object() returned an unexpected NULL pointer.\n");
+  while ((c = next_char(reader)) != '"') {
+    if (c == EOF) {
+      reader->mark = NO_MARK;
+      reader_error(reader, "unterminated string");
+      reader->condition = READ_TRUNCATED;
       return NULL;
+    } else if (c == '\\' && next_char(reader) == EOF) {
+      continue;
     }
+  }
 
-    ((cons*) next_cons->datum.cons)->car = next_object;
-    ((cons*) next_cons->datum.cons)->cdr = make_cons(NULL, NULL);
+  /* everything between the quotes, then strip the escapes */
+  char *ptr = reader->buffer + reader->mark;
+  char *end = reader->buffer + reader->position - 1;
+  char *target_str = xmalloc(end - ptr + 1);
+  char *target_ptr = target_str;
 
-    next_cons_ref = &(((cons*) next_cons->datum.cons)->cdr);
-    next_cons = ((cons*) next_cons->datum.cons)->cdr;
-  }
+  while (ptr < end) {
+    if (*ptr == '\\' && ptr + 1 < end) {
+      if (*(ptr + 1) == '"' || *(ptr + 1) == '\\') {
+        *target_ptr++ = *(ptr + 1);
+        ptr += 2;
+        continue;
+      } else if (*(ptr + 1) == 'n') {
+        *target_ptr++ = '\n';
+        ptr += 2;
+        continue;
+      }
+    }
 
-  if (((cons*) next_cons->datum.cons)->car == NULL &&
-      ((cons*) next_cons->datum.cons)->cdr == NULL)
-    *next_cons_ref = NIL;
+    *target_ptr++ = *ptr++;
+  }
+  *target_ptr = 0;
+  reader->mark = NO_MARK;
 
-  return cons_o;
+  return make_string(target_str);
 }
 
-static void clear_rest_of_list(int num_open_parens) {
-  int num_parens = num_open_parens;
+/* NUMBER is -?[0-9]+\.?[0-9]* -- anything else is a symbol */
+static int is_number(const char *text, size_t length) {
+  size_t i = 0;
 
-  while (num_parens) {
-    enum token next_token = yylex();
+  if (i < length && text[i] == '-')
+    i++;
 
-    if (next_token == TOKEN_LEFT_PAREN)
-      ++num_parens;
-    else if (next_token == TOKEN_RIGHT_PAREN)
-      --num_parens;
-  }
+  if (i == length || text[i] < '0' || text[i] > '9')
+    return 0;
+
+  while (i < length && text[i] >= '0' && text[i] <= '9')
+    i++;
+
+  if (i < length && text[i] == '.')
+    i++;
+
+  while (i < length && text[i] >= '0' && text[i] <= '9')
+    i++;
+
+  return i == length;
 }
 
-static lisp_object_t *read_backquote(FILE *file) {
-  lisp_object_t *backquote = make_lisp_object();
-  lisp_object_t *backquoted_object = NULL;
-  lisp_object_t *next_object = NULL;
-  
-  backquote->type = SYMBOL;
-  backquote->datum.symbol = strdup("backquote");
+static double parse_number(const char *text, size_t length) {
+  char digits[64];
+  char *copy = (length < sizeof(digits)) ? digits : xmalloc(length + 1);
 
-  next_object = read_object(file, NULL);
+  memcpy(copy, text, length);
+  copy[length] = 0;
 
-  if (next_object != NULL) {
-    backquoted_object = make_cons(backquote,
-                                  make_cons(next_object, NIL));
-  }
+  double value = strtod(copy, NULL);
 
-  return backquoted_object;
+  if (copy != digits)
+    free(copy);
+
+  return value;
 }
 
-static lisp_object_t *read_comma(FILE *file) {
-  lisp_object_t *comma = make_lisp_object();
-  lisp_object_t *comma_object = NULL;
-  lisp_object_t *next_object = NULL;
-  
-  comma->type = SYMBOL;
-  comma->datum.symbol = strdup("comma");
+static lisp_object_t* read_atom(lisp_reader_t *reader) {
+  while (!is_delimiter(peek_char(reader)))
+    next_char(reader);
 
-  next_object = read_object(file, NULL);
+  /* the token is read straight out of the input buffer */
+  char *text = reader->buffer + reader->mark;
+  size_t length = reader->position - reader->mark;
+  reader->mark = NO_MARK;
 
-  if (next_object != NULL) {
-    comma_object = make_cons(comma,
-                          make_cons(next_object, NIL));
+  if (length == 1 && text[0] == '.') {
+    reader->condition = READ_DOT;
+    return NULL;
   }
 
-  return comma_object;
+  if (is_number(text, length))
+    return make_number(parse_number(text, length));
+
+  if (length == 3 && !strncmp(text, "nil", 3))
+    return NIL;
+
+  return intern(text, length);
 }
 
-static lisp_object_t *read_comma_at(FILE *file) {
-  lisp_object_t *comma_at = make_lisp_object();
-  lisp_object_t *comma_at_object = NULL;
-  lisp_object_t *next_object = NULL;
-  
-  comma_at->type = SYMBOL;
-  comma_at->datum.symbol = strdup("comma-at");
+static lisp_object_t* read_list(lisp_reader_t *reader) {
+  lisp_object_t *list = NIL;
+  lisp_object_t **tail = &list;
+
+  while (1) {
+    skip_whitespace(reader);
 
-  next_object = read_object(file, NULL);
+    int c = peek_char(reader);
+
+    if (c == EOF) {
+      reader_error(reader, "unexpected EOF");
+      reader->condition = READ_TRUNCATED;
+      return NULL;
+    } else if (c == ')') {
+      next_char(reader);
+      return list;
+    }
 
-  if (next_object != NULL) {
-    comma_at_object = make_cons(comma_at,
-                             make_cons(next_object, NIL));
+    lisp_object_t *next_object = read_form(reader);
+
+    if (next_object != NULL) {
+      lisp_object_t *cell = make_cons(next_object, NIL);
+      *tail = cell;
+      tail = &CONS_VALUE(cell)->cdr;
+      continue;
+    }
+
+    if (reader->condition != READ_DOT)
+      return NULL;
+
+    /* handles improper lists */
+    if (list == NIL) {
+      reader_error(reader, "invalid usage of '.'");
+      clear_rest_of_list(reader, 1);
+      return NULL;
+    }
+
+    next_object = read_form(reader);
+
+    if (next_object == NULL) {
+      if (reader->condition == READ_UNBALANCED_PAREN) {
+        reader_error(reader, "invalid usage of '.'");
+      } else if (reader->condition == READ_DOT) {
+        reader_error(reader, "invalid usage of '.'");
+        clear_rest_of_list(reader, 1);
+      } else if (reader->condition == READ_EOF) {
+        reader_error(reader, "unexpected EOF");
+        reader->condition = READ_TRUNCATED;
+      }
+
+      return NULL;
+    }
+    *tail = next_object;
+
+    /* make sure the last element of the list is actually the last! */
+    skip_whitespace(reader);
+    c = peek_char(reader);
+
+    if (c == ')') {
+      next_char(reader);
+      return list;
+    } else if (c == EOF) {
+      reader_error(reader, "unexpected EOF");
+      reader->condition = READ_TRUNCATED;
+      return NULL;
+    }
+
+    reader_error(reader, "invalid usage of '.'");
+    clear_rest_of_list(reader, 1);
+    return NULL;
   }
+}
 
-  return comma_at_object;
+static void clear_rest_of_list(lisp_reader_t *reader, int num_open_parens) {
+  int num_parens = num_open_parens;
+  int c;
+
+  while (num_parens && (c = next_char(reader)) != EOF) {
+    if (c == '(') {
+      ++num_parens;
+    } else if (c == ')') {
+      --num_parens;
+    } else if (c == ';') {
+      while ((c = next_char(reader)) != EOF && c != '\n')
+        ;
+    } else if (c == '"') {
+      while ((c = next_char(reader)) != EOF && c != '"') {
+        if (c == '\\')
+          next_char(reader);
+      }
+    }
+  }
 }
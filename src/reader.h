@@ -4,13 +4,59 @@
 #include <stdio.h>
 #include "lisp.h"
 
-enum token {TOKEN_NUMBER, TOKEN_SYMBOL, TOKEN_QUOTE,
-            TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN, TOKEN_EOF,
-            TOKEN_SINGLE_QUOTE, TOKEN_DOT, TOKEN_COMMA,
-            TOKEN_COMMA_AT, TOKEN_BACKQUOTE};
+/* READ_TRUNCATED is the input ending partway through a form, unlike
+   READ_EOF which only ever happens between forms */
+enum read_condition {READ_EOF = 1, READ_UNBALANCED_PAREN, READ_DOT, READ_ERROR, READ_TRUNCATED};
 
-enum read_condition {READ_EOF = 1, READ_UNBALANCED_PAREN, READ_DOT};
+/* Reader state for a single input source. Characters are scanned in place
+ * out of buffer; tokens that straddle a refill are kept intact by sliding
+ * them to the front of the buffer before reading more input.
+ */
+typedef struct lisp_reader {
+  FILE *file;
+  char *buffer;
+  size_t capacity;
+  size_t position;              /* next unread character */
+  size_t limit;                 /* one past the last valid character */
+  size_t mark;                  /* start of the token being scanned */
+  int line;
+  int column;
+  enum read_condition condition;
 
-lisp_object_t* read_object(FILE *input, char *prompt);
+  /* what went wrong and where, for READ_ERROR and READ_TRUNCATED */
+  const char *error;
+  int error_line;
+  int error_column;
+
+  /* set for readers that own their input, see open_file_reader() */
+  int fd;
+  void *mapping;
+  size_t mapping_size;
+} lisp_reader_t;
+
+/* Returns a reader that pulls its input from file */
+lisp_reader_t* make_file_reader(FILE *file);
+
+/* Returns a reader over length bytes at data, which must outlive it.
+ * Tokens are scanned directly out of data without copying.
+ */
+lisp_reader_t* make_memory_reader(const char *data, size_t length);
+
+/* Opens path for reading, mapping it into memory when possible. NULL is
+ * returned if the file can't be opened.
+ */
+lisp_reader_t* open_file_reader(const char *path);
+
+/* Releases the reader (but does not close its file or unmap its data) */
+void free_reader(lisp_reader_t *reader);
+
+/* Releases a reader from open_file_reader(), closing its input */
+void close_reader(lisp_reader_t *reader);
+
+/* Reads the next form. NULL is returned on EOF or error, in which case
+ * reader->condition says why. Nothing is printed; reporting the error is
+ * up to the caller.
+ */
+lisp_object_t* read_form(lisp_reader_t *reader);
 
 #endif
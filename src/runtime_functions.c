@@ -1,35 +1,45 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include "lisp.h"
 #include "reader.h"
+#include "image.h"
+#include "profile.h"
+#include "parallel.h"
+#include "green.h"
+#include "io.h"
+#include "ffi.h"
+#include "vectors.h"
+#include "sort.h"
 #include "runtime_functions.h"
 
-extern lisp_object_t *NIL;
-extern lisp_object_t *T;
-
 /* TODO: add checks to make sure that the actual length of these arg 
    lists is actually correct. 
    Currently we ignore unnecessary arguments (which is bad.)
 */
 
 static int arg_length(lisp_object_t *args) {
-  lisp_object_t *arglen = length(make_cons(args, NIL));
+  int length = 0;
 
-  /* handles errors */
-  if (arglen == NULL || arglen == NIL)
-    return 0;
+  for (; args != NIL && args->type == CONS; args = CONS_VALUE(args)->cdr)
+    length++;
 
-  return (int) (arglen->datum.number);
+  return length;
+}
+
+static int functionp(lisp_object_t *f) {
+  return f->type == LAMBDA || f->type == NATIVE_FUNCTION || f->type == HOST_FUNCTION
+    || f->type == CONTINUATION;
 }
 
 lisp_object_t* quote_func(lisp_object_t *args) {
   int num_args = arg_length(args);
 
-  if (num_args != 1) {
-    fprintf(stderr, "Error: quote requires 1 arguments.\n");
-    return NIL;
-  }
+  if (num_args != 1)
+    return lisp_error("quote requires 1 arguments.");
 
   return CONS_VALUE(args)->car;
 }
@@ -37,10 +47,8 @@ lisp_object_t* quote_func(lisp_object_t *args) {
 lisp_object_t* cons_func(lisp_object_t *args) {
   int num_args = arg_length(args);
 
-  if (num_args != 2) {
-    fprintf(stderr, "Error: cons requires 2 arguments.\n");
-    return NIL;
-  }
+  if (num_args != 2)
+    return lisp_error("cons requires 2 arguments.");
 
   lisp_object_t *car = CONS_VALUE(args)->car;
   lisp_object_t *cadr = CONS_VALUE(CONS_VALUE(args)->cdr)->car;
@@ -51,17 +59,13 @@ lisp_object_t* cons_func(lisp_object_t *args) {
 lisp_object_t* car_func(lisp_object_t *args) {
   int num_args = arg_length(args);
 
-  if (num_args != 1) {
-    fprintf(stderr, "Error: car requires 1 arguments.\n");
-    return NIL;
-  }
+  if (num_args != 1)
+    return lisp_error("car requires 1 arguments.");
 
   lisp_object_t *car = CONS_VALUE(args)->car;
 
-  if (car->type != CONS) {
-    fprintf(stderr, "Error: car defined on CONS.\n");
-    return NULL;
-  }
+  if (car->type != CONS)
+    return lisp_error("car defined on CONS.");
 
   if (car == NIL)
     return NIL;
@@ -72,17 +76,13 @@ lisp_object_t* car_func(lisp_object_t *args) {
 lisp_object_t* cdr_func(lisp_object_t *args) {
   int num_args = arg_length(args);
 
-  if (num_args != 1) {
-    fprintf(stderr, "Error: cdr requires 1 arguments.\n");
-    return NIL;
-  }
+  if (num_args != 1)
+    return lisp_error("cdr requires 1 arguments.");
 
   lisp_object_t *car = CONS_VALUE(args)->car;
 
-  if (car->type != CONS) {
-    fprintf(stderr, "Error: cdr defined on CONS.\n");
-    return NULL;
-  }
+  if (car->type != CONS)
+    return lisp_error("cdr defined on CONS.");
 
   if (car == NIL)
     return NIL;
@@ -92,24 +92,19 @@ lisp_object_t* cdr_func(lisp_object_t *args) {
 
 lisp_object_t* set_func(lisp_object_t *expression, lisp_object_t *environment) {
   if (CONS_VALUE(expression)->cdr == NIL) {
-    fprintf(stderr, "Error: set requires 2 arguments, but received 0.\n");
-    return NULL;
+    return lisp_error("set requires 2 arguments, but received 0.");
   } else if (CONS_VALUE(CONS_VALUE(expression)->cdr)->cdr == NIL) {
-    fprintf(stderr, "Error: set requires 2 arguments, but received 1.\n");
-    return NULL;
+    return lisp_error("set requires 2 arguments, but received 1.");
   }
   lisp_object_t *symbol_value = eval(CONS_VALUE(CONS_VALUE(expression)->cdr)->car,
                                      environment);
-
-  if (!symbol_value)
-    return NULL;
-      
   lisp_object_t *bind_value = eval(CONS_VALUE(CONS_VALUE(CONS_VALUE(expression)->cdr)->cdr)->car,
                                    environment);
 
-  if (!bind_value)
-    return NULL;
+  if (profile_enabled)
+    profile_name_function(bind_value, symbol_value);
 
+  lisp_object_t *super_env_symbol = get_super_env_symbol();
   lisp_object_t *lex_e = environment;
   while (lex_e) {
     lisp_object_t *it = lex_e;
@@ -117,11 +112,11 @@ lisp_object_t* set_func(lisp_object_t *expression, lisp_object_t *environment) {
     char cont = 1;
 
     while (it != NIL && it->type == CONS) {
-      if (strcmp(symbol_value->datum.symbol, CONS_VALUE(CONS_VALUE(it)->car)->car->datum.symbol) == 0) {
+      if (CONS_VALUE(CONS_VALUE(it)->car)->car == symbol_value) {
         CONS_VALUE(CONS_VALUE(it)->car)->cdr = bind_value;
         cont = 0;
         break;
-      } else if (strcmp("*lisp-super-env*", CONS_VALUE(CONS_VALUE(it)->car)->car->datum.symbol) == 0) {
+      } else if (CONS_VALUE(CONS_VALUE(it)->car)->car == super_env_symbol) {
         next = CONS_VALUE(CONS_VALUE(it)->car)->cdr;
       }
 
@@ -144,21 +139,17 @@ lisp_object_t* if_func(lisp_object_t *args, lisp_object_t *environment) {
   int num_args = arg_length(args);
 
   if (num_args < 2) {
-    fprintf(stderr, "Error: if requires at least 2 arguments.\n");
-    return NIL;
+    return lisp_error("if requires at least 2 arguments.");
   } else if (num_args > 3) {
-    fprintf(stderr, "Error: if accepts no more than 3 arguments.\n");
-    return NIL;
+    return lisp_error("if accepts no more than 3 arguments.");
   }
 
   lisp_object_t *antecedent = CONS_VALUE(args)->car;
   
   if (CONS_VALUE(args)->cdr == NIL) {
-    fprintf(stderr, "Error: if requires at least 2 arguments, but received 1.\n");
-    return NULL;
+    return lisp_error("if requires at least 2 arguments, but received 1.");
   } else if (CONS_VALUE(args)->cdr->type != CONS) {
-    fprintf(stderr, "Error: if syntax.\n");
-    return NULL;
+    return lisp_error("if syntax.");
   }
 
   lisp_object_t *consequent = CONS_VALUE(CONS_VALUE(args)->cdr)->car;
@@ -168,17 +159,11 @@ lisp_object_t* if_func(lisp_object_t *args, lisp_object_t *environment) {
     if (CONS_VALUE(CONS_VALUE(args)->cdr)->cdr->type == CONS) {
       otherwise = CONS_VALUE(CONS_VALUE(CONS_VALUE(args)->cdr)->cdr)->car;
     } else {
-      fprintf(stderr, "Error: if syntax.\n");
-      return NULL;
+      return lisp_error("if syntax.");
     }
   }
 
-  lisp_object_t *result = eval(antecedent, environment);
-
-  if (!result)
-    return NULL;
-
-  if (result != NIL) {
+  if (eval(antecedent, environment) != NIL) {
     return eval(consequent, environment);
   } else {
     return eval(otherwise, environment);
@@ -208,11 +193,9 @@ lisp_object_t* list(lisp_object_t *args) {
 
 lisp_object_t* length(lisp_object_t *args) {
   if (args == NIL) {
-    fprintf(stderr, "Error: length requires 1 argument, but was supplied 0.\n");
-    return NIL;
+    return lisp_error("length requires 1 argument, but was supplied 0.");
   } else if (CONS_VALUE(args)->cdr != NIL) {
-    fprintf(stderr, "Error: length supplied too many arguments.\n");
-    return NIL;
+    return lisp_error("length supplied too many arguments.");
   }
 
   size_t length = 0;
@@ -227,20 +210,14 @@ lisp_object_t* length(lisp_object_t *args) {
   if (t->type != CONS)
     length++;
 
-  lisp_object_t *length_o = make_lisp_object();
-  length_o->type = NUMBER;
-  length_o->datum.number = length;
-  
-  return length_o;
+  return make_number(length);
 }
 
 lisp_object_t* eq(lisp_object_t *args) {
   int num_args = arg_length(args);
 
-  if (num_args != 2) {
-    fprintf(stderr, "Error: eq requires 2 arguments.\n");
-    return NIL;
-  }
+  if (num_args != 2)
+    return lisp_error("eq requires 2 arguments.");
 
   lisp_object_t *a = CONS_VALUE(args)->car;
   lisp_object_t *b = CONS_VALUE(CONS_VALUE(args)->cdr)->car;
@@ -271,40 +248,187 @@ lisp_object_t* eq(lisp_object_t *args) {
   case MACRO:
     return (a == b) ? T : NIL;
 
+  case INPUT_PORT:
+  case CONTINUATION:
+  case THREAD:
+  case CHANNEL:
+  case BYTES:
+  case STREAM:
+  case OUTPUT_PORT:
+  case HOST_FUNCTION:
+  case F64VECTOR:
+  case I64VECTOR:
+    return (a == b) ? T : NIL;
+
   default:
-    fprintf(stderr, "Error: eq is not defined on type.\n");
-    return NIL;
+    return lisp_error("eq is not defined on type.");
+  }
+}
+
+/* Signals the error that stopped reader, if it wasn't the end of the
+   input. Truncated input is an error like any other, so callers never
+   take it for the end. */
+static void check_read(lisp_reader_t *reader, const char *function_name, lisp_object_t *path) {
+  const char *what = NULL;
+  int line = reader->line;
+  int column = reader->column;
+
+  switch (reader->condition) {
+
+  case READ_EOF:
+    return;
+
+  case READ_UNBALANCED_PAREN:
+    what = "unbalanced parenthesis";
+    break;
+
+  case READ_DOT:
+    what = "unexpected '.'";
+    break;
+
+  default:
+    what = reader->error ? reader->error : "unreadable form";
+    line = reader->error_line;
+    column = reader->error_column;
+    break;
+  }
+
+  if (path)
+    lisp_error("%s found %s in \"%s\" (line %d, column %d).", function_name, what,
+               path->datum.string, line, column);
+
+  lisp_error("%s found %s (line %d, column %d).", function_name, what, line, column);
+}
+
+/* foo.lisp compiles to foo.fasl, anything else just gains the extension */
+static char* fasl_path_for(const char *source_path) {
+  size_t length = strlen(source_path);
+  char *fasl_path = xmalloc(length + 6);
+
+  strcpy(fasl_path, source_path);
+
+  if (length > 5 && strcmp(source_path + length - 5, ".lisp") == 0)
+    strcpy(fasl_path + length - 5, ".fasl");
+  else if (!(length > 5 && strcmp(source_path + length - 5, ".fasl") == 0))
+    strcat(fasl_path, ".fasl");
+
+  return fasl_path;
+}
+
+lisp_object_t* compile_file(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args != 1)
+    return lisp_error("compile-file requires 1 argument.");
+
+  lisp_object_t *path = CONS_VALUE(args)->car;
+  lisp_object_t *env = get_global_environment();
+
+  if (path->type != STRING)
+    return lisp_error("compile-file expects its first argument to be of type STRING.");
+
+  lisp_reader_t *reader = open_file_reader(path->datum.string);
+
+  if (!reader)
+    return lisp_error("compile-file unable to open file: \"%s\"", path->datum.string);
+
+  escape_point_t cleanup;
+  push_escape(&cleanup, ESCAPE_CLEANUP, NULL);
+
+  if (setjmp(cleanup.jump) != 0) {
+    pop_escape(&cleanup);
+    close_reader(reader);
+    resume_escape(&cleanup);
+  }
+
+  /* Forms are evaluated as they're compiled, so that macros defined early
+     in the file can be expanded in the rest of it. */
+  lisp_object_t *forms = NIL;
+  lisp_object_t **tail = &forms;
+  lisp_object_t *next_object = NULL;
+  while ((next_object = read_form(reader)) != NULL) {
+    lisp_object_t *cell = make_cons(macroexpand_all(next_object, env), NIL);
+    *tail = cell;
+    tail = &CONS_VALUE(cell)->cdr;
+
+    eval(CONS_VALUE(cell)->car, env);
   }
+
+  check_read(reader, "compile-file", path);
+  pop_escape(&cleanup);
+  close_reader(reader);
+
+  lisp_object_t *fasl_path = make_string(fasl_path_for(path->datum.string));
+
+  if (write_image(fasl_path->datum.string, forms) != 0)
+    return lisp_error("compile-file unable to write \"%s\"", fasl_path->datum.string);
+
+  return fasl_path;
+}
+
+static int newer_than(const struct timespec *a, const struct timespec *b) {
+  return a->tv_sec > b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
 }
 
 lisp_object_t* load(lisp_object_t *args, lisp_object_t *env) {
   int num_args = arg_length(args);
 
-  if (num_args != 1) {
-    fprintf(stderr, "Error: load requires 1 argument.\n");
-    return NIL;
-  } 
+  if (num_args != 1)
+    return lisp_error("load requires 1 argument.");
 
   lisp_object_t *path = CONS_VALUE(args)->car;
 
-  if (path->type != STRING) {
-    fprintf(stderr, "Error: load expects its first argument to be of type STRING.\n");
-    return NULL;
+  if (path->type != STRING)
+    return lisp_error("load expects its first argument to be of type STRING.");
+
+  /* compiled forms are only used when they're strictly newer than the
+     source, to the nanosecond, since a source edited in the same instant
+     as compile-file may or may not be the one that was compiled */
+  char *fasl_path = fasl_path_for(path->datum.string);
+  struct stat source_stat;
+  struct stat fasl_stat;
+  int use_fasl = stat(fasl_path, &fasl_stat) == 0
+    && (stat(path->datum.string, &source_stat) != 0
+        || newer_than(&fasl_stat.st_mtim, &source_stat.st_mtim));
+
+  if (use_fasl) {
+    lisp_object_t *forms = read_image(fasl_path);
+    free(fasl_path);
+
+    if (!forms)
+      return lisp_error("load unable to read the compiled \"%s\"", path->datum.string);
+
+    for (; forms != NIL && forms->type == CONS; forms = CONS_VALUE(forms)->cdr)
+      eval(CONS_VALUE(forms)->car, env);
+
+    return T;
   }
+  free(fasl_path);
+
+  /* Each load has a reader of its own, so nested loads leave the
+     caller's reader state alone. */
+  lisp_reader_t *reader = open_file_reader(path->datum.string);
+
+  if (!reader)
+    return lisp_error("load unable to open file: \"%s\"", path->datum.string);
 
-  FILE *file = fopen(path->datum.string, "r");
+  escape_point_t cleanup;
+  push_escape(&cleanup, ESCAPE_CLEANUP, NULL);
 
-  if (!file) {
-    fprintf(stderr, "Error: load unable to open file: \"%s\"\n", path->datum.string);
-    return NULL;
+  if (setjmp(cleanup.jump) != 0) {
+    pop_escape(&cleanup);
+    close_reader(reader);
+    resume_escape(&cleanup);
   }
 
   lisp_object_t *next_object = NULL;
-  while ((next_object = read_object(file, NULL)) != NULL) {
+  while ((next_object = read_form(reader)) != NULL) {
     eval(next_object, env);
   }
 
-  fclose(file);
+  check_read(reader, "load", path);
+  pop_escape(&cleanup);
+  close_reader(reader);
 
   return T;
 }
@@ -312,18 +436,8 @@ lisp_object_t* load(lisp_object_t *args, lisp_object_t *env) {
 lisp_object_t* atomp(lisp_object_t *args) {
   int num_args = arg_length(args);
 
-  if (num_args != 1) {
-    fprintf(stderr, "Error: atom? requires 1 argument.\n");
-    return NIL;
-  } 
-
-  lisp_object_t *len_lst = make_cons(args, NIL);
-  lisp_object_t *len = length(len_lst);
-
-  if (len != NIL && len->datum.number != 1) {
-    fprintf(stderr, "Error: atom? requires 1 argument.\n");
-    return NIL;
-  }
+  if (num_args != 1)
+    return lisp_error("atom? requires 1 argument.");
 
   lisp_object_t *a = CONS_VALUE(args)->car;
 
@@ -333,219 +447,1559 @@ lisp_object_t* atomp(lisp_object_t *args) {
   return NIL;
 }
 
-lisp_object_t* primitive_print(lisp_object_t *args) {
-  lisp_object_t *str = NULL;
+/* The writer of args' port at index, or of the current output port when
+   args is shorter */
+static lisp_writer_t* output_writer(lisp_object_t *args, int index, char *function_name) {
+  lisp_object_t *port = current_output_port();
+
+  for (int i = 0; i < index && args != NIL; i++)
+    args = CONS_VALUE(args)->cdr;
+
+  if (args != NIL)
+    port = CONS_VALUE(args)->car;
+
+  if (port->type != OUTPUT_PORT)
+    lisp_error("%s expects an OUTPUT_PORT.", function_name);
+
+  lisp_writer_t *writer = port->datum.writer;
+
+  if (!writer->file && !writer->buffer)
+    lisp_error("%s given a closed port.", function_name);
+
+  return writer;
+}
 
+lisp_object_t* primitive_print(lisp_object_t *args) {
   int num_args = arg_length(args);
 
-  if (num_args != 1) {
-    fprintf(stderr, "Error: primitive-print requires 1 argument.\n");
-    return NIL;
-  } else {
-    if (CONS_VALUE(args)->car->type == STRING) {
-      str = CONS_VALUE(args)->car;
-    } else {
-      str = print_object(CONS_VALUE(args)->car);
-    }
-  }
+  if (num_args != 1)
+    return lisp_error("primitive-print requires 1 argument.");
+
+  lisp_writer_t *writer = output_writer(NIL, 0, "primitive-print");
+  lisp_object_t *object = CONS_VALUE(args)->car;
 
-  if (str)
-    printf("%s ", str->datum.string);
+  /* a string is printed bare, but the strings inside anything else are
+     quoted, unlike display */
+  if (object->type == STRING)
+    writer_puts(writer, object->datum.string);
+  else
+    write_object(writer, object);
+
+  writer_write(writer, " ", 1);
 
   return NIL;
 }
 
-char* strdup(const char *src) {
-  size_t len = strlen(src);
-  char *copy = malloc(len + 1);
+lisp_object_t* primitive_write(lisp_object_t *args) {
+  int num_args = arg_length(args);
 
-  strcpy(copy, src);
-  
-  return copy;
+  if (num_args < 1 || num_args > 2)
+    return lisp_error("write requires 1 or 2 arguments.");
+
+  write_object(output_writer(args, 1, "write"), CONS_VALUE(args)->car);
+
+  return NIL;
 }
 
-lisp_object_t* add(lisp_object_t *args) {
+lisp_object_t* display(lisp_object_t *args) {
   int num_args = arg_length(args);
 
-  if (num_args < 1) {
-    fprintf(stderr, "Error: too few arguments supplied to +.\n");
-    return NULL;
-  }
+  if (num_args < 1 || num_args > 2)
+    return lisp_error("display requires 1 or 2 arguments.");
 
-  lisp_object_t *it = args;
-  double sum = 0;
-  
-  while (it != NIL) {
-    if (CONS_VALUE(it)->car->type != NUMBER) {
-      fprintf(stderr, "Error: wrong non-numeric type given to +.\n");
-      return NULL;
-    }
+  display_object(output_writer(args, 1, "display"), CONS_VALUE(args)->car);
 
-    sum += CONS_VALUE(it)->car->datum.number;
-    it = CONS_VALUE(it)->cdr;
-  }
+  return NIL;
+}
 
-  lisp_object_t *result = make_lisp_object();
-  result->type = NUMBER;
-  result->datum.number = sum;
+lisp_object_t* newline(lisp_object_t *args) {
+  if (arg_length(args) > 1)
+    return lisp_error("newline takes at most 1 argument.");
 
-  return result;
+  writer_write(output_writer(args, 0, "newline"), "\n", 1);
+
+  return NIL;
 }
 
-lisp_object_t* subtract(lisp_object_t *args) {
+lisp_object_t* flush_output(lisp_object_t *args) {
+  if (arg_length(args) > 1)
+    return lisp_error("flush-output takes at most 1 argument.");
+
+  lisp_writer_t *writer = output_writer(args, 0, "flush-output");
+
+  if (writer->file)
+    fflush(writer->file);
+
+  return NIL;
+}
+
+lisp_object_t* primitive_current_output_port(lisp_object_t *args) {
+  if (args != NIL)
+    return lisp_error("current-output-port takes no arguments.");
+
+  return current_output_port();
+}
+
+lisp_object_t* open_output_file(lisp_object_t *args) {
   int num_args = arg_length(args);
 
-  if (num_args < 1) {
-    fprintf(stderr, "Error: too few arguments supplied to -\n");
-    return NULL;
-  }
+  if (num_args != 1)
+    return lisp_error("open-output-file requires 1 argument.");
 
-  if (CONS_VALUE(args)->car->type != NUMBER) {
-    fprintf(stderr, "Error: wrong non-numeric type given to -.\n");
-    return NULL;
-  }
+  lisp_object_t *path = CONS_VALUE(args)->car;
 
-  double value = CONS_VALUE(args)->car->datum.number;
-  lisp_object_t *it = CONS_VALUE(args)->cdr;
-  
-  while (it != NIL) {
-    if (CONS_VALUE(it)->car->type != NUMBER) {
-      fprintf(stderr, "Error: wrong non-numeric type given to -.\n");
-      return NULL;
-    }
+  if (path->type != STRING)
+    return lisp_error("open-output-file expects its first argument to be of type STRING.");
 
-    value -= CONS_VALUE(it)->car->datum.number;
-    it = CONS_VALUE(it)->cdr;
-  }
+  FILE *file = fopen(path->datum.string, "w");
 
-  lisp_object_t *result = make_lisp_object();
-  result->type = NUMBER;
-  result->datum.number = value;
+  if (!file)
+    return lisp_error("open-output-file unable to open file: \"%s\"", path->datum.string);
 
-  return result;
+  return make_output_port(file, 1);
 }
 
-lisp_object_t* multiply(lisp_object_t *args) {
-  int num_args = arg_length(args);
+lisp_object_t* set_port_buffering(lisp_object_t *args) {
+  if (arg_length(args) != 2)
+    return lisp_error("set-port-buffering requires 2 arguments.");
 
-  if (num_args < 1) {
-    fprintf(stderr, "Error: too few arguments supplied to *.\n");
-    return NULL;
-  }
+  lisp_writer_t *writer = output_writer(args, 0, "set-port-buffering");
+  lisp_object_t *mode = CONS_VALUE(CONS_VALUE(args)->cdr)->car;
 
-  lisp_object_t *it = args;
-  double product = 1;
-  
-  while (it != NIL) {
-    if (CONS_VALUE(it)->car->type != NUMBER) {
-      fprintf(stderr, "Error: wrong non-numeric type given to *.\n");
-      return NULL;
-    }
+  if (mode == intern("full", 4))
+    writer->buffering = WRITER_FULLY_BUFFERED;
+  else if (mode == intern("line", 4))
+    writer->buffering = WRITER_LINE_BUFFERED;
+  else if (mode == intern("none", 4))
+    writer->buffering = WRITER_UNBUFFERED;
+  else
+    return lisp_error("set-port-buffering expects full, line or none.");
 
-    product *= CONS_VALUE(it)->car->datum.number;
-    it = CONS_VALUE(it)->cdr;
+  if (writer->file && writer->buffering != WRITER_FULLY_BUFFERED)
+    fflush(writer->file);
+
+  return mode;
+}
+
+lisp_object_t* primitive_with_output_to_string(lisp_object_t *args) {
+  if (arg_length(args) != 1)
+    return lisp_error("primitive-with-output-to-string requires 1 argument.");
+
+  lisp_object_t *thunk = CONS_VALUE(args)->car;
+
+  if (!functionp(thunk))
+    return lisp_error("primitive-with-output-to-string expects a function.");
+
+  lisp_object_t *previous = current_output_port();
+  lisp_object_t *port = make_output_port(NULL, 0);
+  escape_point_t cleanup;
+
+  push_escape(&cleanup, ESCAPE_CLEANUP, NULL);
+
+  if (setjmp(cleanup.jump) != 0) {
+    pop_escape(&cleanup);
+    set_current_output_port(previous);
+    resume_escape(&cleanup);
   }
 
-  lisp_object_t *result = make_lisp_object();
-  result->type = NUMBER;
-  result->datum.number = product;
+  set_current_output_port(port);
+  funcall(thunk, NIL);
+  pop_escape(&cleanup);
+  set_current_output_port(previous);
 
-  return result;
+  return make_string(writer_finish(port->datum.writer));
 }
 
-lisp_object_t* divide(lisp_object_t *args) {
+lisp_object_t* open_input_file(lisp_object_t *args) {
   int num_args = arg_length(args);
 
-  if (num_args < 1) {
-    fprintf(stderr, "Error: too few arguments supplied to /.\n");
-    return NULL;
-  }
+  if (num_args != 1)
+    return lisp_error("open-input-file requires 1 argument.");
 
-  if (CONS_VALUE(args)->car->type != NUMBER) {
-    fprintf(stderr, "Error: wrong non-numeric type given to /.\n");
-    return NULL;
-  }
+  lisp_object_t *path = CONS_VALUE(args)->car;
 
-  double value = CONS_VALUE(args)->car->datum.number;
-  lisp_object_t *it = CONS_VALUE(args)->cdr;
-  
-  while (it != NIL) {
-    if (CONS_VALUE(it)->car->type != NUMBER) {
-      fprintf(stderr, "Error: wrong non-numeric type given to /.\n");
-      return NULL;
-    }
+  if (path->type != STRING)
+    return lisp_error("open-input-file expects its first argument to be of type STRING.");
 
-    value /= CONS_VALUE(it)->car->datum.number;
-    it = CONS_VALUE(it)->cdr;
-  }
+  lisp_reader_t *reader = open_file_reader(path->datum.string);
 
-  lisp_object_t *result = make_lisp_object();
-  result->type = NUMBER;
-  result->datum.number = value;
+  if (!reader)
+    return lisp_error("open-input-file unable to open file: \"%s\"", path->datum.string);
 
-  return result;
+  lisp_object_t *port = make_lisp_object();
+  port->type = INPUT_PORT;
+  port->datum.reader = reader;
+
+  return port;
 }
 
-lisp_object_t* less_than(lisp_object_t *args) {
+static lisp_reader_t* port_reader(lisp_object_t *args, char *function_name) {
   int num_args = arg_length(args);
 
-  if (num_args < 1) {
-    fprintf(stderr, "Error: too few arguments supplied to <.\n");
-    return NULL;
-  }
-  
-  if (CONS_VALUE(args)->car->type != NUMBER) {
-    fprintf(stderr, "Error: wrong non-numeric type given to <.\n");
-    return NULL;
-  }
+  if (num_args != 1)
+    lisp_error("%s requires 1 argument.", function_name);
 
-  lisp_object_t *it = CONS_VALUE(args)->cdr;
-  lisp_object_t *prev = CONS_VALUE(args)->car;
+  lisp_object_t *port = CONS_VALUE(args)->car;
 
-  while (it != NIL) {
-    if (CONS_VALUE(it)->car->type != NUMBER) {
-      fprintf(stderr, "Error: wrong non-numeric type given to <.\n");
-      return NULL;
-    }
+  if (port->type != INPUT_PORT)
+    lisp_error("%s expects its first argument to be of type INPUT_PORT.", function_name);
+  else if (port->datum.reader == NULL)
+    lisp_error("%s given a closed port.", function_name);
 
-    if (CONS_VALUE(it)->car->datum.number <= prev->datum.number)
-      return NIL;
+  return port->datum.reader;
+}
 
-    prev = CONS_VALUE(it)->car;
-    it = CONS_VALUE(it)->cdr;
+lisp_object_t* read_port(lisp_object_t *args) {
+  lisp_reader_t *reader = port_reader(args, "read");
+  lisp_object_t *object = read_form(reader);
+
+  if (object)
+    return object;
+
+  check_read(reader, "read", NULL);
+
+  return EOF_OBJECT;
+}
+
+lisp_object_t* close_port(lisp_object_t *args) {
+  if (arg_length(args) == 1 && CONS_VALUE(args)->car->type == STREAM) {
+    io_close(CONS_VALUE(args)->car);
+    return T;
   }
 
+  if (arg_length(args) == 1 && CONS_VALUE(args)->car->type == OUTPUT_PORT) {
+    free(writer_finish(output_writer(args, 0, "close-port")));
+    return T;
+  }
+
+  lisp_reader_t *reader = port_reader(args, "close-port");
+
+  close_reader(reader);
+  CONS_VALUE(args)->car->datum.reader = NULL;
+
   return T;
 }
 
-lisp_object_t* greater_than(lisp_object_t *args) {
+lisp_object_t* primitive_open(lisp_object_t *args) {
   int num_args = arg_length(args);
 
-  if (num_args < 1) {
-    fprintf(stderr, "Error: too few arguments supplied to >.\n");
-    return NULL;
-  }
-  
-  if (CONS_VALUE(args)->car->type != NUMBER) {
-    fprintf(stderr, "Error: wrong non-numeric type given to >.\n");
-    return NULL;
-  }
+  if (num_args < 1 || num_args > 2)
+    return lisp_error("open requires 1 or 2 arguments.");
 
-  lisp_object_t *it = CONS_VALUE(args)->cdr;
-  lisp_object_t *prev = CONS_VALUE(args)->car;
+  lisp_object_t *path = CONS_VALUE(args)->car;
+  lisp_object_t *mode = num_args == 2 ? CONS_VALUE(CONS_VALUE(args)->cdr)->car : NULL;
 
-  while (it != NIL) {
-    if (CONS_VALUE(it)->car->type != NUMBER) {
-      fprintf(stderr, "Error: wrong non-numeric type given to >.\n");
-      return NULL;
-    }
+  if (path->type != STRING)
+    return lisp_error("open expects its first argument to be of type STRING.");
 
-    if (CONS_VALUE(it)->car->datum.number >= prev->datum.number)
-      return NIL;
+  if (mode && mode->type != STRING)
+    return lisp_error("open expects its second argument to be of type STRING.");
 
-    prev = CONS_VALUE(it)->car;
-    it = CONS_VALUE(it)->cdr;
-  }
+  return io_open(path->datum.string, mode ? mode->datum.string : "r");
+}
 
-  return T;
+static lisp_object_t* stream_arg(lisp_object_t *args, int num_args, char *function_name) {
+  if (arg_length(args) != num_args)
+    lisp_error("%s requires %d argument%s.", function_name, num_args, num_args == 1 ? "" : "s");
+
+  if (CONS_VALUE(args)->car->type != STREAM)
+    lisp_error("%s expects its first argument to be of type STREAM.", function_name);
+
+  return CONS_VALUE(args)->car;
+}
+
+lisp_object_t* read_bytes(lisp_object_t *args) {
+  lisp_object_t *stream = stream_arg(args, 2, "read-bytes");
+  lisp_object_t *count = CONS_VALUE(CONS_VALUE(args)->cdr)->car;
+
+  if (count->type != NUMBER || count->datum.number < 0)
+    return lisp_error("read-bytes expects a count of bytes.");
+
+  return io_read_bytes(stream, (size_t) count->datum.number);
+}
+
+lisp_object_t* write_bytes(lisp_object_t *args) {
+  lisp_object_t *stream = stream_arg(args, 2, "write-bytes");
+  lisp_object_t *data = CONS_VALUE(CONS_VALUE(args)->cdr)->car;
+
+  if (data->type == BYTES)
+    io_write_bytes(stream, data->datum.bytes->data, data->datum.bytes->length);
+  else if (data->type == STRING)
+    io_write_bytes(stream, (unsigned char*) data->datum.string, strlen(data->datum.string));
+  else
+    return lisp_error("write-bytes expects its second argument to be BYTES or a STRING.");
+
+  return data;
+}
+
+lisp_object_t* read_line(lisp_object_t *args) {
+  return io_read_line(stream_arg(args, 1, "read-line"));
+}
+
+lisp_object_t* bytes_length(lisp_object_t *args) {
+  if (arg_length(args) != 1 || CONS_VALUE(args)->car->type != BYTES)
+    return lisp_error("bytes-length requires 1 argument of type BYTES.");
+
+  return make_number(CONS_VALUE(args)->car->datum.bytes->length);
+}
+
+lisp_object_t* bytes_to_string(lisp_object_t *args) {
+  if (arg_length(args) != 1 || CONS_VALUE(args)->car->type != BYTES)
+    return lisp_error("bytes->string requires 1 argument of type BYTES.");
+
+  lisp_bytes_t *bytes = CONS_VALUE(args)->car->datum.bytes;
+  char *string = xmalloc(bytes->length + 1);
+
+  memcpy(string, bytes->data, bytes->length);
+  string[bytes->length] = '\0';
+
+  return make_string(string);
+}
+
+lisp_object_t* string_to_bytes(lisp_object_t *args) {
+  if (arg_length(args) != 1 || CONS_VALUE(args)->car->type != STRING)
+    return lisp_error("string->bytes requires 1 argument of type STRING.");
+
+  size_t length = strlen(CONS_VALUE(args)->car->datum.string);
+  unsigned char *data = xmalloc(length ? length : 1);
+
+  memcpy(data, CONS_VALUE(args)->car->datum.string, length);
+
+  return make_bytes(data, length);
+}
+
+lisp_object_t* primitive_make_bytes(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args < 1 || num_args > 2)
+    return lisp_error("make-bytes requires 1 or 2 arguments.");
+
+  lisp_object_t *length = CONS_VALUE(args)->car;
+  lisp_object_t *fill = num_args == 2 ? CONS_VALUE(CONS_VALUE(args)->cdr)->car : NULL;
+
+  if (length->type != NUMBER || length->datum.number < 0)
+    return lisp_error("make-bytes expects its first argument to be a non-negative NUMBER.");
+
+  if (fill && fill->type != NUMBER)
+    return lisp_error("make-bytes expects its second argument to be of type NUMBER.");
+
+  size_t count = (size_t) length->datum.number;
+  unsigned char *data = xmalloc(count ? count : 1);
+
+  memset(data, fill ? (int) fill->datum.number : 0, count);
+
+  return make_bytes(data, count);
+}
+
+lisp_object_t* foreign_function(lisp_object_t *args) {
+  if (arg_length(args) != 4)
+    return lisp_error("foreign-function requires 4 arguments.");
+
+  lisp_object_t *library = CONS_VALUE(args)->car;
+  lisp_object_t *name = CONS_VALUE(CONS_VALUE(args)->cdr)->car;
+  lisp_object_t *result_type = CONS_VALUE(CONS_VALUE(CONS_VALUE(args)->cdr)->cdr)->car;
+  lisp_object_t *arg_types = CONS_VALUE(CONS_VALUE(CONS_VALUE(CONS_VALUE(args)->cdr)->cdr)->cdr)->car;
+
+  if (library != NIL && library->type != STRING)
+    return lisp_error("foreign-function expects its first argument to be a STRING or nil.");
+
+  if (name->type != STRING)
+    return lisp_error("foreign-function expects its second argument to be of type STRING.");
+
+  if (arg_types->type != CONS)
+    return lisp_error("foreign-function expects its fourth argument to be a list.");
+
+  return ffi_bind(library == NIL ? NULL : library->datum.string, name->datum.string,
+                  result_type, arg_types);
+}
+
+lisp_object_t* primitive_exit(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args > 1)
+    return lisp_error("exit takes at most 1 argument.");
+
+  lisp_object_t *status = num_args ? CONS_VALUE(args)->car : NULL;
+
+  if (status && status->type != NUMBER)
+    return lisp_error("exit expects its first argument to be of type NUMBER.");
+
+  /* stdio flushes the file ports on the way out */
+  exit(status ? (int) status->datum.number : 0);
+}
+
+lisp_object_t* eof_objectp(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args != 1)
+    return lisp_error("eof-object? requires 1 argument.");
+
+  return (CONS_VALUE(args)->car == EOF_OBJECT) ? T : NIL;
+}
+
+lisp_object_t* for_each_form(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args != 2)
+    return lisp_error("for-each-form requires 2 arguments.");
+
+  lisp_object_t *path = CONS_VALUE(args)->car;
+  lisp_object_t *f = CONS_VALUE(CONS_VALUE(args)->cdr)->car;
+
+  if (path->type != STRING)
+    return lisp_error("for-each-form expects its first argument to be of type STRING.");
+
+  lisp_reader_t *reader = open_file_reader(path->datum.string);
+
+  if (!reader)
+    return lisp_error("for-each-form unable to open file: \"%s\"", path->datum.string);
+
+  escape_point_t cleanup;
+  push_escape(&cleanup, ESCAPE_CLEANUP, NULL);
+
+  if (setjmp(cleanup.jump) != 0) {
+    pop_escape(&cleanup);
+    close_reader(reader);
+    resume_escape(&cleanup);
+  }
+
+  /* Only the form in hand is referenced, and garbage is collected
+     between calls, so earlier forms don't pile up */
+  lisp_object_t *next_object = NULL;
+  while ((next_object = read_form(reader)) != NULL) {
+    funcall(f, make_cons(next_object, NIL));
+    maybe_gc(get_global_environment());
+  }
+
+  check_read(reader, "for-each-form", path);
+  pop_escape(&cleanup);
+  close_reader(reader);
+
+  return T;
+}
+
+lisp_object_t* save_image(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args != 1)
+    return lisp_error("save-image requires 1 argument.");
+
+  lisp_object_t *path = CONS_VALUE(args)->car;
+
+  if (path->type != STRING)
+    return lisp_error("save-image expects its first argument to be of type STRING.");
+
+  if (write_image(path->datum.string, get_global_environment()) != 0)
+    return lisp_error("save-image unable to write \"%s\"", path->datum.string);
+
+  return T;
+}
+
+lisp_object_t* primitive_profile_start(lisp_object_t *args) {
+  profile_start();
+
+  return T;
+}
+
+lisp_object_t* primitive_profile_stop(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args > 1) {
+    return lisp_error("profile-stop accepts no more than 1 argument.");
+  } else if (num_args == 1 && CONS_VALUE(args)->car->type != STRING) {
+    return lisp_error("profile-stop expects its first argument to be of type STRING.");
+  }
+
+  profile_stop();
+  profile_report(stderr);
+
+  /* collapsed stacks, for flame graphs */
+  if (num_args == 1 && profile_write_collapsed(CONS_VALUE(args)->car->datum.string) != 0)
+    return lisp_error("profile-stop unable to write \"%s\"", CONS_VALUE(args)->car->datum.string);
+
+  return T;
+}
+
+lisp_object_t* call_cc(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args != 1)
+    return lisp_error("call/cc requires 1 argument.");
+
+  lisp_object_t *f = CONS_VALUE(args)->car;
+
+  if (!functionp(f))
+    return lisp_error("call/cc expects its first argument to be a function.");
+
+  /* capturing is just remembering where to jump back to */
+  escape_point_t point;
+  lisp_object_t *result = NULL;
+
+  push_escape(&point, ESCAPE_CATCH, NULL);
+
+  if (setjmp(point.jump) == 0)
+    result = funcall(f, make_cons(make_continuation(&point), NIL));
+  else
+    result = point.value;
+
+  pop_escape(&point);
+
+  return result;
+}
+
+lisp_object_t* primitive_error(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args < 1 || num_args > 2)
+    return lisp_error("error requires 1 or 2 arguments.");
+
+  lisp_object_t *message = CONS_VALUE(args)->car;
+  lisp_object_t *form = num_args == 2 ? CONS_VALUE(CONS_VALUE(args)->cdr)->car : NULL;
+
+  if (message->type != STRING)
+    return lisp_error("error expects its first argument to be of type STRING.");
+
+  throw_to(intern("error", 5), make_error(message, form));
+}
+
+lisp_object_t* errorp(lisp_object_t *args) {
+  if (arg_length(args) != 1)
+    return lisp_error("error? requires 1 argument.");
+
+  return CONS_VALUE(args)->car->type == ERROR ? T : NIL;
+}
+
+static lisp_object_t* error_arg(lisp_object_t *args, char *function_name) {
+  if (arg_length(args) != 1)
+    lisp_error("%s requires 1 argument.", function_name);
+
+  lisp_object_t *error = CONS_VALUE(args)->car;
+
+  if (error->type != ERROR)
+    lisp_error("%s expects its first argument to be of type ERROR.", function_name);
+
+  return error;
+}
+
+lisp_object_t* error_message(lisp_object_t *args) {
+  return CONS_VALUE(error_arg(args, "error-message"))->car;
+}
+
+lisp_object_t* error_form(lisp_object_t *args) {
+  return CONS_VALUE(error_arg(args, "error-form"))->cdr;
+}
+
+lisp_object_t* primitive_throw(lisp_object_t *args) {
+  if (arg_length(args) != 2)
+    return lisp_error("throw requires 2 arguments.");
+
+  throw_to(CONS_VALUE(args)->car, CONS_VALUE(CONS_VALUE(args)->cdr)->car);
+}
+
+lisp_object_t* primitive_catch(lisp_object_t *args) {
+  if (arg_length(args) != 2)
+    return lisp_error("primitive-catch requires 2 arguments.");
+
+  lisp_object_t *tag = CONS_VALUE(args)->car;
+  lisp_object_t *thunk = CONS_VALUE(CONS_VALUE(args)->cdr)->car;
+
+  if (!functionp(thunk))
+    return lisp_error("primitive-catch expects its second argument to be a function.");
+
+  escape_point_t point;
+  lisp_object_t *result = NULL;
+
+  push_escape(&point, ESCAPE_CATCH, tag);
+
+  if (setjmp(point.jump) == 0)
+    result = funcall(thunk, NIL);
+  else
+    result = point.value;
+
+  pop_escape(&point);
+
+  return result;
+}
+
+lisp_object_t* primitive_unwind_protect(lisp_object_t *args) {
+  if (arg_length(args) != 2)
+    return lisp_error("primitive-unwind-protect requires 2 arguments.");
+
+  lisp_object_t *thunk = CONS_VALUE(args)->car;
+  lisp_object_t *cleanup = CONS_VALUE(CONS_VALUE(args)->cdr)->car;
+
+  if (!functionp(thunk) || !functionp(cleanup))
+    return lisp_error("primitive-unwind-protect expects functions.");
+
+  escape_point_t point;
+  push_escape(&point, ESCAPE_CLEANUP, NULL);
+
+  if (setjmp(point.jump) != 0) {
+    pop_escape(&point);
+    funcall(cleanup, NIL);
+    resume_escape(&point);
+  }
+
+  lisp_object_t *result = funcall(thunk, NIL);
+
+  pop_escape(&point);
+  funcall(cleanup, NIL);
+
+  return result;
+}
+
+/* what the parallel natives share with their chunks */
+typedef struct {
+  lisp_object_t *f;
+  lisp_object_t **items;
+  lisp_object_t **results;      /* the conses results go in, see result_cells() */
+} parallel_args_t;
+
+/* Copies the proper list into a new array, after checking it is one */
+static lisp_object_t** list_to_array(lisp_object_t *list, size_t *count, const char *name) {
+  size_t length = 0;
+  lisp_object_t *it = list;
+
+  for (; it != NIL && it->type == CONS; it = CONS_VALUE(it)->cdr)
+    length++;
+
+  if (it != NIL)
+    lisp_error("%s expects a list.", name);
+
+  lisp_object_t **items = xmalloc((length ? length : 1) * sizeof(lisp_object_t*));
+
+  for (size_t i = 0; i < length; i++, list = CONS_VALUE(list)->cdr)
+    items[i] = CONS_VALUE(list)->car;
+
+  *count = length;
+
+  return items;
+}
+
+/* Returns the conses of a new list of count NULLs, which the chunks store
+   their results in. f may collect garbage, and results in an array would
+   be lost, while the list is on the caller's stack. */
+static lisp_object_t** result_cells(size_t count, lisp_object_t **list) {
+  lisp_object_t **cells = xmalloc((count ? count : 1) * sizeof(lisp_object_t*));
+
+  *list = NIL;
+
+  for (size_t i = count; i > 0; i--) {
+    *list = make_cons(NULL, *list);
+    cells[i - 1] = *list;
+  }
+
+  return cells;
+}
+
+/* Runs body over count items on the pool, freeing the arrays and throwing
+   on whatever a chunk threw */
+static void run_parallel(size_t count, void (*body)(size_t start, size_t end, void *data),
+                         parallel_args_t *data) {
+  lisp_object_t *tag = NULL;
+  lisp_object_t *value = NULL;
+
+  int status = parallel_for(count, body, data, &tag, &value);
+
+  if (status != 0) {
+    free(data->items);
+    free(data->results);
+    throw_to(tag, value);
+  }
+}
+
+static void map_chunk(size_t start, size_t end, void *data) {
+  parallel_args_t *args = data;
+
+  for (size_t i = start; i < end; i++)
+    CONS_VALUE(args->results[i])->car = funcall(args->f, make_cons(args->items[i], NIL));
+}
+
+static void for_each_chunk(size_t start, size_t end, void *data) {
+  parallel_args_t *args = data;
+
+  for (size_t i = start; i < end; i++)
+    funcall(args->f, make_cons(args->items[i], NIL));
+}
+
+/* a chunk's partial result is kept at the index it starts at */
+static void reduce_chunk(size_t start, size_t end, void *data) {
+  parallel_args_t *args = data;
+  lisp_object_t *result = args->items[start];
+
+  for (size_t i = start + 1; i < end; i++)
+    result = funcall(args->f, make_cons(result, make_cons(args->items[i], NIL)));
+
+  CONS_VALUE(args->results[start])->car = result;
+}
+
+lisp_object_t* pmap(lisp_object_t *args) {
+  if (arg_length(args) != 2)
+    return lisp_error("pmap requires 2 arguments.");
+
+  parallel_args_t data = {CONS_VALUE(args)->car, NULL, NULL};
+  size_t count = 0;
+
+  if (!functionp(data.f))
+    return lisp_error("pmap expects its first argument to be a function.");
+
+  lisp_object_t *result;
+
+  data.items = list_to_array(CONS_VALUE(CONS_VALUE(args)->cdr)->car, &count, "pmap");
+  data.results = result_cells(count, &result);
+
+  run_parallel(count, map_chunk, &data);
+  free(data.items);
+  free(data.results);
+
+  return result;
+}
+
+lisp_object_t* pfor_each(lisp_object_t *args) {
+  if (arg_length(args) != 2)
+    return lisp_error("pfor-each requires 2 arguments.");
+
+  parallel_args_t data = {CONS_VALUE(args)->car, NULL, NULL};
+  size_t count = 0;
+
+  if (!functionp(data.f))
+    return lisp_error("pfor-each expects its first argument to be a function.");
+
+  data.items = list_to_array(CONS_VALUE(CONS_VALUE(args)->cdr)->car, &count, "pfor-each");
+
+  run_parallel(count, for_each_chunk, &data);
+  free(data.items);
+
+  return NIL;
+}
+
+lisp_object_t* preduce(lisp_object_t *args) {
+  if (arg_length(args) != 3)
+    return lisp_error("preduce requires 3 arguments.");
+
+  parallel_args_t data = {CONS_VALUE(args)->car, NULL, NULL};
+  lisp_object_t *result = CONS_VALUE(CONS_VALUE(args)->cdr)->car;
+  lisp_object_t *list = CONS_VALUE(CONS_VALUE(CONS_VALUE(args)->cdr)->cdr)->car;
+  size_t count = 0;
+
+  if (!functionp(data.f))
+    return lisp_error("preduce expects its first argument to be a function.");
+
+  lisp_object_t *cells;
+
+  data.items = list_to_array(list, &count, "preduce");
+  data.results = result_cells(count, &cells);
+
+  run_parallel(count, reduce_chunk, &data);
+
+  free(data.items);
+  free(data.results);
+
+  /* only the cells a chunk started at hold a partial result */
+  lisp_object_t *partials = NIL;
+  lisp_object_t **tail = &partials;
+
+  for (; cells != NIL; cells = CONS_VALUE(cells)->cdr) {
+    if (CONS_VALUE(cells)->car) {
+      *tail = cells;
+      tail = &CONS_VALUE(cells)->cdr;
+    }
+  }
+
+  *tail = NIL;
+
+  /* the partials are combined in order, so f need only be associative */
+  for (; partials != NIL; partials = CONS_VALUE(partials)->cdr)
+    result = funcall(data.f, make_cons(result, make_cons(CONS_VALUE(partials)->car, NIL)));
+
+  return result;
+}
+
+lisp_object_t* spawn(lisp_object_t *args) {
+  if (arg_length(args) != 1)
+    return lisp_error("spawn requires 1 argument.");
+
+  if (!functionp(CONS_VALUE(args)->car))
+    return lisp_error("spawn expects its first argument to be a function.");
+
+  return green_spawn(CONS_VALUE(args)->car, 0);
+}
+
+lisp_object_t* primitive_future(lisp_object_t *args) {
+  if (arg_length(args) != 1)
+    return lisp_error("primitive-future requires 1 argument.");
+
+  if (!functionp(CONS_VALUE(args)->car))
+    return lisp_error("primitive-future expects its first argument to be a function.");
+
+  return green_spawn(CONS_VALUE(args)->car, 1);
+}
+
+lisp_object_t* touch(lisp_object_t *args) {
+  if (arg_length(args) != 1)
+    return lisp_error("touch requires 1 argument.");
+
+  if (CONS_VALUE(args)->car->type != THREAD)
+    return lisp_error("touch expects its first argument to be of type THREAD.");
+
+  return green_touch(CONS_VALUE(args)->car);
+}
+
+lisp_object_t* yield(lisp_object_t *args) {
+  if (args != NIL)
+    return lisp_error("yield takes no arguments.");
+
+  green_yield();
+
+  return NIL;
+}
+
+lisp_object_t* make_channel(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args > 1)
+    return lisp_error("make-channel takes at most 1 argument.");
+
+  double capacity = 0;
+
+  if (num_args == 1) {
+    lisp_object_t *limit = CONS_VALUE(args)->car;
+
+    if (limit->type != NUMBER || limit->datum.number < 1)
+      return lisp_error("make-channel expects a positive capacity.");
+
+    capacity = limit->datum.number;
+  }
+
+  return green_make_channel((size_t) capacity);
+}
+
+static lisp_object_t* channel_arg(lisp_object_t *args, const char *function_name) {
+  lisp_object_t *channel = CONS_VALUE(args)->car;
+
+  if (channel->type != CHANNEL)
+    lisp_error("%s expects its first argument to be of type CHANNEL.", function_name);
+
+  return channel;
+}
+
+lisp_object_t* channel_send(lisp_object_t *args) {
+  if (arg_length(args) != 2)
+    return lisp_error("send requires 2 arguments.");
+
+  lisp_object_t *value = CONS_VALUE(CONS_VALUE(args)->cdr)->car;
+
+  green_send(channel_arg(args, "send"), value);
+
+  return value;
+}
+
+lisp_object_t* channel_recv(lisp_object_t *args) {
+  if (arg_length(args) != 1)
+    return lisp_error("recv requires 1 argument.");
+
+  return green_recv(channel_arg(args, "recv"));
+}
+
+static lisp_object_t* stats_entry(const char *name, lisp_object_t *value,
+                                  lisp_object_t *rest) {
+  return make_cons(make_cons(intern(name, strlen(name)), value), rest);
+}
+
+/* ((per kind) . n) for either the object or the byte counters */
+static lisp_object_t* kind_counts(const size_t *counts) {
+  lisp_object_t *result = NIL;
+
+  for (int kind = ALLOCATION_KINDS - 1; kind >= 0; kind--)
+    result = stats_entry(allocation_kind_name(kind), make_number(counts[kind]), result);
+
+  return result;
+}
+
+lisp_object_t* primitive_memory_stats(lisp_object_t *args) {
+  const memory_stats_t *stats = memory_stats();
+  lisp_object_t *result = NIL;
+
+  /* only the profiler knows which function was running */
+  if (profile_enabled)
+    result = stats_entry("sites", profile_allocation_sites(), result);
+
+  result = stats_entry("gc-max-pause-ms", make_number(stats->max_pause_ms), result);
+  result = stats_entry("gc-total-pause-ms", make_number(stats->total_pause_ms), result);
+  result = stats_entry("gc-last-pause-ms", make_number(stats->last_pause_ms), result);
+  result = stats_entry("gc-last-freed", make_number(stats->last_freed), result);
+  result = stats_entry("gc-last-survivors", make_number(stats->last_survivors), result);
+  result = stats_entry("gc-count", make_number(stats->gc_count), result);
+  result = stats_entry("live-objects", make_number(stats->live_objects), result);
+  result = stats_entry("bytes", kind_counts(stats->bytes), result);
+  result = stats_entry("objects", kind_counts(stats->objects), result);
+
+  return result;
+}
+
+lisp_object_t* memory_stats_log(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args < 1 || num_args > 2)
+    return lisp_error("memory-stats-log requires 1 or 2 arguments.");
+
+  lisp_object_t *path = CONS_VALUE(args)->car;
+  lisp_object_t *interval = num_args == 2 ? CONS_VALUE(CONS_VALUE(args)->cdr)->car : NULL;
+
+  if (path != NIL && path->type != STRING) {
+    return lisp_error("memory-stats-log expects its first argument to be of type STRING.");
+  } else if (interval && (interval->type != NUMBER || interval->datum.number < 1)) {
+    return lisp_error("memory-stats-log expects a positive interval.");
+  }
+
+  set_memory_stats_log(NULL, 1);
+
+  /* (memory-stats-log nil) just stops logging */
+  if (path == NIL)
+    return T;
+
+  if (open_memory_stats_log(path->datum.string,
+                            interval ? (size_t) interval->datum.number : 1) != 0)
+    return lisp_error("memory-stats-log unable to open file: \"%s\"", path->datum.string);
+
+  return T;
+}
+
+char* strdup(const char *src) {
+  size_t len = strlen(src);
+  char *copy = malloc(len + 1);
+
+  strcpy(copy, src);
+  
+  return copy;
+}
+
+lisp_object_t* add(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args < 1)
+    return lisp_error("too few arguments supplied to +.");
+
+  lisp_object_t *it = args;
+  double sum = 0;
+  
+  while (it != NIL) {
+    if (CONS_VALUE(it)->car->type != NUMBER)
+      return lisp_error("wrong non-numeric type given to +.");
+
+    sum += CONS_VALUE(it)->car->datum.number;
+    it = CONS_VALUE(it)->cdr;
+  }
+
+  return make_number(sum);
+}
+
+lisp_object_t* subtract(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args < 1)
+    return lisp_error("too few arguments supplied to -");
+
+  if (CONS_VALUE(args)->car->type != NUMBER)
+    return lisp_error("wrong non-numeric type given to -.");
+
+  double value = CONS_VALUE(args)->car->datum.number;
+  lisp_object_t *it = CONS_VALUE(args)->cdr;
+  
+  while (it != NIL) {
+    if (CONS_VALUE(it)->car->type != NUMBER)
+      return lisp_error("wrong non-numeric type given to -.");
+
+    value -= CONS_VALUE(it)->car->datum.number;
+    it = CONS_VALUE(it)->cdr;
+  }
+
+  return make_number(value);
+}
+
+lisp_object_t* multiply(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args < 1)
+    return lisp_error("too few arguments supplied to *.");
+
+  lisp_object_t *it = args;
+  double product = 1;
+  
+  while (it != NIL) {
+    if (CONS_VALUE(it)->car->type != NUMBER)
+      return lisp_error("wrong non-numeric type given to *.");
+
+    product *= CONS_VALUE(it)->car->datum.number;
+    it = CONS_VALUE(it)->cdr;
+  }
+
+  return make_number(product);
+}
+
+lisp_object_t* divide(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args < 1)
+    return lisp_error("too few arguments supplied to /.");
+
+  if (CONS_VALUE(args)->car->type != NUMBER)
+    return lisp_error("wrong non-numeric type given to /.");
+
+  double value = CONS_VALUE(args)->car->datum.number;
+  lisp_object_t *it = CONS_VALUE(args)->cdr;
+  
+  while (it != NIL) {
+    if (CONS_VALUE(it)->car->type != NUMBER)
+      return lisp_error("wrong non-numeric type given to /.");
+
+    value /= CONS_VALUE(it)->car->datum.number;
+    it = CONS_VALUE(it)->cdr;
+  }
+
+  return make_number(value);
+}
+
+lisp_object_t* less_than(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args < 1)
+    return lisp_error("too few arguments supplied to <.");
+  
+  if (CONS_VALUE(args)->car->type != NUMBER)
+  
+    return lisp_error("wrong non-numeric type given to <.");
+
+  lisp_object_t *it = CONS_VALUE(args)->cdr;
+  lisp_object_t *prev = CONS_VALUE(args)->car;
+
+  while (it != NIL) {
+    if (CONS_VALUE(it)->car->type != NUMBER)
+      return lisp_error("wrong non-numeric type given to <.");
+
+    if (CONS_VALUE(it)->car->datum.number <= prev->datum.number)
+      return NIL;
+
+    prev = CONS_VALUE(it)->car;
+    it = CONS_VALUE(it)->cdr;
+  }
+
+  return T;
+}
+
+lisp_object_t* greater_than(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args < 1)
+    return lisp_error("too few arguments supplied to >.");
+  
+  if (CONS_VALUE(args)->car->type != NUMBER)
+  
+    return lisp_error("wrong non-numeric type given to >.");
+
+  lisp_object_t *it = CONS_VALUE(args)->cdr;
+  lisp_object_t *prev = CONS_VALUE(args)->car;
+
+  while (it != NIL) {
+    if (CONS_VALUE(it)->car->type != NUMBER)
+      return lisp_error("wrong non-numeric type given to >.");
+
+    if (CONS_VALUE(it)->car->datum.number >= prev->datum.number)
+      return NIL;
+
+    prev = CONS_VALUE(it)->car;
+    it = CONS_VALUE(it)->cdr;
+  }
+
+  return T;
+}
+
+static lisp_object_t* nth_arg(lisp_object_t *args, int index) {
+  while (index-- > 0)
+    args = CONS_VALUE(args)->cdr;
+
+  return CONS_VALUE(args)->car;
+}
+
+static lisp_object_t* vector_arg(lisp_object_t *args, int index, const char *function_name) {
+  lisp_object_t *vector = nth_arg(args, index);
+
+  if (vector->type != F64VECTOR && vector->type != I64VECTOR)
+    lisp_error("%s expects argument %d to be an F64VECTOR or I64VECTOR.", function_name,
+               index + 1);
+
+  return vector;
+}
+
+/* An I64VECTOR only holds integers that fit */
+static int fits_i64(double number) {
+  return number >= -9223372036854775808.0 && number < 9223372036854775808.0
+    && (double) (int64_t) number == number;
+}
+
+static int64_t to_i64(double number, const char *function_name) {
+  if (!fits_i64(number))
+    lisp_error("%s given %f, which an I64VECTOR can't hold.", function_name, number);
+
+  return (int64_t) number;
+}
+
+static void set_element(lisp_object_t *vector, size_t i, lisp_object_t *value,
+                        const char *function_name) {
+  if (value->type != NUMBER)
+    lisp_error("%s expects numbers for its elements.", function_name);
+
+  if (vector->type == F64VECTOR)
+    vector->datum.vector->data.f64[i] = value->datum.number;
+  else
+    vector->datum.vector->data.i64[i] = to_i64(value->datum.number, function_name);
+}
+
+static lisp_object_t* vector_from_args(lisp_type type, lisp_object_t *args,
+                                       const char *function_name) {
+  lisp_object_t *vector = make_numeric_vector(type, arg_length(args));
+
+  for (size_t i = 0; args != NIL; args = CONS_VALUE(args)->cdr, i++)
+    set_element(vector, i, CONS_VALUE(args)->car, function_name);
+
+  return vector;
+}
+
+lisp_object_t* f64vector(lisp_object_t *args) {
+  return vector_from_args(F64VECTOR, args, "f64vector");
+}
+
+lisp_object_t* i64vector(lisp_object_t *args) {
+  return vector_from_args(I64VECTOR, args, "i64vector");
+}
+
+static lisp_object_t* make_filled_vector(lisp_type type, lisp_object_t *args,
+                                         const char *function_name) {
+  int num_args = arg_length(args);
+
+  if (num_args < 1 || num_args > 2)
+    return lisp_error("%s requires 1 or 2 arguments.", function_name);
+
+  lisp_object_t *length = CONS_VALUE(args)->car;
+
+  if (length->type != NUMBER || length->datum.number < 0)
+    return lisp_error("%s expects its first argument to be a non-negative NUMBER.",
+                      function_name);
+
+  lisp_object_t *vector = make_numeric_vector(type, (size_t) length->datum.number);
+
+  if (num_args == 2 && vector->datum.vector->length > 0) {
+    set_element(vector, 0, nth_arg(args, 1), function_name);
+
+    for (size_t i = 1; i < vector->datum.vector->length; i++) {
+      if (type == F64VECTOR)
+        vector->datum.vector->data.f64[i] = vector->datum.vector->data.f64[0];
+      else
+        vector->datum.vector->data.i64[i] = vector->datum.vector->data.i64[0];
+    }
+  }
+
+  return vector;
+}
+
+lisp_object_t* make_f64vector(lisp_object_t *args) {
+  return make_filled_vector(F64VECTOR, args, "make-f64vector");
+}
+
+lisp_object_t* make_i64vector(lisp_object_t *args) {
+  return make_filled_vector(I64VECTOR, args, "make-i64vector");
+}
+
+static lisp_object_t* element(lisp_object_t *vector, size_t i) {
+  if (vector->type == F64VECTOR)
+    return make_number(vector->datum.vector->data.f64[i]);
+
+  return make_number((double) vector->datum.vector->data.i64[i]);
+}
+
+lisp_object_t* vec_length(lisp_object_t *args) {
+  if (arg_length(args) != 1)
+    return lisp_error("vec-length requires 1 argument.");
+
+  return make_number(vector_arg(args, 0, "vec-length")->datum.vector->length);
+}
+
+lisp_object_t* vec_ref(lisp_object_t *args) {
+  if (arg_length(args) != 2)
+    return lisp_error("vec-ref requires 2 arguments.");
+
+  lisp_object_t *vector = vector_arg(args, 0, "vec-ref");
+  lisp_object_t *index = nth_arg(args, 1);
+
+  if (index->type != NUMBER || index->datum.number < 0
+      || index->datum.number >= vector->datum.vector->length)
+    return lisp_error("vec-ref given an index out of range.");
+
+  return element(vector, (size_t) index->datum.number);
+}
+
+lisp_object_t* vec_to_list(lisp_object_t *args) {
+  if (arg_length(args) != 1)
+    return lisp_error("vec->list requires 1 argument.");
+
+  lisp_object_t *vector = vector_arg(args, 0, "vec->list");
+  lisp_object_t *result = NIL;
+
+  for (size_t i = vector->datum.vector->length; i > 0; i--)
+    result = make_cons(element(vector, i - 1), result);
+
+  return result;
+}
+
+/* Checks for two vectors of the same type and length */
+static void vector_pair(lisp_object_t *args, const char *function_name,
+                        lisp_object_t **a, lisp_object_t **b) {
+  if (arg_length(args) != 2)
+    lisp_error("%s requires 2 arguments.", function_name);
+
+  *a = vector_arg(args, 0, function_name);
+  *b = vector_arg(args, 1, function_name);
+
+  if ((*a)->type != (*b)->type || (*a)->datum.vector->length != (*b)->datum.vector->length)
+    lisp_error("%s expects vectors of the same type and length.", function_name);
+}
+
+lisp_object_t* vec_add(lisp_object_t *args) {
+  lisp_object_t *a, *b;
+
+  vector_pair(args, "vec+", &a, &b);
+
+  size_t length = a->datum.vector->length;
+  lisp_object_t *result = make_numeric_vector(a->type, length);
+
+  if (a->type == F64VECTOR)
+    f64_add(result->datum.vector->data.f64, a->datum.vector->data.f64,
+            b->datum.vector->data.f64, length);
+  else
+    i64_add(result->datum.vector->data.i64, a->datum.vector->data.i64,
+            b->datum.vector->data.i64, length);
+
+  return result;
+}
+
+lisp_object_t* vec_multiply(lisp_object_t *args) {
+  lisp_object_t *a, *b;
+
+  vector_pair(args, "vec*", &a, &b);
+
+  size_t length = a->datum.vector->length;
+  lisp_object_t *result = make_numeric_vector(a->type, length);
+
+  if (a->type == F64VECTOR)
+    f64_mul(result->datum.vector->data.f64, a->datum.vector->data.f64,
+            b->datum.vector->data.f64, length);
+  else
+    i64_mul(result->datum.vector->data.i64, a->datum.vector->data.i64,
+            b->datum.vector->data.i64, length);
+
+  return result;
+}
+
+lisp_object_t* dot(lisp_object_t *args) {
+  lisp_object_t *a, *b;
+
+  vector_pair(args, "dot", &a, &b);
+
+  if (a->type == F64VECTOR)
+    return make_number(f64_dot(a->datum.vector->data.f64, b->datum.vector->data.f64,
+                               a->datum.vector->length));
+
+  return make_number((double) i64_dot(a->datum.vector->data.i64, b->datum.vector->data.i64,
+                                      a->datum.vector->length));
+}
+
+lisp_object_t* sum(lisp_object_t *args) {
+  if (arg_length(args) != 1)
+    return lisp_error("sum requires 1 argument.");
+
+  lisp_object_t *vector = vector_arg(args, 0, "sum");
+
+  if (vector->type == F64VECTOR)
+    return make_number(f64_sum(vector->datum.vector->data.f64, vector->datum.vector->length));
+
+  return make_number((double) i64_sum(vector->datum.vector->data.i64,
+                                      vector->datum.vector->length));
+}
+
+lisp_object_t* scale(lisp_object_t *args) {
+  if (arg_length(args) != 2)
+    return lisp_error("scale requires 2 arguments.");
+
+  lisp_object_t *vector = vector_arg(args, 0, "scale");
+  lisp_object_t *k = nth_arg(args, 1);
+
+  if (k->type != NUMBER)
+    return lisp_error("scale expects its second argument to be of type NUMBER.");
+
+  size_t length = vector->datum.vector->length;
+  lisp_object_t *result = make_numeric_vector(vector->type, length);
+
+  if (vector->type == F64VECTOR)
+    f64_mul_scalar(result->datum.vector->data.f64, vector->datum.vector->data.f64,
+                   k->datum.number, length);
+  else
+    i64_mul_scalar(result->datum.vector->data.i64, vector->datum.vector->data.i64,
+                   to_i64(k->datum.number, "scale"), length);
+
+  return result;
+}
+
+/* Runs the kernel vector_map_kernel() found, returning 0 when it can't be
+   run exactly on an I64VECTOR, e.g. for a k that isn't an integer */
+static int run_map_kernel(vector_map_t *map, lisp_object_t *vector, lisp_object_t *result) {
+  lisp_vector_t *in = vector->datum.vector;
+  lisp_vector_t *out = result->datum.vector;
+
+  if (vector->type == F64VECTOR) {
+    switch (map->op) {
+    case MAP_ADD:
+      f64_add_scalar(out->data.f64, in->data.f64, map->k, in->length);
+      break;
+    case MAP_MUL:
+      f64_mul_scalar(out->data.f64, in->data.f64, map->k, in->length);
+      break;
+    case MAP_SUBTRACT_FROM:
+      f64_subtract_from(out->data.f64, map->k, in->data.f64, in->length);
+      break;
+    case MAP_SQUARE:
+      f64_mul(out->data.f64, in->data.f64, in->data.f64, in->length);
+      break;
+    }
+
+    return 1;
+  }
+
+  if (map->op != MAP_SQUARE && !fits_i64(map->k))
+    return 0;
+
+  switch (map->op) {
+  case MAP_ADD:
+    i64_add_scalar(out->data.i64, in->data.i64, (int64_t) map->k, in->length);
+    break;
+  case MAP_MUL:
+    i64_mul_scalar(out->data.i64, in->data.i64, (int64_t) map->k, in->length);
+    break;
+  case MAP_SUBTRACT_FROM:
+    i64_subtract_from(out->data.i64, (int64_t) map->k, in->data.i64, in->length);
+    break;
+  case MAP_SQUARE:
+    i64_mul(out->data.i64, in->data.i64, in->data.i64, in->length);
+    break;
+  }
+
+  return 1;
+}
+
+lisp_object_t* vec_map(lisp_object_t *args) {
+  if (arg_length(args) != 2)
+    return lisp_error("vec-map requires 2 arguments.");
+
+  lisp_object_t *f = CONS_VALUE(args)->car;
+  lisp_object_t *vector = vector_arg(args, 1, "vec-map");
+  size_t length = vector->datum.vector->length;
+  lisp_object_t *result = make_numeric_vector(vector->type, length);
+  vector_map_t map;
+
+  if (!functionp(f))
+    return lisp_error("vec-map expects its first argument to be a function.");
+
+  if (vector_map_kernel(f, &map) && run_map_kernel(&map, vector, result))
+    return result;
+
+  for (size_t i = 0; i < length; i++) {
+    lisp_object_t *x = element(vector, i);
+
+    set_element(result, i, funcall_array(f, 1, &x), "vec-map");
+  }
+
+  return result;
+}
+
+/* Keeps object alive while a sort calls the predicate or key, which may
+   collect garbage. Nothing else refers to the buffers, and the objects
+   in them aren't seen by the collector. */
+static void keep(lisp_object_t *volatile *kept, lisp_object_t *object) {
+  *kept = make_cons(object, *kept);
+}
+
+/* Scratch space for sorting, kept in BYTES so that it's collected rather
+   than leaked when the predicate or key throws */
+static sort_item_t* sort_buffer(size_t n, lisp_object_t *volatile *kept) {
+  size_t size = (n ? n : 1) * sizeof(sort_item_t);
+  lisp_object_t *buffer = make_bytes(xmalloc(size), size);
+
+  keep(kept, buffer);
+
+  return (sort_item_t*) buffer->datum.bytes->data;
+}
+
+static int number_less(const sort_item_t *a, const sort_item_t *b, void *context) {
+  (void) context;
+
+  return a->key->datum.number < b->key->datum.number;
+}
+
+static int number_greater(const sort_item_t *a, const sort_item_t *b, void *context) {
+  (void) context;
+
+  return a->key->datum.number > b->key->datum.number;
+}
+
+static int predicate_less(const sort_item_t *a, const sort_item_t *b, void *context) {
+  lisp_object_t *args[2] = {a->key, b->key};
+
+  return funcall_array(context, 2, args) != NIL;
+}
+
+static sort_item_t* sequence_items(lisp_object_t *sequence, size_t *count,
+                                   lisp_object_t *volatile *kept) {
+  size_t length = 0;
+  sort_item_t *items;
+
+  if (sequence->type == F64VECTOR || sequence->type == I64VECTOR) {
+    length = sequence->datum.vector->length;
+    items = sort_buffer(length, kept);
+
+    for (size_t i = 0; i < length; i++) {
+      items[i].item = element(sequence, i);
+      keep(kept, items[i].item);
+    }
+  } else {
+    lisp_object_t *it = sequence;
+
+    for (; it != NIL && it->type == CONS; it = CONS_VALUE(it)->cdr)
+      length++;
+
+    if (it != NIL)
+      lisp_error("sort expects a list or a vector.");
+
+    items = sort_buffer(length, kept);
+
+    for (size_t i = 0; i < length; i++, sequence = CONS_VALUE(sequence)->cdr)
+      items[i].item = CONS_VALUE(sequence)->car;
+  }
+
+  *count = length;
+
+  return items;
+}
+
+/* < and > on a vector need no boxing or calls at all */
+static lisp_object_t* sort_vector(lisp_object_t *vector, int descending) {
+  size_t length = vector->datum.vector->length;
+  lisp_object_t *result = make_numeric_vector(vector->type, length);
+  lisp_vector_t *sorted = result->datum.vector;
+
+  if (vector->type == F64VECTOR) {
+    memcpy(sorted->data.f64, vector->datum.vector->data.f64, length * sizeof(double));
+    f64_introsort(sorted->data.f64, length);
+
+    for (size_t i = 0; descending && i < length / 2; i++) {
+      double temp = sorted->data.f64[i];
+      sorted->data.f64[i] = sorted->data.f64[length - 1 - i];
+      sorted->data.f64[length - 1 - i] = temp;
+    }
+  } else {
+    memcpy(sorted->data.i64, vector->datum.vector->data.i64, length * sizeof(int64_t));
+    i64_introsort(sorted->data.i64, length);
+
+    for (size_t i = 0; descending && i < length / 2; i++) {
+      int64_t temp = sorted->data.i64[i];
+      sorted->data.i64[i] = sorted->data.i64[length - 1 - i];
+      sorted->data.i64[length - 1 - i] = temp;
+    }
+  }
+
+  return result;
+}
+
+lisp_object_t* primitive_sort(lisp_object_t *args) {
+  int num_args = arg_length(args);
+
+  if (num_args < 2 || num_args > 3)
+    return lisp_error("sort requires 2 or 3 arguments.");
+
+  lisp_object_t *sequence = CONS_VALUE(args)->car;
+  lisp_object_t *predicate = nth_arg(args, 1);
+  lisp_object_t *key = num_args == 3 ? nth_arg(args, 2) : NULL;
+
+  if (!functionp(predicate) || (key && !functionp(key)))
+    return lisp_error("sort expects its predicate and key to be functions.");
+
+  lisp_function native = predicate->type == NATIVE_FUNCTION ? predicate->datum.native_func : NULL;
+  int numeric = native == less_than || native == greater_than;
+  int is_vector = sequence->type == F64VECTOR || sequence->type == I64VECTOR;
+
+  if (is_vector && numeric && !key)
+    return sort_vector(sequence, native == greater_than);
+
+  size_t length;
+  lisp_object_t *volatile kept = NIL;
+  sort_item_t *items = sequence_items(sequence, &length, &kept);
+
+  /* each key is found once, rather than on every comparison */
+  for (size_t i = 0; i < length; i++) {
+    items[i].key = key ? funcall_array(key, 1, &items[i].item) : items[i].item;
+
+    if (key)
+      keep(&kept, items[i].key);
+
+    if (items[i].key->type != NUMBER)
+      numeric = 0;
+  }
+
+  sort_less less = predicate_less;
+
+  if (numeric)
+    less = native == less_than ? number_less : number_greater;
+
+  merge_sort(items, sort_buffer(length, &kept), length, less, predicate);
+
+  if (is_vector) {
+    lisp_object_t *result = make_numeric_vector(sequence->type, length);
+
+    for (size_t i = 0; i < length; i++)
+      set_element(result, i, items[i].item, "sort");
+
+    return result;
+  }
+
+  lisp_object_t *result = NIL;
+
+  for (size_t i = length; i > 0; i--)
+    result = make_cons(items[i - 1].item, result);
+
+  return result;
+}
+
+lisp_object_t* binary_search(lisp_object_t *args) {
+  if (arg_length(args) != 2)
+    return lisp_error("binary-search requires 2 arguments.");
+
+  lisp_object_t *vector = vector_arg(args, 0, "binary-search");
+  lisp_object_t *x = nth_arg(args, 1);
+  lisp_vector_t *sorted = vector->datum.vector;
+  size_t i;
+
+  if (x->type != NUMBER)
+    return lisp_error("binary-search expects its second argument to be of type NUMBER.");
+
+  if (vector->type == F64VECTOR) {
+    i = f64_lower_bound(sorted->data.f64, sorted->length, x->datum.number);
+
+    if (i < sorted->length && sorted->data.f64[i] == x->datum.number)
+      return make_number(i);
+  } else if (fits_i64(x->datum.number)) {
+    i = i64_lower_bound(sorted->data.i64, sorted->length, (int64_t) x->datum.number);
+
+    if (i < sorted->length && sorted->data.i64[i] == (int64_t) x->datum.number)
+      return make_number(i);
+  }
+
+  return NIL;
 }
@@ -21,10 +21,153 @@ lisp_object_t* eq(lisp_object_t *args);
 
 lisp_object_t* load(lisp_object_t *path, lisp_object_t *env);
 
+lisp_object_t* compile_file(lisp_object_t *args);
+
 lisp_object_t* atomp(lisp_object_t *args);
 
+/* (primitive-print object) displays object and a space */
 lisp_object_t* primitive_print(lisp_object_t *args);
 
+/* (exit [status]) ends the process, with status 0 by default */
+lisp_object_t* primitive_exit(lisp_object_t *args);
+
+/* (write object [port]) and (display object [port]) print to port, or
+   the current output port; display leaves strings unquoted */
+lisp_object_t* primitive_write(lisp_object_t *args);
+
+lisp_object_t* display(lisp_object_t *args);
+
+lisp_object_t* newline(lisp_object_t *args);
+
+lisp_object_t* flush_output(lisp_object_t *args);
+
+lisp_object_t* primitive_current_output_port(lisp_object_t *args);
+
+lisp_object_t* open_output_file(lisp_object_t *args);
+
+/* (set-port-buffering port mode) makes a file port flush when its buffer
+   fills (full), after each newline (line) or after each write (none) */
+lisp_object_t* set_port_buffering(lisp_object_t *args);
+
+/* (primitive-with-output-to-string thunk) returns what thunk writes to
+   the current output port */
+lisp_object_t* primitive_with_output_to_string(lisp_object_t *args);
+
+lisp_object_t* open_input_file(lisp_object_t *args);
+
+lisp_object_t* read_port(lisp_object_t *args);
+
+lisp_object_t* close_port(lisp_object_t *args);
+
+lisp_object_t* eof_objectp(lisp_object_t *args);
+
+lisp_object_t* for_each_form(lisp_object_t *args);
+
+lisp_object_t* save_image(lisp_object_t *args);
+
+lisp_object_t* primitive_profile_start(lisp_object_t *args);
+
+lisp_object_t* primitive_profile_stop(lisp_object_t *args);
+
+lisp_object_t* primitive_memory_stats(lisp_object_t *args);
+
+/* (call/cc f) calls f with a continuation that returns its argument from
+   the call/cc. Continuations are escape-only. */
+lisp_object_t* call_cc(lisp_object_t *args);
+
+/* (error message [form]) throws an error object to the tag error, so
+   (primitive-catch 'error thunk) returns it. The form defaults to the
+   call being evaluated. */
+lisp_object_t* primitive_error(lisp_object_t *args);
+
+lisp_object_t* errorp(lisp_object_t *args);
+
+lisp_object_t* error_message(lisp_object_t *args);
+
+lisp_object_t* error_form(lisp_object_t *args);
+
+/* (throw tag value) returns value from the innermost catch of tag */
+lisp_object_t* primitive_throw(lisp_object_t *args);
+
+/* (primitive-catch tag thunk) calls thunk, returning what it returns or
+   what is thrown to tag while it runs */
+lisp_object_t* primitive_catch(lisp_object_t *args);
+
+/* (primitive-unwind-protect thunk cleanup) calls cleanup after thunk,
+   however thunk exits */
+lisp_object_t* primitive_unwind_protect(lisp_object_t *args);
+
+/* (pmap f list) is (map f list) with the calls spread over threads, each
+ * with a VM forked from the caller's. f may cons and call anything, but
+ * must not define globals, as the global environment is shared. An error
+ * thrown by any call is thrown again from pmap.
+ */
+lisp_object_t* pmap(lisp_object_t *args);
+
+/* (pfor-each f list) calls f on every element like pmap, returning nil */
+lisp_object_t* pfor_each(lisp_object_t *args);
+
+/* (preduce f initial list) folds list with f like pmap spreads calls. Each
+   thread folds a run of elements, then those are folded from initial, so f
+   must be associative with initial as its identity. */
+lisp_object_t* preduce(lisp_object_t *args);
+
+/* (open path [mode]) opens a file for read-bytes, write-bytes and
+   read-line, see io.h. The mode defaults to "r". */
+lisp_object_t* primitive_open(lisp_object_t *args);
+
+/* (read-bytes stream count) returns BYTES of up to count, or *eof* */
+lisp_object_t* read_bytes(lisp_object_t *args);
+
+/* (write-bytes stream data) writes BYTES or a STRING, returning it */
+lisp_object_t* write_bytes(lisp_object_t *args);
+
+/* (read-line stream) returns a STRING, or *eof* */
+lisp_object_t* read_line(lisp_object_t *args);
+
+lisp_object_t* bytes_length(lisp_object_t *args);
+
+/* (bytes->string bytes) stops at the first NUL, if there is one */
+lisp_object_t* bytes_to_string(lisp_object_t *args);
+
+lisp_object_t* string_to_bytes(lisp_object_t *args);
+
+/* (make-bytes length [fill]) returns BYTES of length copies of fill, or of
+   zeros, e.g. for a foreign function to write into */
+lisp_object_t* primitive_make_bytes(lisp_object_t *args);
+
+/* (foreign-function library name result-type arg-types) binds the C
+   function name in the shared library at the path library, or in the
+   program itself when library is nil, see ffi.h */
+lisp_object_t* foreign_function(lisp_object_t *args);
+
+/* (spawn thunk) starts a green thread calling thunk, see green.h. It first
+   runs when the caller yields or waits, or after the top-level form. */
+lisp_object_t* spawn(lisp_object_t *args);
+
+/* (primitive-future thunk) is spawn, but keeps what thunk throws for
+   touch rather than reporting it */
+lisp_object_t* primitive_future(lisp_object_t *args);
+
+/* (touch thread) waits for thread, returning what its thunk returned or
+   throwing what it threw */
+lisp_object_t* touch(lisp_object_t *args);
+
+lisp_object_t* yield(lisp_object_t *args);
+
+/* (make-channel [capacity]) makes a queue for green threads; without a
+   capacity, send never waits */
+lisp_object_t* make_channel(lisp_object_t *args);
+
+/* (send channel value) returns value once it's queued */
+lisp_object_t* channel_send(lisp_object_t *args);
+
+lisp_object_t* channel_recv(lisp_object_t *args);
+
+/* (memory-stats-log path [interval]) appends a line of statistics to path
+   after every interval collections; (memory-stats-log nil) stops. */
+lisp_object_t* memory_stats_log(lisp_object_t *args);
+
 lisp_object_t* add(lisp_object_t *args);
 
 lisp_object_t* subtract(lisp_object_t *args);
@@ -37,4 +180,49 @@ lisp_object_t* less_than(lisp_object_t *args);
 
 lisp_object_t* greater_than(lisp_object_t *args);
 
+/* (f64vector x...) and (i64vector x...) make vectors of unboxed numbers,
+   see vectors.h. An I64VECTOR only takes integers. */
+lisp_object_t* f64vector(lisp_object_t *args);
+
+lisp_object_t* i64vector(lisp_object_t *args);
+
+/* (make-f64vector length [fill]), zero filled by default */
+lisp_object_t* make_f64vector(lisp_object_t *args);
+
+lisp_object_t* make_i64vector(lisp_object_t *args);
+
+lisp_object_t* vec_length(lisp_object_t *args);
+
+lisp_object_t* vec_ref(lisp_object_t *args);
+
+lisp_object_t* vec_to_list(lisp_object_t *args);
+
+/* (vec+ a b) and (vec* a b) work elementwise on vectors of the same type
+   and length, returning a new one */
+lisp_object_t* vec_add(lisp_object_t *args);
+
+lisp_object_t* vec_multiply(lisp_object_t *args);
+
+lisp_object_t* dot(lisp_object_t *args);
+
+lisp_object_t* sum(lisp_object_t *args);
+
+/* (scale vector k) multiplies every element by k */
+lisp_object_t* scale(lisp_object_t *args);
+
+/* (vec-map f vector) returns a vector of the same type holding f of each
+   element. Simple arithmetic lambdas don't call f, see vectors.h. */
+lisp_object_t* vec_map(lisp_object_t *args);
+
+/* (sort sequence predicate [key]) returns a sorted copy of a list or
+   vector, where predicate says whether one key goes strictly before
+   another. key is called once per element, and defaults to the element.
+   Lists sort stably. With < or > on numbers the predicate isn't called
+   at all, see sort.h. */
+lisp_object_t* primitive_sort(lisp_object_t *args);
+
+/* (binary-search vector x) returns the first index of x in the
+   ascending vector, or nil */
+lisp_object_t* binary_search(lisp_object_t *args);
+
 #endif
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lisp.h"
+#include "sort.h"
+
+/* ranges this short are insertion sorted */
+#define SMALL_SORT 16
+
+static void insertion_sort(sort_item_t *items, size_t n, sort_less less, void *context) {
+  for (size_t i = 1; i < n; i++) {
+    sort_item_t item = items[i];
+    size_t j = i;
+
+    for (; j > 0 && less(&item, &items[j - 1], context); j--)
+      items[j] = items[j - 1];
+
+    items[j] = item;
+  }
+}
+
+/* Merges from[start, middle) and from[middle, end) into to, taking from
+   the left on ties to keep the sort stable */
+static void merge(const sort_item_t *from, sort_item_t *to, size_t start, size_t middle,
+                  size_t end, sort_less less, void *context) {
+  size_t i = start;
+  size_t j = middle;
+  size_t k = start;
+
+  while (i < middle && j < end) {
+    if (less(&from[j], &from[i], context))
+      to[k++] = from[j++];
+    else
+      to[k++] = from[i++];
+  }
+
+  memcpy(to + k, from + i, (middle - i) * sizeof(sort_item_t));
+  k += middle - i;
+  memcpy(to + k, from + j, (end - j) * sizeof(sort_item_t));
+}
+
+/* Bottom up, so the stack doesn't grow with n */
+void merge_sort(sort_item_t *items, sort_item_t *scratch, size_t n, sort_less less,
+                void *context) {
+  sort_item_t *from = items;
+  sort_item_t *to = scratch;
+
+  for (size_t start = 0; start < n; start += SMALL_SORT)
+    insertion_sort(items + start, n - start < SMALL_SORT ? n - start : SMALL_SORT, less,
+                   context);
+
+  for (size_t width = SMALL_SORT; width < n; width *= 2) {
+    for (size_t start = 0; start < n; start += 2 * width) {
+      size_t middle = start + width < n ? start + width : n;
+      size_t end = middle + width < n ? middle + width : n;
+
+      merge(from, to, start, middle, end, less, context);
+    }
+
+    sort_item_t *merged = to;
+    to = from;
+    from = merged;
+  }
+
+  if (from != items)
+    memcpy(items, from, n * sizeof(sort_item_t));
+}
+
+static int depth_limit(size_t n) {
+  int depth = 0;
+
+  for (; n > 1; n >>= 1)
+    depth += 2;
+
+  return depth;
+}
+
+/*
+ * Introsort: quicksort with a median of three pivot, falling back to
+ * heapsort once it has gone 2 log n partitions deep, which only happens
+ * on inputs built to defeat the pivot. The smaller side is recursed on
+ * and the larger looped on. Hoare partitioning only stops its scans on
+ * elements that compare false, so NaNs end up somewhere but never make
+ * it run off either end.
+ *
+ * The same code is wanted for doubles and 64-bit integers, so it's
+ * written once over TYPE.
+ */
+#define DEFINE_INTROSORT(PREFIX, TYPE)                                  \
+  static void PREFIX##_swap(TYPE *a, size_t i, size_t j) {              \
+    TYPE temp = a[i];                                                   \
+    a[i] = a[j];                                                        \
+    a[j] = temp;                                                        \
+  }                                                                     \
+                                                                        \
+  static void PREFIX##_insertion_sort(TYPE *a, size_t n) {              \
+    for (size_t i = 1; i < n; i++) {                                    \
+      TYPE x = a[i];                                                    \
+      size_t j = i;                                                     \
+                                                                        \
+      for (; j > 0 && x < a[j - 1]; j--)                                \
+        a[j] = a[j - 1];                                                \
+                                                                        \
+      a[j] = x;                                                         \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  static void PREFIX##_sift_down(TYPE *a, size_t root, size_t n) {      \
+    for (size_t child; (child = 2 * root + 1) < n; root = child) {      \
+      if (child + 1 < n && a[child] < a[child + 1])                     \
+        child++;                                                        \
+                                                                        \
+      if (!(a[root] < a[child]))                                        \
+        return;                                                         \
+                                                                        \
+      PREFIX##_swap(a, root, child);                                    \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  static void PREFIX##_heapsort(TYPE *a, size_t n) {                    \
+    for (size_t i = n / 2; i > 0; i--)                                  \
+      PREFIX##_sift_down(a, i - 1, n);                                  \
+                                                                        \
+    for (size_t end = n - 1; end > 0; end--) {                          \
+      PREFIX##_swap(a, 0, end);                                         \
+      PREFIX##_sift_down(a, 0, end);                                    \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  /* Leaves the median of a[0], a[n / 2] and a[n - 1] in a[0] */        \
+  static void PREFIX##_median_to_front(TYPE *a, size_t n) {             \
+    size_t middle = n / 2;                                              \
+                                                                        \
+    if (a[middle] < a[0])                                               \
+      PREFIX##_swap(a, middle, 0);                                      \
+    if (a[n - 1] < a[middle])                                           \
+      PREFIX##_swap(a, n - 1, middle);                                  \
+    if (a[middle] < a[0])                                               \
+      PREFIX##_swap(a, middle, 0);                                      \
+                                                                        \
+    PREFIX##_swap(a, 0, middle);                                        \
+  }                                                                     \
+                                                                        \
+  /* Returns j such that a[0, j] <= pivot <= a[j + 1, n), j < n - 1 */  \
+  static size_t PREFIX##_partition(TYPE *a, size_t n) {                 \
+    TYPE pivot = a[0];                                                  \
+    size_t i = 0;                                                       \
+    size_t j = n - 1;                                                   \
+                                                                        \
+    for (;;) {                                                          \
+      while (a[i] < pivot)                                              \
+        i++;                                                            \
+      while (pivot < a[j])                                              \
+        j--;                                                            \
+                                                                        \
+      if (i >= j)                                                       \
+        return j;                                                       \
+                                                                        \
+      PREFIX##_swap(a, i++, j--);                                       \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  static void PREFIX##_introsort_loop(TYPE *a, size_t n, int depth) {   \
+    while (n > SMALL_SORT) {                                            \
+      if (depth-- == 0) {                                               \
+        PREFIX##_heapsort(a, n);                                        \
+        return;                                                         \
+      }                                                                 \
+                                                                        \
+      PREFIX##_median_to_front(a, n);                                   \
+                                                                        \
+      size_t left = PREFIX##_partition(a, n) + 1;                       \
+                                                                        \
+      if (left < n - left) {                                            \
+        PREFIX##_introsort_loop(a, left, depth);                        \
+        a += left;                                                      \
+        n -= left;                                                      \
+      } else {                                                          \
+        PREFIX##_introsort_loop(a + left, n - left, depth);             \
+        n = left;                                                       \
+      }                                                                 \
+    }                                                                   \
+                                                                        \
+    PREFIX##_insertion_sort(a, n);                                      \
+  }                                                                     \
+                                                                        \
+  void PREFIX##_introsort(TYPE *a, size_t n) {                          \
+    PREFIX##_introsort_loop(a, n, depth_limit(n));                      \
+  }                                                                     \
+                                                                        \
+  size_t PREFIX##_lower_bound(const TYPE *a, size_t n, TYPE x) {        \
+    size_t low = 0;                                                     \
+    size_t high = n;                                                    \
+                                                                        \
+    while (low < high) {                                                \
+      size_t middle = low + (high - low) / 2;                           \
+                                                                        \
+      if (a[middle] < x)                                                \
+        low = middle + 1;                                               \
+      else                                                              \
+        high = middle;                                                  \
+    }                                                                   \
+                                                                        \
+    return low;                                                         \
+  }
+
+DEFINE_INTROSORT(f64, double)
+DEFINE_INTROSORT(i64, int64_t)
@@ -0,0 +1,38 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lisp.h"
+
+/*
+ * The algorithms behind sort and binary-search. Lists are merge sorted,
+ * which is stable, and vectors of numbers are introsorted in place, which
+ * isn't, though equal numbers can't be told apart anyway. Both are
+ * O(n log n) in the worst case and neither recurses more than log n deep.
+ */
+
+typedef struct {
+  lisp_object_t *item;
+  lisp_object_t *key;           /* what the comparator is given */
+} sort_item_t;
+
+/* Whether a goes strictly before b */
+typedef int (*sort_less)(const sort_item_t *a, const sort_item_t *b, void *context);
+
+/* Sorts items using scratch, which holds n items as well */
+void merge_sort(sort_item_t *items, sort_item_t *scratch, size_t n, sort_less less,
+                void *context);
+
+/* Sort into ascending order */
+void f64_introsort(double *a, size_t n);
+
+void i64_introsort(int64_t *a, size_t n);
+
+/* The index of the first element of the ascending a that isn't less
+   than x, which is n when they all are */
+size_t f64_lower_bound(const double *a, size_t n, double x);
+
+size_t i64_lower_bound(const int64_t *a, size_t n, int64_t x);
+
+#endif
@@ -0,0 +1,424 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lisp.h"
+#include "runtime_functions.h"
+#include "vectors.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNELS 1
+#endif
+
+static int simd_disabled;
+
+static int use_avx2() {
+#ifdef HAVE_AVX2_KERNELS
+  return !simd_disabled && __builtin_cpu_supports("avx2");
+#else
+  return 0;
+#endif
+}
+
+void set_vector_simd(int enabled) {
+  simd_disabled = !enabled;
+}
+
+#ifdef HAVE_AVX2_KERNELS
+
+/*
+ * The AVX2 kernels are compiled for AVX2 whatever the rest of the build
+ * targets, and only called once use_avx2() has checked the CPU. Each
+ * handles four elements at a time and leaves the rest to a scalar loop.
+ */
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static size_t f64_add_avx2(double *out, const double *a, const double *b, size_t n) {
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+
+  return i;
+}
+
+AVX2 static size_t f64_mul_avx2(double *out, const double *a, const double *b, size_t n) {
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+
+  return i;
+}
+
+AVX2 static size_t f64_add_scalar_avx2(double *out, const double *a, double k, size_t n) {
+  __m256d constant = _mm256_set1_pd(k);
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), constant));
+
+  return i;
+}
+
+AVX2 static size_t f64_mul_scalar_avx2(double *out, const double *a, double k, size_t n) {
+  __m256d constant = _mm256_set1_pd(k);
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), constant));
+
+  return i;
+}
+
+AVX2 static size_t f64_subtract_from_avx2(double *out, double k, const double *a, size_t n) {
+  __m256d constant = _mm256_set1_pd(k);
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(out + i, _mm256_sub_pd(constant, _mm256_loadu_pd(a + i)));
+
+  return i;
+}
+
+AVX2 static double horizontal_sum(__m256d lanes) {
+  double parts[4];
+
+  _mm256_storeu_pd(parts, lanes);
+
+  return (parts[0] + parts[1]) + (parts[2] + parts[3]);
+}
+
+/* two accumulators, so one addition needn't wait on the last */
+AVX2 static double f64_dot_avx2(const double *a, const double *b, size_t n, size_t *done) {
+  __m256d even = _mm256_setzero_pd();
+  __m256d odd = _mm256_setzero_pd();
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    even = _mm256_add_pd(even, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    odd = _mm256_add_pd(odd, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4),
+                                           _mm256_loadu_pd(b + i + 4)));
+  }
+
+  for (; i + 4 <= n; i += 4)
+    even = _mm256_add_pd(even, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+
+  *done = i;
+
+  return horizontal_sum(_mm256_add_pd(even, odd));
+}
+
+AVX2 static double f64_sum_avx2(const double *a, size_t n, size_t *done) {
+  __m256d even = _mm256_setzero_pd();
+  __m256d odd = _mm256_setzero_pd();
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    even = _mm256_add_pd(even, _mm256_loadu_pd(a + i));
+    odd = _mm256_add_pd(odd, _mm256_loadu_pd(a + i + 4));
+  }
+
+  for (; i + 4 <= n; i += 4)
+    even = _mm256_add_pd(even, _mm256_loadu_pd(a + i));
+
+  *done = i;
+
+  return horizontal_sum(_mm256_add_pd(even, odd));
+}
+
+/* AVX2 has no 64 bit multiply, so only additions are done here */
+AVX2 static size_t i64_add_avx2(int64_t *out, const int64_t *a, const int64_t *b, size_t n) {
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    __m256i sum = _mm256_add_epi64(_mm256_loadu_si256((const __m256i*) (a + i)),
+                                   _mm256_loadu_si256((const __m256i*) (b + i)));
+    _mm256_storeu_si256((__m256i*) (out + i), sum);
+  }
+
+  return i;
+}
+
+AVX2 static size_t i64_add_scalar_avx2(int64_t *out, const int64_t *a, int64_t k, size_t n) {
+  __m256i constant = _mm256_set1_epi64x(k);
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    __m256i sum = _mm256_add_epi64(_mm256_loadu_si256((const __m256i*) (a + i)), constant);
+    _mm256_storeu_si256((__m256i*) (out + i), sum);
+  }
+
+  return i;
+}
+
+AVX2 static int64_t i64_sum_avx2(const int64_t *a, size_t n, size_t *done) {
+  __m256i lanes = _mm256_setzero_si256();
+  int64_t parts[4];
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    lanes = _mm256_add_epi64(lanes, _mm256_loadu_si256((const __m256i*) (a + i)));
+
+  _mm256_storeu_si256((__m256i*) parts, lanes);
+  *done = i;
+
+  return (int64_t) ((uint64_t) parts[0] + (uint64_t) parts[1]
+                    + (uint64_t) parts[2] + (uint64_t) parts[3]);
+}
+
+#endif
+
+void f64_add(double *out, const double *a, const double *b, size_t n) {
+  size_t i = 0;
+
+#ifdef HAVE_AVX2_KERNELS
+  if (use_avx2())
+    i = f64_add_avx2(out, a, b, n);
+#endif
+
+  for (; i < n; i++)
+    out[i] = a[i] + b[i];
+}
+
+void f64_mul(double *out, const double *a, const double *b, size_t n) {
+  size_t i = 0;
+
+#ifdef HAVE_AVX2_KERNELS
+  if (use_avx2())
+    i = f64_mul_avx2(out, a, b, n);
+#endif
+
+  for (; i < n; i++)
+    out[i] = a[i] * b[i];
+}
+
+void f64_add_scalar(double *out, const double *a, double k, size_t n) {
+  size_t i = 0;
+
+#ifdef HAVE_AVX2_KERNELS
+  if (use_avx2())
+    i = f64_add_scalar_avx2(out, a, k, n);
+#endif
+
+  for (; i < n; i++)
+    out[i] = a[i] + k;
+}
+
+void f64_mul_scalar(double *out, const double *a, double k, size_t n) {
+  size_t i = 0;
+
+#ifdef HAVE_AVX2_KERNELS
+  if (use_avx2())
+    i = f64_mul_scalar_avx2(out, a, k, n);
+#endif
+
+  for (; i < n; i++)
+    out[i] = a[i] * k;
+}
+
+void f64_subtract_from(double *out, double k, const double *a, size_t n) {
+  size_t i = 0;
+
+#ifdef HAVE_AVX2_KERNELS
+  if (use_avx2())
+    i = f64_subtract_from_avx2(out, k, a, n);
+#endif
+
+  for (; i < n; i++)
+    out[i] = k - a[i];
+}
+
+double f64_dot(const double *a, const double *b, size_t n) {
+  double result = 0;
+  size_t i = 0;
+
+#ifdef HAVE_AVX2_KERNELS
+  if (use_avx2())
+    result = f64_dot_avx2(a, b, n, &i);
+#endif
+
+  for (; i < n; i++)
+    result += a[i] * b[i];
+
+  return result;
+}
+
+double f64_sum(const double *a, size_t n) {
+  double result = 0;
+  size_t i = 0;
+
+#ifdef HAVE_AVX2_KERNELS
+  if (use_avx2())
+    result = f64_sum_avx2(a, n, &i);
+#endif
+
+  for (; i < n; i++)
+    result += a[i];
+
+  return result;
+}
+
+/* the scalar i64 loops work unsigned, where overflow wraps rather than
+   being undefined */
+void i64_add(int64_t *out, const int64_t *a, const int64_t *b, size_t n) {
+  size_t i = 0;
+
+#ifdef HAVE_AVX2_KERNELS
+  if (use_avx2())
+    i = i64_add_avx2(out, a, b, n);
+#endif
+
+  for (; i < n; i++)
+    out[i] = (int64_t) ((uint64_t) a[i] + (uint64_t) b[i]);
+}
+
+void i64_mul(int64_t *out, const int64_t *a, const int64_t *b, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = (int64_t) ((uint64_t) a[i] * (uint64_t) b[i]);
+}
+
+void i64_add_scalar(int64_t *out, const int64_t *a, int64_t k, size_t n) {
+  size_t i = 0;
+
+#ifdef HAVE_AVX2_KERNELS
+  if (use_avx2())
+    i = i64_add_scalar_avx2(out, a, k, n);
+#endif
+
+  for (; i < n; i++)
+    out[i] = (int64_t) ((uint64_t) a[i] + (uint64_t) k);
+}
+
+void i64_mul_scalar(int64_t *out, const int64_t *a, int64_t k, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = (int64_t) ((uint64_t) a[i] * (uint64_t) k);
+}
+
+void i64_subtract_from(int64_t *out, int64_t k, const int64_t *a, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = (int64_t) ((uint64_t) k - (uint64_t) a[i]);
+}
+
+int64_t i64_dot(const int64_t *a, const int64_t *b, size_t n) {
+  uint64_t result = 0;
+
+  for (size_t i = 0; i < n; i++)
+    result += (uint64_t) a[i] * (uint64_t) b[i];
+
+  return (int64_t) result;
+}
+
+int64_t i64_sum(const int64_t *a, size_t n) {
+  uint64_t result = 0;
+  size_t i = 0;
+
+#ifdef HAVE_AVX2_KERNELS
+  if (use_avx2())
+    result = (uint64_t) i64_sum_avx2(a, n, &i);
+#endif
+
+  for (; i < n; i++)
+    result += (uint64_t) a[i];
+
+  return (int64_t) result;
+}
+
+/* Sets *k to what operand stands for if it's a number, or a variable
+   bound to one */
+static int constant_operand(lisp_object_t *operand, lisp_object_t *environment, double *k) {
+  if (operand->type == SYMBOL)
+    operand = lookup_value(operand, environment);
+
+  if (!operand || operand->type != NUMBER)
+    return 0;
+
+  *k = operand->datum.number;
+
+  return 1;
+}
+
+int vector_map_kernel(lisp_object_t *f, vector_map_t *map) {
+  if (f->type != LAMBDA)
+    return 0;
+
+  /* (lambda (x) (op a b)) */
+  lisp_object_t *environment = CONS_VALUE(f)->cdr;
+  lisp_object_t *form = CONS_VALUE(CONS_VALUE(f)->car)->cdr;
+  lisp_object_t *parameters = CONS_VALUE(form)->car;
+  lisp_object_t *body = CONS_VALUE(form)->cdr;
+
+  if (parameters->type != CONS || parameters == NIL || CONS_VALUE(parameters)->cdr != NIL
+      || body == NIL || CONS_VALUE(body)->cdr != NIL)
+    return 0;
+
+  lisp_object_t *x = CONS_VALUE(parameters)->car;
+  lisp_object_t *call = CONS_VALUE(body)->car;
+
+  if (x->type != SYMBOL || call->type != CONS || call == NIL)
+    return 0;
+
+  lisp_object_t *operands = CONS_VALUE(call)->cdr;
+
+  if (operands == NIL || CONS_VALUE(operands)->cdr == NIL
+      || CONS_VALUE(CONS_VALUE(operands)->cdr)->cdr != NIL)
+    return 0;
+
+  lisp_object_t *op = CONS_VALUE(call)->car;
+  lisp_object_t *a = CONS_VALUE(operands)->car;
+  lisp_object_t *b = CONS_VALUE(CONS_VALUE(operands)->cdr)->car;
+
+  /* x would shadow a global op */
+  if (op->type != SYMBOL || op == x)
+    return 0;
+
+  lisp_object_t *native = lookup_value(op, environment);
+
+  if (!native || native->type != NATIVE_FUNCTION)
+    return 0;
+
+  lisp_function function = native->datum.native_func;
+
+  if (a == x && b == x) {
+    if (function == add) {
+      map->op = MAP_MUL;
+      map->k = 2;
+      return 1;
+    } else if (function == multiply) {
+      map->op = MAP_SQUARE;
+      return 1;
+    }
+
+    return 0;
+  }
+
+  if (a == x && constant_operand(b, environment, &map->k)) {
+    if (function == add) {
+      map->op = MAP_ADD;
+    } else if (function == subtract) {
+      map->op = MAP_ADD;
+      map->k = -map->k;
+    } else if (function == multiply) {
+      map->op = MAP_MUL;
+    } else {
+      return 0;
+    }
+
+    return 1;
+  }
+
+  if (b == x && constant_operand(a, environment, &map->k)) {
+    if (function == add)
+      map->op = MAP_ADD;
+    else if (function == subtract)
+      map->op = MAP_SUBTRACT_FROM;
+    else if (function == multiply)
+      map->op = MAP_MUL;
+    else
+      return 0;
+
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef VECTORS_H
+#define VECTORS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lisp.h"
+
+/*
+ * Kernels over the elements of F64VECTORs and I64VECTORs. Where the CPU
+ * has AVX2 they work four elements at a time, and otherwise one at a
+ * time. Elementwise results are the same either way, but dot and sum
+ * add in a different order with AVX2, so their f64 results may differ in
+ * the last bits. i64 arithmetic wraps around.
+ *
+ * out may be one of the inputs.
+ */
+
+void f64_add(double *out, const double *a, const double *b, size_t n);
+
+void f64_mul(double *out, const double *a, const double *b, size_t n);
+
+/* out = a + k */
+void f64_add_scalar(double *out, const double *a, double k, size_t n);
+
+/* out = a * k */
+void f64_mul_scalar(double *out, const double *a, double k, size_t n);
+
+/* out = k - a */
+void f64_subtract_from(double *out, double k, const double *a, size_t n);
+
+double f64_dot(const double *a, const double *b, size_t n);
+
+double f64_sum(const double *a, size_t n);
+
+void i64_add(int64_t *out, const int64_t *a, const int64_t *b, size_t n);
+
+void i64_mul(int64_t *out, const int64_t *a, const int64_t *b, size_t n);
+
+void i64_add_scalar(int64_t *out, const int64_t *a, int64_t k, size_t n);
+
+void i64_mul_scalar(int64_t *out, const int64_t *a, int64_t k, size_t n);
+
+void i64_subtract_from(int64_t *out, int64_t k, const int64_t *a, size_t n);
+
+int64_t i64_dot(const int64_t *a, const int64_t *b, size_t n);
+
+int64_t i64_sum(const int64_t *a, size_t n);
+
+/* Turns the AVX2 kernels off, or back on where the CPU has them, e.g. to
+   compare against the scalar ones */
+void set_vector_simd(int enabled);
+
+/*
+ * vec-map runs a kernel instead of calling its function per element when
+ * the function is one of these lambdas, where k is a number or a variable
+ * bound to one:
+ *
+ *   (lambda (x) (+ x k))  (+ k x)  (- x k)  (- k x)
+ *   (lambda (x) (* x k))  (* k x)  (* x x)  (+ x x)
+ */
+typedef enum {
+  MAP_ADD,                      /* x + k */
+  MAP_MUL,                      /* x * k */
+  MAP_SUBTRACT_FROM,            /* k - x */
+  MAP_SQUARE                    /* x * x */
+} vector_map_op;
+
+typedef struct {
+  vector_map_op op;
+  double k;
+} vector_map_t;
+
+/* Returns whether f is one of those, filling in map if it is */
+int vector_map_kernel(lisp_object_t *f, vector_map_t *map);
+
+#endif